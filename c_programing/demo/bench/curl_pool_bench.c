@@ -0,0 +1,187 @@
+// Measure the latency of HTTPS requests made the way the AI integration
+// used to (a new easy handle per request, so every request resolves the
+// name, connects and does a full TLS handshake) against the way it does
+// now (handles kept between requests, each with its own connection, sharing
+// one DNS and TLS session cache).
+//
+// Each thread sends its requests one after the other. For the pooled
+// handles the first request of each thread is reported apart: it finds the
+// pool cold and has to open a connection, the others find it warm. p50,
+// p99 and the number of connections opened are printed per row.
+//
+// Usage: build/bin/curl_pool_bench URL [threads] [requests_per_thread] [ca_file]
+//   Built by `make bench`. ca_file verifies a test server's own certificate.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <curl/curl.h>
+
+static const char *url;
+static const char *ca_file;
+static int requests_per_thread;
+static int use_pool;
+static CURLSH *share;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+typedef struct {
+    double *latencies;      // Milliseconds, one per request
+    long connections;       // Connections opened
+} worker_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void lock_share(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    (void)userptr;
+    pthread_mutex_lock(&share_locks[data]);
+}
+
+static void unlock_share(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    (void)userptr;
+    pthread_mutex_unlock(&share_locks[data]);
+}
+
+// Throw the response away
+static size_t discard(void *contents, size_t size, size_t nmemb, void *userp) {
+    (void)contents;
+    (void)userp;
+    return size * nmemb;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *worker = arg;
+    CURL *pooled = NULL;
+    for (int i = 0; i < requests_per_thread; i++) {
+        double start = now_ms();
+        CURL *curl = pooled;
+        if (curl == NULL) {
+            curl = curl_easy_init();
+            if (use_pool) {
+                curl_easy_setopt(curl, CURLOPT_SHARE, share);
+            }
+        }
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard);
+        if (ca_file != NULL) {
+            curl_easy_setopt(curl, CURLOPT_CAINFO, ca_file);
+        }
+        CURLcode res = curl_easy_perform(curl);
+        if (res != CURLE_OK) {
+            fprintf(stderr, "Request failed: %s\n", curl_easy_strerror(res));
+        }
+        long connections = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connections);
+        worker->connections += connections;
+        if (use_pool) {
+            curl_easy_reset(curl);
+            pooled = curl;
+        } else {
+            curl_easy_cleanup(curl);
+        }
+        worker->latencies[i] = now_ms() - start;
+    }
+    if (pooled != NULL) {
+        curl_easy_cleanup(pooled);
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_row(const char *name, double *latencies, size_t count, long connections) {
+    if (count == 0) {
+        return;
+    }
+    qsort(latencies, count, sizeof(double), compare_double);
+    printf("%-12s %10zu %10.2f %10.2f %12ld\n", name, count, latencies[count / 2], latencies[count * 99 / 100],
+           connections);
+}
+
+static void run(int threads) {
+    if (use_pool) {
+        // A fresh share, so the pool starts cold
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_share);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    for (int t = 0; t < threads; t++) {
+        workers[t].latencies = malloc(requests_per_thread * sizeof(double));
+        pthread_create(&tids[t], NULL, worker_main, &workers[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    // Split the first request of each thread from the others
+    double *cold = malloc(threads * sizeof(double));
+    double *warm = malloc((size_t)threads * requests_per_thread * sizeof(double));
+    size_t warm_count = 0;
+    long connections = 0;
+    for (int t = 0; t < threads; t++) {
+        cold[t] = workers[t].latencies[0];
+        memcpy(warm + warm_count, workers[t].latencies + 1, (requests_per_thread - 1) * sizeof(double));
+        warm_count += requests_per_thread - 1;
+        connections += workers[t].connections;
+        free(workers[t].latencies);
+    }
+    if (use_pool) {
+        print_row("pool cold", cold, threads, connections);
+        print_row("pool warm", warm, warm_count, 0);
+        curl_share_cleanup(share);
+    } else {
+        // Every request is cold without the pool
+        memcpy(warm + warm_count, cold, threads * sizeof(double));
+        print_row("fresh", warm, warm_count + threads, connections);
+    }
+
+    free(cold);
+    free(warm);
+    free(workers);
+    free(tids);
+}
+
+int main(int argc, char *argv[]) {
+    url = argc > 1 ? argv[1] : NULL;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    requests_per_thread = argc > 3 ? atoi(argv[3]) : 50;
+    ca_file = argc > 4 ? argv[4] : NULL;
+    if (url == NULL || threads <= 0 || requests_per_thread <= 1) {
+        fprintf(stderr, "Usage: %s URL [threads] [requests_per_thread] [ca_file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&share_locks[i], NULL);
+    }
+
+    printf("%s: %d threads, %d requests each\n\n", url, threads, requests_per_thread);
+    printf("%-12s %10s %10s %10s %12s\n", "mode", "requests", "p50 ms", "p99 ms", "connections");
+
+    use_pool = 0;
+    run(threads);
+
+    use_pool = 1;
+    run(threads);
+
+    curl_global_cleanup();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+// Measure how long a request thread spends logging one line when the
+// output is slow: printf-style line-buffered writes to the stream, as the
+// server did before, against log_message, which only fills a record in
+// the thread's ring.
+//
+// The stream is a pipe read by a thread that accepts a limited number of
+// bytes per second, like a terminal or a log collector that falls behind.
+// Each worker thread logs request lines at a steady rate and records the
+// latency of every call; p50, p99 and the worst call are printed in
+// microseconds together with the number of lines the logger dropped.
+//
+// Usage: build/bin/log_bench [threads] [lines_per_thread] [sink_kb_per_s]
+//   Built by `make bench`.
+
+#include "../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static int lines_per_thread;
+static int use_logger;
+static FILE *sink;
+static int sink_kb_per_s;
+static volatile int sink_open = 1;
+
+typedef struct {
+    int id;
+    double *latencies;      // Microseconds, one per line
+} worker_t;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Read from the pipe at no more than sink_kb_per_s
+static void *slow_reader(void *arg) {
+    int fd = *(int *)arg;
+    char buf[1024];
+    while (sink_open) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        usleep((useconds_t)(n * 1000000L / (sink_kb_per_s * 1024L)));
+    }
+    return NULL;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *worker = arg;
+    for (int i = 0; i < lines_per_thread; i++) {
+        double start = now_us();
+        if (use_logger) {
+            log_message(LOG_LEVEL_INFO, "GET /run/file_operations worker=%d n=%d", worker->id, i);
+        } else {
+            fprintf(sink, "Received request: GET /run/file_operations worker=%d n=%d\n", worker->id, i);
+        }
+        worker->latencies[i] = now_us() - start;
+        usleep(100);    // The rest of the request
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *name, int threads) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    sink = fdopen(fds[1], "w");
+    setvbuf(sink, NULL, _IOLBF, 0);     // Like stdout on a terminal
+    sink_open = 1;
+    pthread_t reader;
+    pthread_create(&reader, NULL, slow_reader, &fds[0]);
+
+    if (use_logger) {
+        logger_start(sink, LOG_LEVEL_INFO);
+    }
+
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    for (int t = 0; t < threads; t++) {
+        workers[t].id = t;
+        workers[t].latencies = malloc(lines_per_thread * sizeof(double));
+        pthread_create(&tids[t], NULL, worker_main, &workers[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    logger_stats_t stats = {0, 0};
+    if (use_logger) {
+        // Stop reading slowly so the writer can flush what it holds
+        sink_kb_per_s = 1 << 20;
+        logger_stop();
+        logger_get_stats(&stats);
+    }
+    sink_open = 0;
+    fclose(sink);
+    pthread_join(reader, NULL);
+    close(fds[0]);
+
+    size_t total = (size_t)threads * lines_per_thread;
+    double *all = malloc(total * sizeof(double));
+    for (int t = 0; t < threads; t++) {
+        memcpy(all + (size_t)t * lines_per_thread, workers[t].latencies, lines_per_thread * sizeof(double));
+        free(workers[t].latencies);
+    }
+    qsort(all, total, sizeof(double), compare_double);
+    printf("%-10s %10.1f %10.1f %10.1f %10lu\n", name, all[total / 2], all[total * 99 / 100],
+           all[total - 1], stats.dropped);
+
+    free(all);
+    free(workers);
+    free(tids);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    lines_per_thread = argc > 2 ? atoi(argv[2]) : 5000;
+    int kb_per_s = argc > 3 ? atoi(argv[3]) : 256;
+    if (threads <= 0 || lines_per_thread <= 0 || kb_per_s <= 0) {
+        fprintf(stderr, "Usage: %s [threads] [lines_per_thread] [sink_kb_per_s]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d threads, %d lines each, output drained at %d KB/s\n\n", threads, lines_per_thread, kb_per_s);
+    printf("%-10s %10s %10s %10s %10s\n", "mode", "p50 us", "p99 us", "max us", "dropped");
+
+    sink_kb_per_s = kb_per_s;
+    use_logger = 0;
+    run("printf", threads);
+
+    sink_kb_per_s = kb_per_s;
+    use_logger = 1;
+    run("logger", threads);
+    return EXIT_SUCCESS;
+}
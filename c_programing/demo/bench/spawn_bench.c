@@ -0,0 +1,162 @@
+// Compare demo spawn latency of forking the server process directly with
+// asking the zygote, as the resident size of the server grows.
+//
+// Each run starts a child that prints one line and exits, and is timed
+// until its output pipe reaches EOF. The benchmark grows its own heap in
+// steps (touching every page, like a server with a warm cache) and keeps a
+// few idle threads around to mimic the web server's worker pool.
+//
+// Usage: build/bin/spawn_bench [runs_per_size] [max_mb]
+//   Built by `make bench`.
+
+#include "../include/demo_zygote.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#define IDLE_THREADS 4
+
+static void runner(unsigned int index) {
+    printf("demo %u\n", index);
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void drain(int fd) {
+    char buf[256];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+    close(fd);
+}
+
+// Fork this process, as the server does without a zygote
+static double spawn_direct(void) {
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+        return -1;
+    }
+
+    double start = now_us();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        runner(0);
+        fflush(stdout);
+        _exit(0);
+    }
+    close(pipefd[1]);
+    if (pid == -1) {
+        close(pipefd[0]);
+        return -1;
+    }
+    drain(pipefd[0]);
+    waitpid(pid, NULL, 0);
+    return now_us() - start;
+}
+
+// Ask the zygote for a worker
+static double spawn_zygote(void) {
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+        return -1;
+    }
+
+    double start = now_us();
+    pid_t pid = demo_zygote_spawn(0, pipefd[1]);
+    close(pipefd[1]);
+    if (pid == -1) {
+        close(pipefd[0]);
+        return -1;
+    }
+    drain(pipefd[0]);
+    return now_us() - start;
+}
+
+static double average(double (*spawn)(void), int runs) {
+    double total = 0;
+    for (int i = 0; i < runs; i++) {
+        double us = spawn();
+        if (us < 0) {
+            return -1;
+        }
+        total += us;
+    }
+    return total / runs;
+}
+
+static long rss_kb(void) {
+    FILE *file = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+    if (file == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return kb;
+}
+
+static void *idle_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        pause();
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int runs = argc > 1 ? atoi(argv[1]) : 200;
+    size_t max_mb = argc > 2 ? (size_t)atoi(argv[2]) : 1024;
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    // Like the server: zygote first, while the process is small
+    if (demo_zygote_start(&runner) != 0) {
+        fprintf(stderr, "Failed to start zygote\n");
+        return 1;
+    }
+
+    pthread_t threads[IDLE_THREADS];
+    for (int i = 0; i < IDLE_THREADS; i++) {
+        pthread_create(&threads[i], NULL, idle_thread, NULL);
+    }
+
+    printf("%10s %12s %16s %16s\n", "heap (MB)", "RSS (KB)", "fork (us)", "zygote (us)");
+
+    size_t heap_mb = 0;
+    for (size_t target = 0; target <= max_mb; target = target ? target * 4 : 16) {
+        // Grow the heap to the target size, touching every page
+        while (heap_mb < target) {
+            char *block = malloc(1024 * 1024);
+            if (block == NULL) {
+                fprintf(stderr, "Out of memory at %zu MB\n", heap_mb);
+                goto done;
+            }
+            memset(block, 1, 1024 * 1024);
+            heap_mb++;
+        }
+
+        double direct = average(spawn_direct, runs);
+        double zygote = average(spawn_zygote, runs);
+        printf("%10zu %12ld %16.1f %16.1f\n", heap_mb, rss_kb(), direct, zygote);
+    }
+
+done:
+    demo_zygote_stop();
+    return 0;
+}
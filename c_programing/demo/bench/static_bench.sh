@@ -0,0 +1,56 @@
+#!/bin/bash
+# Compare static file throughput and server RSS between the in-memory path
+# (-z 0) and the sendfile path for files from 1 KB to 100 MB.
+#
+# Usage: bench/static_bench.sh [requests_per_size]
+#   Run from the demo/ directory after `make web`. Uses curl only.
+
+REQUESTS=${1:-20}
+PORT=${BENCH_PORT:-18081}
+SERVER=./build/bin/web_server
+BENCH_DIR=web/bench
+SIZES="1K 64K 1M 10M 100M"
+
+if [ ! -x "$SERVER" ]; then
+    echo "Web server not built, run 'make web' first" >&2
+    exit 1
+fi
+
+mkdir -p "$BENCH_DIR"
+for size in $SIZES; do
+    head -c "$size" /dev/urandom > "$BENCH_DIR/file_$size.png"
+done
+trap 'rm -rf "$BENCH_DIR"' EXIT
+
+# Print MB/s for REQUESTS sequential downloads of one file
+measure_throughput() {
+    local url="http://127.0.0.1:$PORT/bench/file_$1.png"
+    local start end bytes
+    start=$(date +%s.%N)
+    bytes=0
+    for _ in $(seq "$REQUESTS"); do
+        bytes=$((bytes + $(curl -s -o /dev/null -w '%{size_download}' "$url")))
+    done
+    end=$(date +%s.%N)
+    echo "$bytes $start $end" | awk '{printf "%.1f", $1 / ($3 - $2) / 1048576}'
+}
+
+printf "%-10s %-8s %12s %12s\n" "mode" "size" "MB/s" "RSS (KB)"
+for mode in memory sendfile; do
+    if [ "$mode" = "memory" ]; then
+        "$SERVER" -p "$PORT" -z 0 -c 512 >/dev/null 2>&1 &
+    else
+        "$SERVER" -p "$PORT" >/dev/null 2>&1 &
+    fi
+    server_pid=$!
+    sleep 1
+
+    for size in $SIZES; do
+        throughput=$(measure_throughput "$size")
+        rss=$(awk '/VmRSS/ {print $2}' "/proc/$server_pid/status")
+        printf "%-10s %-8s %12s %12s\n" "$mode" "$size" "$throughput" "$rss"
+    done
+
+    kill -INT "$server_pid"
+    wait "$server_pid" 2>/dev/null
+done
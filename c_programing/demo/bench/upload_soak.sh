@@ -0,0 +1,54 @@
+#!/bin/bash
+# Soak test for POST handling: send thousands of /api/chat uploads that are
+# abandoned half way (the connection is closed before the announced body has
+# arrived) and print the server's RSS as it goes. Each request's arena is
+# given back to the pool when MHD reports the request completed, so RSS
+# should level off after the first round instead of growing with every batch.
+#
+# Usage: bench/upload_soak.sh [uploads] [parallel]
+#   Run from the demo/ directory after `make web`. Uses bash's /dev/tcp only.
+
+UPLOADS=${1:-5000}
+PARALLEL=${2:-50}
+PORT=${BENCH_PORT:-18082}
+SERVER=./build/bin/web_server
+REPORT_EVERY=1000
+
+if [ ! -x "$SERVER" ]; then
+    echo "Web server not built, run 'make web' first" >&2
+    exit 1
+fi
+
+# Announce a 60 KB body, send about 8 KB of an unterminated string, then hang up
+abort_upload() {
+    exec 3<>"/dev/tcp/127.0.0.1/$PORT" || return
+    printf 'POST /api/chat HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\nContent-Length: 61440\r\n\r\n' >&3
+    printf '{"message":"%s' "$(head -c 8192 /dev/zero | tr '\0' 'a')" >&3
+    exec 3>&-
+}
+
+rss_kb() {
+    awk '/VmRSS/ {print $2}' "/proc/$server_pid/status"
+}
+
+"$SERVER" -p "$PORT" >/dev/null 2>&1 &
+server_pid=$!
+trap 'kill -INT "$server_pid" 2>/dev/null; wait "$server_pid" 2>/dev/null' EXIT
+sleep 1
+
+printf "%10s %12s\n" "uploads" "RSS (KB)"
+printf "%10s %12s\n" 0 "$(rss_kb)"
+sent=0
+while [ "$sent" -lt "$UPLOADS" ]; do
+    pids=()
+    for _ in $(seq "$PARALLEL"); do
+        abort_upload 2>/dev/null &
+        pids+=($!)
+    done
+    wait "${pids[@]}"
+    sent=$((sent + PARALLEL))
+    if [ $((sent % REPORT_EVERY)) -eq 0 ]; then
+        sleep 0.2   # Let the server notice the closed connections
+        printf "%10s %12s\n" "$sent" "$(rss_kb)"
+    fi
+done
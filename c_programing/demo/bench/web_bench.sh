@@ -0,0 +1,55 @@
+#!/bin/bash
+# Measure web server throughput (requests/sec) and mean latency for the main
+# page, a static asset and a demo run at several worker thread counts.
+#
+# Usage: bench/web_bench.sh [duration_seconds] [thread counts...]
+#   Run from the demo/ directory after `make web`. Requires wrk or ab.
+
+DURATION=${1:-10}
+shift
+THREAD_COUNTS=${@:-"1 4 16"}
+PORT=${BENCH_PORT:-18080}
+SERVER=./build/bin/web_server
+CONNECTIONS=${BENCH_CONNECTIONS:-64}
+ENDPOINTS="/ /css/style.css /run/system_info_operations"
+
+if [ ! -x "$SERVER" ]; then
+    echo "Web server not built, run 'make web' first" >&2
+    exit 1
+fi
+
+if command -v wrk >/dev/null 2>&1; then
+    TOOL=wrk
+elif command -v ab >/dev/null 2>&1; then
+    TOOL=ab
+else
+    echo "Neither wrk nor ab found, install one of them" >&2
+    exit 1
+fi
+
+# Print "requests/sec mean-latency" for one endpoint
+run_load() {
+    local url="http://127.0.0.1:$PORT$1"
+    if [ "$TOOL" = "wrk" ]; then
+        wrk -t4 -c"$CONNECTIONS" -d"${DURATION}s" "$url" |
+            awk '/Latency/ {lat = $2} /Requests\/sec/ {rps = $2} END {print rps, lat}'
+    else
+        ab -q -k -c "$CONNECTIONS" -t "$DURATION" -n 10000000 "$url" |
+            awk '/Requests per second/ {rps = $4} /Time per request.*\(mean\)$/ {lat = $4 "ms"} END {print rps, lat}'
+    fi
+}
+
+printf "%-8s %-32s %12s %12s\n" "threads" "endpoint" "req/sec" "latency"
+for threads in $THREAD_COUNTS; do
+    "$SERVER" -p "$PORT" -t "$threads" >/dev/null 2>&1 &
+    server_pid=$!
+    sleep 1
+
+    for endpoint in $ENDPOINTS; do
+        read -r rps latency <<< "$(run_load "$endpoint")"
+        printf "%-8s %-32s %12s %12s\n" "$threads" "$endpoint" "$rps" "$latency"
+    done
+
+    kill -INT "$server_pid"
+    wait "$server_pid" 2>/dev/null
+done
@@ -0,0 +1,108 @@
+#ifndef AI_CACHE_H
+#define AI_CACHE_H
+
+/**
+ * @file ai_cache.h
+ * @brief Cache of AI responses keyed by a fingerprint of the prompt
+ *
+ * The key is a 128-bit hash of everything that decides the answer: the
+ * model, the temperature and every message of the prompt, which includes
+ * the versioned project context. Responses are kept in memory with LRU
+ * eviction under a byte cap and, optionally, in a memory-mapped file that
+ * survives restarts. The file is split into sets of fixed-size slots; each
+ * slot carries a checksum, so a slot torn by a crash reads as empty.
+ */
+
+#include "ai_integration.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Default memory cap for cached responses
+#define DEFAULT_AI_CACHE_BYTES (8 * 1024 * 1024)
+// Responses kept in the cache file
+#define AI_CACHE_DISK_SLOTS 1024
+// Size of a slot in the cache file; larger responses stay in memory only
+#define AI_CACHE_DISK_SLOT_SIZE (16 * 1024)
+// Slots a response may land in, the oldest of which is replaced
+#define AI_CACHE_DISK_WAYS 4
+
+// Fingerprint of a prompt
+typedef struct {
+    uint64_t a;
+    uint64_t b;
+} ai_cache_key_t;
+
+// Where a lookup found its response
+typedef enum {
+    AI_CACHE_MISS,
+    AI_CACHE_HIT_MEMORY,
+    AI_CACHE_HIT_DISK
+} ai_cache_result_t;
+
+typedef struct {
+    uint64_t memory_hits;
+    uint64_t disk_hits;
+    uint64_t misses;
+    uint64_t bypasses;      // Requests that asked not to be answered from the cache
+    size_t entries;         // Responses in memory
+    size_t bytes;           // Their size
+    size_t disk_entries;    // Responses in the cache file
+} ai_cache_stats_t;
+
+/**
+ * @brief Set up the cache
+ * @param max_bytes Memory cap for cached responses
+ * @param disk_path Cache file, created if needed, or NULL for memory only
+ * @return 0 on success, -1 if the cache file could not be opened (the
+ *         memory tier works anyway)
+ */
+int ai_cache_init(size_t max_bytes, const char *disk_path);
+
+/**
+ * @brief Free the memory tier and unmap the cache file
+ */
+void ai_cache_shutdown(void);
+
+/**
+ * @brief Compute the key of a prompt
+ * @param key Output for the key
+ * @param model Model name
+ * @param temperature Sampling temperature
+ * @param prompt The prompt as it will be sent
+ */
+void ai_cache_key(ai_cache_key_t *key, const char *model, float temperature, const ai_prompt_t *prompt);
+
+/**
+ * @brief Look up a response; a disk hit is copied into memory
+ * @param key Key of the prompt
+ * @param len Output for the length of the response
+ * @param result Output for where it was found (may be NULL)
+ * @return Malloc'd copy of the response, or NULL on a miss
+ */
+char *ai_cache_lookup(const ai_cache_key_t *key, size_t *len, ai_cache_result_t *result);
+
+/**
+ * @brief Look up a response without counting a hit or a miss
+ *
+ * For a second look on behalf of a request already counted, e.g. one that
+ * waited for a worker while an identical request was being answered.
+ * @return Malloc'd copy of the response, or NULL if it is not cached
+ */
+char *ai_cache_peek(const ai_cache_key_t *key, size_t *len);
+
+/**
+ * @brief Keep a complete response, replacing any under the same key
+ */
+void ai_cache_store(const ai_cache_key_t *key, const char *response, size_t len);
+
+/**
+ * @brief Count a request that skipped the lookup
+ */
+void ai_cache_count_bypass(void);
+
+/**
+ * @brief Read the counters and sizes of the cache
+ */
+void ai_cache_get_stats(ai_cache_stats_t *stats);
+
+#endif /* AI_CACHE_H */
@@ -7,6 +7,35 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Model used when none is specified
+#define AI_DEFAULT_MODEL "deepseek-chat"
+
+/**
+ * @brief A prompt split by how often its parts change
+ *
+ * The messages are sent in this order. The provider caches the prompt
+ * prefixes it has seen, so text that is the same from call to call belongs
+ * in the first two parts, and text that differs per question in the last.
+ */
+typedef struct {
+    const char *system;     // Instructions that never change (may be NULL)
+    const char *context;    // Context that changes rarely, labelled with its version (may be NULL)
+    const char *question;   // The user turn
+} ai_prompt_t;
+
+/**
+ * @brief Token counts reported for a completion
+ */
+typedef struct {
+    bool reported;                  // The response carried the counts
+    uint64_t prompt_tokens;
+    uint64_t cache_hit_tokens;      // Prompt tokens read from the provider's prefix cache
+    uint64_t cache_miss_tokens;     // Prompt tokens processed from scratch
+    uint64_t completion_tokens;
+} ai_usage_t;
 
 /**
  * @brief Initialize the AI subsystem with the provided API key
@@ -22,8 +51,19 @@ bool ai_init(const char *api_key);
  */
 bool ai_init_from_env_file(const char *env_file_path);
 
+/**
+ * @brief Check whether an API key is loaded
+ *
+ * The key may be reloaded while calls are running on other threads; they
+ * copy it under a lock.
+ */
+bool ai_is_initialized(void);
+
 /**
  * @brief Cleanup and free resources used by the AI subsystem
+ *
+ * Closes the idle connections to the API. libcurl is set up once per
+ * process and stays set up, so ai_init may be called again.
  */
 void ai_cleanup(void);
 
@@ -35,12 +75,72 @@ void ai_cleanup(void);
  */
 char *ai_generate_text(const char *prompt, const char *model_name);
 
+/**
+ * @brief Send a structured prompt to DeepSeek AI and get a response
+ *
+ * Identical requests made while a call is in progress wait for that call
+ * and get a copy of its answer instead of making their own. Only the
+ * request that made the call gets the token counts.
+ * @param prompt The prompt; its question must not be empty
+ * @param model_name Optional model name (NULL for default)
+ * @param usage Output for the token counts (may be NULL)
+ * @return AI-generated response (caller must free this memory)
+ */
+char *ai_generate_chat(const ai_prompt_t *prompt, const char *model_name, ai_usage_t *usage);
+
+/**
+ * @brief Counts of calls made to DeepSeek
+ */
+typedef struct {
+    uint64_t calls;         // Calls sent to the API
+    uint64_t coalesced;     // Requests that shared an identical call already in progress
+    uint64_t connections_opened;    // Calls that had to open a connection (DNS, TCP, TLS)
+    uint64_t connections_reused;    // Calls sent on a connection left open by an earlier one
+} ai_call_stats_t;
+
+/**
+ * @brief Called with each piece of the response as the AI generates it
+ * @param text The new text (not NUL-terminated)
+ * @param len Length of the text
+ * @param ctx Context pointer given to ai_generate_text_stream
+ * @return True to continue, false to stop the generation
+ */
+typedef bool (*ai_token_callback_t)(const char *text, size_t len, void *ctx);
+
+/**
+ * @brief Send a prompt to DeepSeek AI and receive the response as it is generated
+ *
+ * Requests a streamed completion and parses the server-sent events as they
+ * arrive, calling on_token for every piece of text. As with
+ * ai_generate_chat, identical requests share one call; if the request that
+ * made it stops, the call goes on as long as another one follows it.
+ * @param prompt The prompt; its question must not be empty
+ * @param model_name Optional model name (NULL for default)
+ * @param on_token Function called with each piece of the response
+ * @param ctx Context pointer passed to on_token
+ * @param usage Output for the token counts, sent after the last piece (may be NULL)
+ * @return The response (caller must free this memory), cut short if the
+ *         stream broke off, or NULL if no text arrived or the call was stopped
+ */
+char *ai_generate_text_stream(const ai_prompt_t *prompt, const char *model_name, ai_token_callback_t on_token,
+                              void *ctx, ai_usage_t *usage);
+
+/**
+ * @brief Read the counts of calls made and shared
+ */
+void ai_get_call_stats(ai_call_stats_t *stats);
+
 /**
  * @brief Set temperature for AI generation (controls randomness)
  * @param temp Temperature value between 0.0 and 1.0
  */
 void ai_set_temperature(float temp);
 
+/**
+ * @brief Current temperature for AI generation
+ */
+float ai_get_temperature(void);
+
 /**
  * @brief Run an interactive AI demo using DeepSeek
  */
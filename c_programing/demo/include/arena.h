@@ -0,0 +1,107 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/**
+ * @file arena.h
+ * @brief Per-request memory arenas backed by a pool of fixed-size blocks
+ *
+ * Each request takes an arena from the pool and allocates from it with a
+ * pointer bump; nothing is freed individually. Releasing the arena hands
+ * all of its blocks back to the pool at once, which keeps them for the
+ * next request up to a configured number of free blocks. Every arena has
+ * its own memory limit, so a single request cannot grow without bound.
+ */
+
+#include <stddef.h>
+
+// Default size of a pooled block
+#define ARENA_DEFAULT_BLOCK_SIZE (16 * 1024)
+
+typedef struct arena_pool arena_pool_t;
+typedef struct arena arena_t;
+
+// Counters of a pool
+typedef struct {
+    size_t arenas_in_use;       // Arenas acquired and not yet released
+    size_t blocks_in_use;       // Pooled blocks held by arenas
+    size_t blocks_free;         // Pooled blocks kept for reuse
+    unsigned long limit_failures;   // Allocations refused by an arena's limit
+} arena_pool_stats_t;
+
+/**
+ * @brief Create a pool
+ * @param block_size Size of each block, including its header
+ * @param max_free_blocks Number of released blocks kept for reuse; more
+ *        are returned to the system
+ * @return The pool, or NULL on allocation failure
+ */
+arena_pool_t *arena_pool_create(size_t block_size, size_t max_free_blocks);
+
+/**
+ * @brief Free a pool and the blocks it keeps
+ *
+ * All arenas must have been released.
+ * @param pool The pool (may be NULL)
+ */
+void arena_pool_free(arena_pool_t *pool);
+
+/**
+ * @brief Read the counters of a pool
+ * @param pool The pool
+ * @param stats Output for the counters
+ */
+void arena_pool_get_stats(arena_pool_t *pool, arena_pool_stats_t *stats);
+
+/**
+ * @brief Take an empty arena from the pool
+ *
+ * Thread-safe. The arena itself is not: one request uses it at a time.
+ * @param pool The pool
+ * @param limit Maximum memory the arena may hold, counted in whole blocks
+ *        plus any allocation larger than a block
+ * @return The arena, or NULL if the limit is below one block or on
+ *         allocation failure
+ */
+arena_t *arena_acquire(arena_pool_t *pool, size_t limit);
+
+/**
+ * @brief Give an arena and everything allocated from it back to the pool
+ * @param arena The arena (may be NULL)
+ */
+void arena_release(arena_t *arena);
+
+/**
+ * @brief Allocate memory aligned for any type
+ * @param arena The arena
+ * @param size Number of bytes
+ * @return The memory, or NULL if the arena's limit would be exceeded
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Allocate zeroed memory
+ * @param arena The arena
+ * @param size Number of bytes
+ * @return The memory, or NULL if the arena's limit would be exceeded
+ */
+void *arena_calloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Grow an allocation, in place if it is the latest one and fits
+ * @param arena The arena
+ * @param ptr Allocation to grow (NULL allocates)
+ * @param old_size Current size of the allocation
+ * @param new_size Requested size
+ * @return The grown allocation (contents preserved), or NULL if the limit
+ *         would be exceeded, in which case ptr stays valid
+ */
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * @brief Memory charged against an arena's limit so far
+ * @param arena The arena
+ * @return Bytes in the arena's blocks and large allocations
+ */
+size_t arena_used(const arena_t *arena);
+
+#endif /* ARENA_H */
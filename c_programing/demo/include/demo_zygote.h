@@ -0,0 +1,59 @@
+#ifndef DEMO_ZYGOTE_H
+#define DEMO_ZYGOTE_H
+
+/**
+ * @file demo_zygote.h
+ * @brief Helper process that forks demo workers on behalf of the server
+ *
+ * The zygote is forked once at startup, before the server creates threads
+ * or grows its heap, and afterwards only forks workers from its own small
+ * single-threaded image. The server sends it a demo index together with the
+ * write end of an output pipe (SCM_RIGHTS over a Unix socket); the worker
+ * runs the demo with stdout and stderr on that pipe. Spawn cost therefore
+ * stays flat however large the server process becomes.
+ *
+ * Workers are reaped by the zygote, not by the server: the caller sees a
+ * demo finish when the pipe reaches EOF. A reaped worker's PID may already
+ * belong to another process, so the caller stops a worker early through
+ * the pidfd the zygote returns with it, never with kill().
+ */
+
+#include <sys/types.h>
+
+// Runs demo 'index' inside a freshly forked worker
+typedef void (*demo_zygote_runner_t)(unsigned int index);
+
+/**
+ * @brief Fork the zygote process
+ *
+ * Must be called while the server is still single-threaded.
+ * @param runner Function the workers call to run a demo
+ * @return 0 on success, -1 on error
+ */
+int demo_zygote_start(demo_zygote_runner_t runner);
+
+/**
+ * @brief Ask the zygote to start a worker
+ *
+ * Thread-safe. The caller keeps its own copy of output_fd and should close
+ * it after the call so the pipe reaches EOF when the worker exits.
+ * @param index Demo index passed to the runner
+ * @param output_fd Descriptor the worker uses as stdout and stderr
+ * @param pidfd Set to a pidfd for the worker, to signal it with
+ *        pidfd_send_signal() and close when done; -1 if the kernel has none
+ * @return Process ID of the worker, or -1 if the zygote is not running
+ */
+pid_t demo_zygote_spawn(unsigned int index, int output_fd, int *pidfd);
+
+/**
+ * @brief Check whether the zygote is available
+ * @return 1 if running, 0 otherwise
+ */
+int demo_zygote_running(void);
+
+/**
+ * @brief Stop the zygote and wait for it to exit
+ */
+void demo_zygote_stop(void);
+
+#endif /* DEMO_ZYGOTE_H */
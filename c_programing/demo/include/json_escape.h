@@ -0,0 +1,53 @@
+#ifndef JSON_ESCAPE_H
+#define JSON_ESCAPE_H
+
+/**
+ * @file json_escape.h
+ * @brief Escaping of text for JSON string literals
+ *
+ * Quotes, backslashes and control characters are escaped; valid UTF-8 is
+ * copied unchanged and each invalid byte becomes U+FFFD. Runs of bytes that
+ * need no escaping are found 16 (SSE2) or 32 (AVX2) bytes at a time and
+ * copied in one block. Callers size the output exactly with
+ * json_escaped_length before writing it with json_escape.
+ */
+
+#include <stddef.h>
+
+/**
+ * @brief Compute the length of the escaped form of a text
+ * @param src Text to escape (need not be NUL-terminated)
+ * @param len Length of the text
+ * @return Number of bytes json_escape writes, without quotes or terminator
+ */
+size_t json_escaped_length(const char *src, size_t len);
+
+/**
+ * @brief Escape a text into a buffer of json_escaped_length bytes
+ * @param dst Output buffer
+ * @param src Text to escape
+ * @param len Length of the text
+ * @return Number of bytes written (no terminator is added)
+ */
+size_t json_escape(char *dst, const char *src, size_t len);
+
+/**
+ * @brief Build a JSON document around an escaped string in one allocation
+ *
+ * The result is prefix, the escaped text, then suffix, e.g.
+ * json_wrap_string("{\"response\":\"", msg, len, "\"}", NULL).
+ * @param prefix Text written before the escaped string
+ * @param src Text to escape
+ * @param len Length of the text
+ * @param suffix Text written after the escaped string
+ * @param out_len Optional output for the length of the result
+ * @return Newly allocated NUL-terminated document (caller must free), or NULL
+ */
+char *json_wrap_string(const char *prefix, const char *src, size_t len, const char *suffix, size_t *out_len);
+
+/**
+ * @brief Name of the scanner selected for this CPU ("avx2", "sse2" or "scalar")
+ */
+const char *json_escape_implementation(void);
+
+#endif /* JSON_ESCAPE_H */
@@ -0,0 +1,103 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+/**
+ * @file json_stream.h
+ * @brief Incremental JSON tokenizer for request bodies
+ *
+ * The tokenizer is fed a document in chunks of any size, as they arrive
+ * from the network, and checks the full JSON grammar as it goes. Only the
+ * members of the top-level object named when the stream is created are
+ * kept (strings are unescaped to UTF-8); everything else is validated and
+ * dropped, so memory use does not grow with the document. The body size
+ * and the nesting depth of objects and arrays are limited.
+ */
+
+#include <stddef.h>
+#include "arena.h"
+
+// Result of feeding input; errors are sticky
+typedef enum {
+    JSON_STREAM_OK,             // Input accepted
+    JSON_STREAM_ERROR_SYNTAX,   // Not valid JSON
+    JSON_STREAM_ERROR_DEPTH,    // Objects and arrays nested too deeply
+    JSON_STREAM_ERROR_SIZE,     // Body larger than the limit
+    JSON_STREAM_ERROR_MEMORY    // Allocation failure or arena limit reached
+} json_stream_status_t;
+
+// Type of a captured member
+typedef enum {
+    JSON_TYPE_NONE,             // Member not present
+    JSON_TYPE_STRING,
+    JSON_TYPE_NUMBER,
+    JSON_TYPE_TRUE,
+    JSON_TYPE_FALSE,
+    JSON_TYPE_NULL,
+    JSON_TYPE_OBJECT,
+    JSON_TYPE_ARRAY
+} json_type_t;
+
+typedef struct json_stream json_stream_t;
+
+/**
+ * @brief Create a tokenizer
+ * @param arena Arena to allocate the tokenizer and captured values from,
+ *        or NULL to use malloc; running out of it is JSON_STREAM_ERROR_MEMORY
+ * @param fields NULL-terminated list of top-level member names to capture
+ *        (the strings must outlive the stream)
+ * @param max_size Maximum number of bytes in the document
+ * @param max_depth Maximum nesting of objects and arrays (at least 1)
+ * @return The tokenizer, or NULL on allocation failure
+ */
+json_stream_t *json_stream_create(arena_t *arena, const char *const *fields, size_t max_size,
+                                  unsigned int max_depth);
+
+/**
+ * @brief Free a tokenizer and the values it captured
+ *
+ * Does nothing for a tokenizer created in an arena; its memory is
+ * returned when the arena is released.
+ * @param stream The tokenizer (may be NULL)
+ */
+void json_stream_free(json_stream_t *stream);
+
+/**
+ * @brief Consume the next chunk of the document
+ * @param stream The tokenizer
+ * @param data Chunk of the document
+ * @param len Length of the chunk
+ * @return JSON_STREAM_OK, or the first error met so far
+ */
+json_stream_status_t json_stream_feed(json_stream_t *stream, const char *data, size_t len);
+
+/**
+ * @brief Signal the end of the document
+ * @param stream The tokenizer
+ * @return JSON_STREAM_OK if exactly one complete value was read, otherwise
+ *         the first error (an incomplete document is a syntax error)
+ */
+json_stream_status_t json_stream_finish(json_stream_t *stream);
+
+/**
+ * @brief Look up a captured member of the top-level object
+ *
+ * Valid after json_stream_finish returned JSON_STREAM_OK. If a member
+ * appears more than once, the last occurrence wins.
+ * @param stream The tokenizer
+ * @param name One of the names given to json_stream_create
+ * @param type Optional output for the member's type (JSON_TYPE_NONE if absent)
+ * @param len Optional output for the length of the value
+ * @return The unescaped string, the number's text or the literal, NUL-
+ *         terminated and owned by the stream; NULL if absent or if the
+ *         member is an object or array
+ */
+const char *json_stream_field(const json_stream_t *stream, const char *name, json_type_t *type, size_t *len);
+
+/**
+ * @brief Describe a status for error messages
+ * @param status A status returned by the tokenizer
+ * @return Static description
+ */
+const char *json_stream_strerror(json_stream_status_t status);
+
+#endif /* JSON_STREAM_H */
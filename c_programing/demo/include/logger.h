@@ -0,0 +1,85 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+/**
+ * @file logger.h
+ * @brief Asynchronous server log
+ *
+ * Every thread that logs gets its own single-producer ring of fixed-size
+ * records. Logging formats the message straight into the next free record
+ * and publishes it with one atomic store, without taking any lock or
+ * touching stdio. A background writer thread drains the rings, formats one
+ * compact line per record ("2026-01-02T15:04:05.123 I message") and writes
+ * them in batches. When a ring is full the message is dropped and counted
+ * instead of blocking the request, and the writer reports the drops.
+ *
+ * Before logger_start and after logger_stop, messages are written directly
+ * (warnings and errors to stderr, the rest to stdout).
+ */
+
+#include <stdio.h>
+
+// Records per thread ring (a power of two)
+#define LOG_RING_SLOTS 1024
+// Longest message kept, longer ones are truncated
+#define LOG_MESSAGE_MAX 224
+
+typedef enum {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+} log_level_t;
+
+// Counters since logger_start
+typedef struct {
+    unsigned long written;      // Lines written by the writer thread
+    unsigned long dropped;      // Messages lost because a ring was full
+} logger_stats_t;
+
+/**
+ * @brief Start the writer thread
+ * @param out Stream the lines are written to
+ * @param level Messages below this level are discarded
+ * @return 0 on success, -1 on error (messages are then written directly)
+ */
+int logger_start(FILE *out, log_level_t level);
+
+/**
+ * @brief Write out every pending message and stop the writer thread
+ *
+ * Call once the threads that log have stopped; later messages are written
+ * directly.
+ */
+void logger_stop(void);
+
+/**
+ * @brief Change the minimum level
+ * @param level Messages below this level are discarded
+ */
+void logger_set_level(log_level_t level);
+
+/**
+ * @brief Queue a message for the writer thread
+ *
+ * Never blocks; a trailing newline is not needed.
+ * @param level Severity of the message
+ * @param format printf-style format
+ */
+void log_message(log_level_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Read the counters of the log
+ * @param stats Output for the counters
+ */
+void logger_get_stats(logger_stats_t *stats);
+
+/**
+ * @brief Parse a level name ("debug", "info", "warn" or "error")
+ * @param name Level name
+ * @param level Output for the level
+ * @return 0 on success, -1 if the name is unknown
+ */
+int log_level_parse(const char *name, log_level_t *level);
+
+#endif /* LOGGER_H */
@@ -0,0 +1,88 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+ * @file metrics.h
+ * @brief Counters and latency histograms in the Prometheus text format
+ *
+ * Series are registered once at startup. Every thread that records a value
+ * gets its own shard of counters, which only that thread writes, so
+ * recording is a plain add with no lock and no shared cache line. The
+ * shards are summed when the metrics are rendered; the counts of threads
+ * that exit are folded into a shared total first.
+ *
+ * Histograms have log2 buckets over microseconds, from 1 us to about 33 s,
+ * and are rendered in seconds.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of registered series of each kind
+#define METRICS_MAX_SERIES 64
+#define METRICS_MAX_HISTOGRAMS 32
+// Bucket i counts values of at most 2^i microseconds, the last one is +Inf
+#define METRICS_HISTOGRAM_BUCKETS 26
+
+typedef enum {
+    METRIC_COUNTER,     // Only goes up
+    METRIC_GAUGE,       // Goes up and down
+    METRIC_HISTOGRAM    // Distribution of durations
+} metric_type_t;
+
+// Reads the value of a series owned by another module when rendering
+typedef double (*metrics_read_t)(void *ctx);
+
+/**
+ * @brief Register a series
+ *
+ * Not thread-safe: register every series before any thread records.
+ * Series of one metric must be registered one after the other.
+ * @param type Kind of series
+ * @param name Metric name, e.g. "http_request_duration_seconds"
+ * @param labels Label pairs without braces, e.g. "route=\"/\"", or NULL
+ * @param help Description written once per metric
+ * @return Series id, or -1 if the table is full
+ */
+int metrics_register(metric_type_t type, const char *name, const char *labels, const char *help);
+
+/**
+ * @brief Register a counter or gauge whose value is read when rendering
+ * @param type METRIC_COUNTER or METRIC_GAUGE
+ * @param name Metric name
+ * @param labels Label pairs without braces, or NULL
+ * @param help Description written once per metric
+ * @param read Function returning the current value
+ * @param ctx Context passed to read
+ * @return 0 on success, -1 if the table is full
+ */
+int metrics_register_read(metric_type_t type, const char *name, const char *labels, const char *help,
+                          metrics_read_t read, void *ctx);
+
+/**
+ * @brief Add to a counter or gauge
+ * @param id Series id (ignored if negative)
+ * @param delta Amount to add, negative only for gauges
+ */
+void metrics_add(int id, int64_t delta);
+
+/**
+ * @brief Record a duration in a histogram
+ * @param id Series id (ignored if negative)
+ * @param microseconds Duration
+ */
+void metrics_observe(int id, uint64_t microseconds);
+
+/**
+ * @brief Monotonic clock in microseconds, for timing observations
+ */
+uint64_t metrics_now_us(void);
+
+/**
+ * @brief Render every series in the Prometheus text exposition format
+ * @param len Output for the length of the text
+ * @return Malloc'd text, or NULL on allocation failure
+ */
+char *metrics_render(size_t *len);
+
+#endif /* METRICS_H */
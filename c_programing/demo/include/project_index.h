@@ -0,0 +1,101 @@
+#ifndef PROJECT_INDEX_H
+#define PROJECT_INDEX_H
+
+/**
+ * @file project_index.h
+ * @brief Project overview for the AI prompt, kept up to date in the background
+ *
+ * A thread walks the project tree once, then follows it through inotify:
+ * each change updates the in-memory tree (and parses a source file again if
+ * one was written), and once the tree has been quiet for a moment a new
+ * snapshot is published by swapping one pointer. A snapshot holds the
+ * directory overview and an inverted index over the parsed sources, from
+ * which the context of each question is selected.
+ *
+ * The overview only changes with the tree, so it can open every prompt of
+ * a session unchanged; the snippets that depend on the question follow it.
+ *
+ * Snapshots are immutable. Readers take no lock: each reader thread owns a
+ * slot in which it announces the snapshot it is using, and the index thread
+ * frees a replaced snapshot only once no slot holds it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Deepest directory level listed below the root
+#define PROJECT_INDEX_MAX_DEPTH 5
+// Quiet time after a change before a new snapshot is published
+#define PROJECT_INDEX_SETTLE_MS 100
+// Threads that can hold a snapshot at the same time
+#define PROJECT_INDEX_MAX_READERS 256
+
+// A published overview of the project
+typedef struct {
+    uint64_t epoch;         // Starts at 1, increases with every snapshot
+    size_t files;           // Files listed
+    size_t dirs;            // Directories listed
+    size_t snippets;        // Source snippets indexed
+    uint64_t version;       // Hash of text: the same tree keeps the same version
+    size_t size;            // Length of text
+    const char *text;       // Directory tree
+} project_snapshot_t;
+
+// The parts of a prompt taken from a snapshot
+typedef struct {
+    const char *overview;   // Start of the snapshot's text, valid while it is held
+    size_t overview_len;
+    char *snippets;         // Malloc'd snippets relevant to the question, or NULL
+    size_t snippets_len;
+} project_context_t;
+
+/**
+ * @brief Start the index thread, which builds the first snapshot
+ * @param root_dir Project root, e.g. "."
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int project_index_start(const char *root_dir);
+
+/**
+ * @brief Stop the index thread and free every snapshot
+ *
+ * No snapshot may be held when this is called.
+ */
+void project_index_stop(void);
+
+/**
+ * @brief Get the current snapshot without taking a lock
+ *
+ * A thread may hold one snapshot at a time.
+ * @return The snapshot (release with project_index_release), or NULL if the
+ *         first one is not built yet
+ */
+const project_snapshot_t *project_index_acquire(void);
+
+/**
+ * @brief Stop using a snapshot from project_index_acquire
+ * @param snapshot The snapshot (may be NULL)
+ */
+void project_index_release(const project_snapshot_t *snapshot);
+
+/**
+ * @brief Select the project context for a question
+ *
+ * The directory tree takes up to half of the budget, cut at a line, and is
+ * the same for every question. The source snippets sharing the most telling
+ * terms with the question fill the rest, best first until the budget is
+ * spent and then put back in file order.
+ * @param snapshot A snapshot held by the caller
+ * @param question Text of the question
+ * @param token_budget Largest size of the context, in tokens
+ * @param context Output for the context; free its snippets when done
+ */
+void project_index_context(const project_snapshot_t *snapshot, const char *question, size_t token_budget,
+                           project_context_t *context);
+
+/**
+ * @brief Epoch of the current snapshot, 0 before the first one
+ */
+uint64_t project_index_epoch(void);
+
+#endif /* PROJECT_INDEX_H */
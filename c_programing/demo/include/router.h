@@ -0,0 +1,118 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+/**
+ * @file router.h
+ * @brief Trie-based HTTP route table
+ *
+ * Routes are stored in a byte trie, so a lookup costs one step per byte of
+ * the path no matter how many routes are registered. Patterns may contain
+ *   :name   a parameter matching one path segment ("/run/:demo")
+ *   *name   a wildcard matching the rest of the path
+ * Literal bytes take precedence over parameters, and parameters over
+ * wildcards. A route table is read-only once built and may be shared by
+ * any number of threads.
+ */
+
+#include <stddef.h>
+
+// Maximum number of parameters extracted from one path
+#define ROUTER_MAX_PARAMS 4
+
+// HTTP methods understood by the router
+typedef enum {
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_OPTIONS,
+    HTTP_METHOD_COUNT
+} http_method_t;
+
+// Method masks for router_add
+#define ROUTE_GET     (1u << HTTP_METHOD_GET)
+#define ROUTE_HEAD    (1u << HTTP_METHOD_HEAD)
+#define ROUTE_POST    (1u << HTTP_METHOD_POST)
+#define ROUTE_PUT     (1u << HTTP_METHOD_PUT)
+#define ROUTE_DELETE  (1u << HTTP_METHOD_DELETE)
+#define ROUTE_OPTIONS (1u << HTTP_METHOD_OPTIONS)
+
+typedef enum {
+    ROUTE_FOUND,
+    ROUTE_NOT_FOUND,
+    ROUTE_METHOD_NOT_ALLOWED
+} route_status_t;
+
+// A parameter extracted from the path (value points into the path, not terminated)
+typedef struct {
+    const char *name;
+    const char *value;
+    size_t len;
+} route_param_t;
+
+// Result of a lookup
+typedef struct {
+    int id;                 // Route identifier given to router_add
+    const void *ctx;        // Context pointer given to router_add
+    unsigned allowed;       // Methods registered for the matched path
+    size_t param_count;
+    route_param_t params[ROUTER_MAX_PARAMS];
+} route_match_t;
+
+typedef struct router router_t;
+
+/**
+ * @brief Create an empty route table
+ * @return The router, or NULL on allocation failure
+ */
+router_t *router_create(void);
+
+/**
+ * @brief Free a route table
+ * @param router The router to free
+ */
+void router_free(router_t *router);
+
+/**
+ * @brief Register a route
+ * @param router The route table
+ * @param methods Mask of ROUTE_* methods the route answers
+ * @param pattern Path pattern starting with '/'
+ * @param id Identifier returned on a match
+ * @param ctx Context pointer returned on a match
+ * @return 0 on success, -1 on an invalid pattern, a conflicting
+ *         parameter name or allocation failure
+ */
+int router_add(router_t *router, unsigned methods, const char *pattern, int id, const void *ctx);
+
+/**
+ * @brief Find the route for a request
+ * @param router The route table
+ * @param method Request method ("GET", "POST", ...)
+ * @param path Request path without the query string
+ * @param match Filled with the route and its parameters; on
+ *        ROUTE_METHOD_NOT_ALLOWED only 'allowed' is set
+ * @return ROUTE_FOUND, ROUTE_NOT_FOUND or ROUTE_METHOD_NOT_ALLOWED
+ */
+route_status_t router_match(const router_t *router, const char *method, const char *path,
+                            route_match_t *match);
+
+/**
+ * @brief Look up a parameter of a match by name
+ * @param match A successful match
+ * @param name Parameter name without the ':' or '*'
+ * @param len Output for the length of the value
+ * @return Start of the value inside the path, or NULL if absent
+ */
+const char *route_param(const route_match_t *match, const char *name, size_t *len);
+
+/**
+ * @brief Format a method mask for an Allow header ("GET, HEAD, POST")
+ * @param methods Mask of ROUTE_* methods
+ * @param buf Output buffer
+ * @param size Size of the output buffer
+ */
+void router_format_allow(unsigned methods, char *buf, size_t size);
+
+#endif /* ROUTER_H */
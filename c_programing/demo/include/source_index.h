@@ -0,0 +1,87 @@
+#ifndef SOURCE_INDEX_H
+#define SOURCE_INDEX_H
+
+/**
+ * @file source_index.h
+ * @brief Inverted index over source snippets, ranked against a question
+ *
+ * Each source file is cut into snippets of at most a few dozen lines, ending
+ * at the close of a top-level block where possible. The terms of a snippet
+ * are its identifiers, lowercased, together with their snake_case and
+ * camelCase parts and the words of the file's path. An index maps every
+ * term to the snippets containing it; a question is scored against it with
+ * BM25 and the best snippets that fit a token budget are returned.
+ *
+ * Parsed files and indexes are immutable once built. Files are reference
+ * counted, but not thread-safe: take and drop references on one thread.
+ */
+
+#include "arena.h"
+#include <stddef.h>
+
+// Lines after which a snippet is cut even inside a block
+#define SOURCE_SNIPPET_MAX_LINES 40
+// Files larger than this are not indexed
+#define SOURCE_MAX_FILE_BYTES (256 * 1024)
+// Rough size of a prompt token, for the budget
+#define SOURCE_BYTES_PER_TOKEN 4
+
+typedef struct source_file source_file_t;
+typedef struct source_index source_index_t;
+
+/**
+ * @brief Whether a file name is one of the indexed source types (.c, .h, Makefile)
+ */
+int source_file_is_indexed(const char *name);
+
+/**
+ * @brief Read and parse a source file
+ * @param pool Pool the file's memory comes from
+ * @param disk_path Path to open
+ * @param path Path shown in the prompt and indexed, e.g. "src/main.c"
+ * @return The file with one reference, or NULL if it cannot be read or is too large
+ */
+source_file_t *source_file_load(arena_pool_t *pool, const char *disk_path, const char *path);
+
+/**
+ * @brief Take another reference to a parsed file
+ */
+void source_file_ref(source_file_t *file);
+
+/**
+ * @brief Drop a reference, freeing the file with the last one
+ * @param file The file (may be NULL)
+ */
+void source_file_unref(source_file_t *file);
+
+/**
+ * @brief Build the index of a set of files
+ *
+ * The index points into the files: keep a reference to each of them for
+ * as long as the index is used.
+ * @param arena Arena the index is allocated from
+ * @param files Parsed files
+ * @param count Number of files
+ * @return The index, or NULL if the arena ran out of memory
+ */
+source_index_t *source_index_build(arena_t *arena, source_file_t *const *files, size_t count);
+
+/**
+ * @brief Number of snippets in an index
+ */
+size_t source_index_snippets(const source_index_t *index);
+
+/**
+ * @brief Select the snippets most relevant to a question
+ *
+ * Thread-safe: the index is only read.
+ * @param index The index
+ * @param question Text of the question
+ * @param token_budget Largest size of the result, in tokens
+ * @param len Output for the length of the text
+ * @return Malloc'd snippets, each with its path and line range, or NULL if
+ *         no snippet shares a term with the question (or on allocation failure)
+ */
+char *source_index_select(const source_index_t *index, const char *question, size_t token_budget, size_t *len);
+
+#endif /* SOURCE_INDEX_H */
@@ -0,0 +1,107 @@
+#ifndef STATIC_CACHE_H
+#define STATIC_CACHE_H
+
+/**
+ * @file static_cache.h
+ * @brief In-memory cache of the static files served by the web server
+ *
+ * The cache is populated at startup from a directory tree, keyed by URL
+ * path ("/css/style.css" for "web/css/style.css"), kept in sync through
+ * inotify and bounded by a memory cap with approximate LRU eviction. Lookups
+ * only take a read lock, so hits on different threads do not wait on each
+ * other. Files at or above the sendfile threshold are not read into memory;
+ * the cache keeps an open descriptor for them instead so responses can be
+ * sent with sendfile().
+ */
+
+#include <stddef.h>
+#include <time.h>
+
+// Default memory cap for cached file contents
+#define DEFAULT_STATIC_CACHE_BYTES (64 * 1024 * 1024)
+// Default size from which files are served from a descriptor instead of memory
+#define DEFAULT_SENDFILE_THRESHOLD (256 * 1024)
+// Maximum number of descriptors kept open for large files
+#define MAX_CACHED_FDS 256
+// Size of a quoted 64-bit hex ETag plus terminator
+#define ETAG_SIZE 20
+// Size of an HTTP date ("Sun, 06 Nov 1994 08:49:37 GMT") plus terminator
+#define HTTP_DATE_SIZE 32
+
+// A cached file. Valid until released, even if the file changes on disk.
+typedef struct {
+    const char *url_path;   // Cache key, e.g. "/css/style.css"
+    const char *data;       // File contents, NULL for descriptor-backed files
+    int fd;                 // Open descriptor for large files, -1 otherwise
+    size_t size;            // Size of the file in bytes
+    time_t mtime;           // Modification time of the cached version
+    char etag[ETAG_SIZE];   // Strong validator, hash of the contents
+    char last_modified[HTTP_DATE_SIZE];  // mtime formatted as an HTTP date
+} static_asset_t;
+
+// Called from the watcher thread after a file under the root changed
+typedef void (*static_cache_listener_t)(const char *url_path, void *ctx);
+
+/**
+ * @brief Register a function to call whenever a watched file changes
+ *
+ * Must be called before static_cache_init. The listener runs on the
+ * watcher thread after the cache has been updated.
+ * @param listener Function to call with the URL path of the changed file
+ * @param ctx Context pointer passed back to the listener
+ */
+void static_cache_set_listener(static_cache_listener_t listener, void *ctx);
+
+/**
+ * @brief Load every file under root_dir and start watching it for changes
+ * @param root_dir Directory to serve, with a trailing slash (e.g. "web/")
+ * @param max_bytes Maximum total size of cached file contents
+ * @param sendfile_threshold Files of at least this size are kept as open
+ *        descriptors instead of in memory (0 keeps every file in memory)
+ * @return 0 on success, -1 on error
+ */
+int static_cache_init(const char *root_dir, size_t max_bytes, size_t sendfile_threshold);
+
+/**
+ * @brief Stop the watcher thread and free all unreferenced entries
+ */
+void static_cache_shutdown(void);
+
+/**
+ * @brief Look up a file by URL path, loading it from disk on a miss
+ * @param url_path URL path starting with '/'
+ * @return The asset (release with static_cache_release), or NULL if not found
+ */
+const static_asset_t *static_cache_acquire(const char *url_path);
+
+/**
+ * @brief Look up a file by URL path without falling back to disk
+ * @param url_path URL path starting with '/'
+ * @return The asset (release with static_cache_release), or NULL if not cached
+ */
+const static_asset_t *static_cache_acquire_cached(const char *url_path);
+
+/**
+ * @brief Drop a reference obtained from static_cache_acquire
+ * @param asset The asset to release
+ */
+void static_cache_release(const static_asset_t *asset);
+
+/**
+ * @brief Release an asset given its data pointer
+ *
+ * Matches the libmicrohttpd free callback signature so cached bytes can be
+ * handed to a response without copying them.
+ * @param data The data pointer of an acquired asset
+ */
+void static_cache_release_buffer(void *data);
+
+/**
+ * @brief Compute a strong ETag ("\"<16 hex digits>\"") for a block of data
+ * @param data Contents to hash
+ * @param size Size of the contents
+ * @param etag Output buffer of ETAG_SIZE bytes
+ */
+void static_cache_etag(const void *data, size_t size, char *etag);
+
+#endif /* STATIC_CACHE_H */
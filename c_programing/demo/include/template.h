@@ -0,0 +1,67 @@
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+/**
+ * @file template.h
+ * @brief Precompiled HTML templates
+ *
+ * Templates are parsed once into literal segments and placeholders:
+ *   {{name}}               variable
+ *   {{#list}} ... {{/list}} section repeated for every item of a list
+ *   {{> file.html}}        another template of the same set
+ * Rendering walks the template once, collecting the literal text and the
+ * values as pieces, and then copies them into an exact-size buffer, so
+ * template text is never re-read or re-scanned.
+ */
+
+#include <stddef.h>
+
+typedef struct template_set template_set_t;
+
+// Callbacks that supply the values of a render
+typedef struct {
+    // Value of a variable (item is the current section item, NULL outside
+    // sections). It is copied when the render ends, so it must stay valid and
+    // unchanged until template_render returns.
+    const char *(*get_var)(const char *name, const void *item, void *ctx);
+    // Number of items in a section
+    size_t (*section_count)(const char *name, void *ctx);
+    // Item of a section, passed back to get_var
+    const void *(*section_item)(const char *name, size_t index, void *ctx);
+    void *ctx;
+} template_data_t;
+
+/**
+ * @brief Create an empty template set
+ * @return The set, or NULL on allocation failure
+ */
+template_set_t *template_set_create(void);
+
+/**
+ * @brief Free a template set and all compiled templates
+ * @param set The set to free
+ */
+void template_set_free(template_set_t *set);
+
+/**
+ * @brief Compile a template and add it to the set, replacing any older version
+ * @param set The template set
+ * @param name Name used to render it and to include it as a partial
+ * @param text Template source (need not be NUL-terminated)
+ * @param len Length of the source
+ * @return 0 on success, -1 on a syntax or allocation error (the old version is kept)
+ */
+int template_set_compile(template_set_t *set, const char *name, const char *text, size_t len);
+
+/**
+ * @brief Render a template of the set
+ * @param set The template set
+ * @param name Name of the template to render
+ * @param data Values for the placeholders
+ * @param len Optional output for the length of the result
+ * @return Newly allocated NUL-terminated output (caller must free), or NULL
+ */
+char *template_render(const template_set_t *set, const char *name,
+                      const template_data_t *data, size_t *len);
+
+#endif /* TEMPLATE_H */
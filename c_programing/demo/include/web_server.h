@@ -4,22 +4,78 @@
 #include <microhttpd.h>
 #include "syscalls.h"
 #include "demos.h"
+#include "static_cache.h"
+#include "logger.h"
+#include "ai_cache.h"
 
 // Web server configuration
 #define SERVER_PORT 8080
 #define TEMPLATE_DIR "web/templates/"
 #define STATIC_DIR "web/"
+#define DEFAULT_THREAD_POOL_SIZE 4
+#define DEFAULT_DEMO_OUTPUT_LIMIT (1024 * 1024)
+#define CHAT_BODY_LIMIT (64 * 1024)     // Largest /api/chat request body
+#define CHAT_JSON_MAX_DEPTH 16          // Deepest nesting accepted in it
+#define DEFAULT_REQUEST_MEMORY_LIMIT (256 * 1024)   // Arena memory one request may use
+#define REQUEST_ARENA_BLOCK_SIZE (16 * 1024)        // Size of the pooled arena blocks
+#define REQUEST_ARENA_FREE_BLOCKS 64                // Released blocks kept for reuse
+#define DEFAULT_AI_WORKERS 4            // Threads making DeepSeek calls for /api/chat
+#define CHAT_QUEUE_LIMIT 64             // Chat requests that may wait for one of them
+#define DEMO_QUEUE_LIMIT 64             // Demo runs that may wait for a free demo slot
+#define DEFAULT_CONTEXT_TOKENS 1500     // Project context added to a chat prompt, in tokens
+#define AI_CACHE_HEADER "X-AI-Cache"    // "bypass" on a chat request skips the response cache;
+                                        // replies carry "hit", "miss" or "bypass"
+
+// Runtime options for the web server (filled from the command line)
+typedef struct {
+    unsigned int port;
+    int use_epoll;                  // epoll + worker thread pool instead of a single select() thread
+    unsigned int thread_pool_size;  // number of epoll worker threads
+    size_t static_cache_bytes;      // memory cap for cached static files
+    size_t sendfile_threshold;      // files of at least this size are sent with sendfile (0 = never)
+    unsigned int max_concurrent_demos;  // demos allowed to run at once (0 = one per CPU)
+    size_t demo_output_limit;       // bytes of output kept per demo run
+    int use_zygote;                 // fork demos from a helper process started at boot
+    size_t request_memory_limit;    // bytes of arena memory one POST request may use
+    log_level_t log_level;          // messages below this level are not logged
+    unsigned int ai_workers;        // threads running DeepSeek calls for /api/chat
+    size_t context_tokens;          // budget for the project context of a chat prompt
+    size_t ai_cache_bytes;          // memory cap for cached AI responses
+    const char* ai_cache_file;      // file keeping AI responses across restarts (NULL = memory only)
+} web_server_config_t;
+
+// How the result of a demo run may be reused
+typedef enum {
+    DEMO_CACHE_NEVER,       // Output differs between runs, always run the demo
+    DEMO_CACHE_TTL,         // Reuse the output for cache_ttl seconds
+    DEMO_CACHE_FOREVER      // Output never changes while the server runs
+} demo_cache_policy_t;
 
 // Structure to hold demo information
 typedef struct {
     const char* name;
     const char* description;
     void (*function)();
+    demo_cache_policy_t cache_policy;
+    unsigned int cache_ttl;         // Seconds, for DEMO_CACHE_TTL
 } demo_info_t;
 
-// Initialize the web server
+// Output captured from one demo run
+typedef struct {
+    char* data;         // Captured bytes, NUL-terminated (caller must free)
+    size_t size;        // Number of captured bytes
+    int truncated;      // The demo wrote more than the output limit and was stopped
+} demo_output_t;
+
+// Fill a configuration with the default options
+void web_server_default_config(web_server_config_t* config);
+
+// Initialize the web server with the default configuration
 struct MHD_Daemon* init_web_server(void);
 
+// Initialize the web server with the given configuration
+struct MHD_Daemon* init_web_server_with_config(const web_server_config_t* config);
+
 // Stop the web server
 void stop_web_server(struct MHD_Daemon* daemon);
 
@@ -36,7 +92,7 @@ int handle_request(void* cls,
 // Utility functions
 char* load_template(const char* filename);
 char* generate_demo_html();
-char* capture_demo_output(void (*demo_func)());
+int capture_demo_output(const demo_info_t* demo, demo_output_t* output);
 const char* get_content_type(const char* filename);
 
 #endif // WEB_SERVER_H
\ No newline at end of file
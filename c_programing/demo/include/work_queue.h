@@ -0,0 +1,58 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+/**
+ * @file work_queue.h
+ * @brief Fixed pool of worker threads for blocking jobs
+ *
+ * Jobs are run in submission order by a fixed number of threads. The queue
+ * is bounded: when it is full, submitting fails at once instead of letting
+ * work pile up behind a slow dependency.
+ */
+
+#include <stddef.h>
+
+typedef struct work_queue work_queue_t;
+
+// A job; cancelled is set when the queue is freed before the job started
+typedef void (*work_fn_t)(void *arg, int cancelled);
+
+/**
+ * @brief Start the worker threads
+ * @param threads Number of worker threads (at least 1)
+ * @param max_queued Jobs that may wait for a free thread
+ * @return The queue, or NULL on error
+ */
+work_queue_t *work_queue_create(unsigned int threads, size_t max_queued);
+
+/**
+ * @brief Queue a job
+ * @param queue The queue
+ * @param fn Function to run on a worker thread
+ * @param arg Argument passed to fn
+ * @return 0 on success, -1 if the queue is full
+ */
+int work_queue_submit(work_queue_t *queue, work_fn_t fn, void *arg);
+
+/**
+ * @brief Number of jobs waiting or running
+ * @param queue The queue
+ */
+size_t work_queue_pending(work_queue_t *queue);
+
+/**
+ * @brief Stop the worker threads
+ *
+ * Jobs still waiting are called on the calling thread with cancelled set,
+ * running jobs are waited for, and later submissions fail.
+ * @param queue The queue
+ */
+void work_queue_stop(work_queue_t *queue);
+
+/**
+ * @brief Stop the queue if needed and free it
+ * @param queue The queue (may be NULL)
+ */
+void work_queue_free(work_queue_t *queue);
+
+#endif /* WORK_QUEUE_H */
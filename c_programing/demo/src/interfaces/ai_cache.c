@@ -0,0 +1,377 @@
+#include "../../include/ai_cache.h"
+#include "../../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MEMORY_BUCKETS 1024
+#define DISK_MAGIC 0x3145484341434941ull    // "AICACHE1"
+#define DISK_HEADER_SIZE 4096
+#define DISK_SETS (AI_CACHE_DISK_SLOTS / AI_CACHE_DISK_WAYS)
+
+// Response held in memory - the text is stored inline after the header
+typedef struct entry {
+    ai_cache_key_t key;
+    struct entry *hash_next;
+    struct entry *lru_prev;
+    struct entry *lru_next;
+    size_t len;
+    char data[];
+} entry_t;
+
+// Start of the cache file
+typedef struct {
+    uint64_t magic;
+    uint32_t slots;
+    uint32_t slot_size;
+    uint64_t next_stamp;    // Larger stamps were used more recently
+} disk_header_t;
+
+// One response in the cache file, the text follows the header
+typedef struct {
+    ai_cache_key_t key;
+    uint64_t stamp;         // Last use, 0 while the slot is empty or being written
+    uint64_t checksum;      // Of the key, the length and the text
+    uint32_t len;
+    uint32_t reserved;
+    char data[];
+} disk_slot_t;
+
+#define DISK_MAX_RESPONSE (AI_CACHE_DISK_SLOT_SIZE - sizeof(disk_slot_t))
+#define DISK_FILE_SIZE ((size_t)DISK_HEADER_SIZE + (size_t)AI_CACHE_DISK_SLOTS * AI_CACHE_DISK_SLOT_SIZE)
+
+static entry_t *buckets[MEMORY_BUCKETS];
+static entry_t *lru_head = NULL;    // Most recently used
+static entry_t *lru_tail = NULL;    // Next to evict
+static size_t max_memory_bytes = DEFAULT_AI_CACHE_BYTES;
+static size_t memory_bytes = 0;
+static size_t memory_entries = 0;
+
+static char *disk_map = NULL;       // The cache file, mapped shared
+static size_t disk_entries = 0;
+
+static uint64_t memory_hits = 0;
+static uint64_t disk_hits = 0;
+static uint64_t misses = 0;
+static uint64_t bypasses = 0;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Two independent 64-bit hashes over the same bytes: FNV-1a, and a
+// multiply-xorshift mix
+static void hash_bytes(ai_cache_key_t *key, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        key->a ^= bytes[i];
+        key->a *= 1099511628211ull;
+        key->b = (key->b ^ bytes[i]) * 0x9e3779b97f4a7c15ull;
+        key->b ^= key->b >> 29;
+    }
+}
+
+// Hash a field with its length so that ("ab", "c") and ("a", "bc") differ
+static void hash_field(ai_cache_key_t *key, const char *text) {
+    uint64_t len = text != NULL ? strlen(text) : 0;
+    hash_bytes(key, &len, sizeof(len));
+    if (len > 0) {
+        hash_bytes(key, text, len);
+    }
+}
+
+void ai_cache_key(ai_cache_key_t *key, const char *model, float temperature, const ai_prompt_t *prompt) {
+    key->a = 14695981039346656037ull;
+    key->b = 0x243f6a8885a308d3ull;
+    hash_field(key, model);
+    hash_bytes(key, &temperature, sizeof(temperature));
+    hash_field(key, prompt->system);
+    hash_field(key, prompt->context);
+    hash_field(key, prompt->question);
+}
+
+static int same_key(const ai_cache_key_t *x, const ai_cache_key_t *y) {
+    return x->a == y->a && x->b == y->b;
+}
+
+static void lru_unlink(entry_t *entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (lru_tail == NULL) lru_tail = entry;
+}
+
+static entry_t **find_link(const ai_cache_key_t *key) {
+    entry_t **link = &buckets[key->a % MEMORY_BUCKETS];
+    while (*link != NULL && !same_key(&(*link)->key, key)) {
+        link = &(*link)->hash_next;
+    }
+    return link;
+}
+
+static void remove_entry(entry_t **link) {
+    entry_t *entry = *link;
+    *link = entry->hash_next;
+    lru_unlink(entry);
+    memory_bytes -= sizeof(entry_t) + entry->len;
+    memory_entries--;
+    free(entry);
+}
+
+// Keep a response in memory, evicting the least recently used ones
+static void memory_insert(const ai_cache_key_t *key, const char *response, size_t len) {
+    entry_t **link = find_link(key);
+    if (*link != NULL) {
+        remove_entry(link);
+    }
+    size_t size = sizeof(entry_t) + len;
+    if (size > max_memory_bytes) {
+        return;
+    }
+    while (memory_bytes + size > max_memory_bytes && lru_tail != NULL) {
+        remove_entry(find_link(&lru_tail->key));
+    }
+
+    entry_t *entry = malloc(size + 1);
+    if (entry == NULL) {
+        return;
+    }
+    entry->key = *key;
+    entry->len = len;
+    memcpy(entry->data, response, len);
+    entry->data[len] = '\0';
+    link = &buckets[key->a % MEMORY_BUCKETS];
+    entry->hash_next = *link;
+    *link = entry;
+    lru_push_front(entry);
+    memory_bytes += size;
+    memory_entries++;
+}
+
+static disk_header_t *disk_header(void) {
+    return (disk_header_t *)disk_map;
+}
+
+static disk_slot_t *disk_slot(size_t index) {
+    return (disk_slot_t *)(disk_map + DISK_HEADER_SIZE + index * AI_CACHE_DISK_SLOT_SIZE);
+}
+
+static uint64_t slot_checksum(const disk_slot_t *slot) {
+    ai_cache_key_t sum = {14695981039346656037ull, 0};
+    hash_bytes(&sum, &slot->key, sizeof(slot->key));
+    hash_bytes(&sum, &slot->len, sizeof(slot->len));
+    hash_bytes(&sum, slot->data, slot->len);
+    return sum.a;
+}
+
+// A slot holds a response only if it was written to the end
+static int slot_valid(const disk_slot_t *slot) {
+    return slot->stamp != 0 && slot->len <= DISK_MAX_RESPONSE && slot->checksum == slot_checksum(slot);
+}
+
+static disk_slot_t *disk_find(const ai_cache_key_t *key) {
+    size_t first = (key->a % DISK_SETS) * AI_CACHE_DISK_WAYS;
+    for (size_t i = first; i < first + AI_CACHE_DISK_WAYS; i++) {
+        disk_slot_t *slot = disk_slot(i);
+        if (slot->stamp != 0 && same_key(&slot->key, key)) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Write a response into its set, over the same key or the least recently
+// used slot. The slot reads as empty until the stamp is set last.
+static void disk_store(const ai_cache_key_t *key, const char *response, size_t len) {
+    if (len > DISK_MAX_RESPONSE) {
+        return;
+    }
+    disk_slot_t *slot = disk_find(key);
+    if (slot == NULL) {
+        size_t first = (key->a % DISK_SETS) * AI_CACHE_DISK_WAYS;
+        slot = disk_slot(first);
+        for (size_t i = first + 1; i < first + AI_CACHE_DISK_WAYS && slot->stamp != 0; i++) {
+            if (disk_slot(i)->stamp < slot->stamp) {
+                slot = disk_slot(i);
+            }
+        }
+        if (slot->stamp == 0) {
+            disk_entries++;
+        }
+    }
+
+    slot->stamp = 0;
+    atomic_thread_fence(memory_order_release);
+    slot->key = *key;
+    slot->len = (uint32_t)len;
+    memcpy(slot->data, response, len);
+    slot->checksum = slot_checksum(slot);
+    atomic_thread_fence(memory_order_release);
+    slot->stamp = disk_header()->next_stamp++;
+}
+
+// Map the cache file, starting it afresh if it is missing or was written
+// with another layout
+static int disk_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "AI cache: cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    disk_header_t header;
+    struct stat st;
+    int fresh = fstat(fd, &st) != 0 || (size_t)st.st_size != DISK_FILE_SIZE ||
+                pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                header.magic != DISK_MAGIC || header.slots != AI_CACHE_DISK_SLOTS ||
+                header.slot_size != AI_CACHE_DISK_SLOT_SIZE;
+    if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, DISK_FILE_SIZE) != 0)) {
+        log_message(LOG_LEVEL_ERROR, "AI cache: cannot size %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, DISK_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_message(LOG_LEVEL_ERROR, "AI cache: cannot map %s: %s", path, strerror(errno));
+        return -1;
+    }
+    disk_map = map;
+
+    if (fresh) {
+        disk_header()->magic = DISK_MAGIC;
+        disk_header()->slots = AI_CACHE_DISK_SLOTS;
+        disk_header()->slot_size = AI_CACHE_DISK_SLOT_SIZE;
+        disk_header()->next_stamp = 1;
+    }
+    disk_entries = 0;
+    for (size_t i = 0; i < AI_CACHE_DISK_SLOTS; i++) {
+        if (disk_slot(i)->stamp != 0) {
+            disk_entries++;
+        }
+    }
+    log_message(LOG_LEVEL_INFO, "AI cache: %zu responses in %s", disk_entries, path);
+    return 0;
+}
+
+int ai_cache_init(size_t max_bytes, const char *disk_path) {
+    pthread_mutex_lock(&cache_mutex);
+    max_memory_bytes = max_bytes;
+    int ret = (disk_path != NULL && disk_map == NULL) ? disk_open(disk_path) : 0;
+    pthread_mutex_unlock(&cache_mutex);
+    return ret;
+}
+
+void ai_cache_shutdown(void) {
+    pthread_mutex_lock(&cache_mutex);
+    while (lru_tail != NULL) {
+        remove_entry(find_link(&lru_tail->key));
+    }
+    if (disk_map != NULL) {
+        msync(disk_map, DISK_FILE_SIZE, MS_SYNC);
+        munmap(disk_map, DISK_FILE_SIZE);
+        disk_map = NULL;
+        disk_entries = 0;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+// Find a response and copy it, moving it to the front of the LRU list; the
+// caller holds cache_mutex
+static char *find_response(const ai_cache_key_t *key, size_t *len, ai_cache_result_t *found) {
+    char *copy = NULL;
+    *found = AI_CACHE_MISS;
+    entry_t *entry = *find_link(key);
+    if (entry != NULL) {
+        lru_unlink(entry);
+        lru_push_front(entry);
+        copy = malloc(entry->len + 1);
+        if (copy != NULL) {
+            memcpy(copy, entry->data, entry->len + 1);
+            *len = entry->len;
+            *found = AI_CACHE_HIT_MEMORY;
+        }
+    } else if (disk_map != NULL) {
+        disk_slot_t *slot = disk_find(key);
+        if (slot != NULL && slot_valid(slot)) {
+            copy = malloc(slot->len + 1);
+            if (copy != NULL) {
+                memcpy(copy, slot->data, slot->len);
+                copy[slot->len] = '\0';
+                *len = slot->len;
+                *found = AI_CACHE_HIT_DISK;
+                slot->stamp = disk_header()->next_stamp++;
+                memory_insert(key, copy, *len);
+            }
+        }
+    }
+    return copy;
+}
+
+char *ai_cache_lookup(const ai_cache_key_t *key, size_t *len, ai_cache_result_t *result) {
+    ai_cache_result_t found;
+    pthread_mutex_lock(&cache_mutex);
+    char *copy = find_response(key, len, &found);
+    if (found == AI_CACHE_HIT_MEMORY) {
+        memory_hits++;
+    } else if (found == AI_CACHE_HIT_DISK) {
+        disk_hits++;
+    } else {
+        misses++;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (result != NULL) {
+        *result = found;
+    }
+    return copy;
+}
+
+char *ai_cache_peek(const ai_cache_key_t *key, size_t *len) {
+    ai_cache_result_t found;
+    pthread_mutex_lock(&cache_mutex);
+    char *copy = find_response(key, len, &found);
+    pthread_mutex_unlock(&cache_mutex);
+    return copy;
+}
+
+void ai_cache_store(const ai_cache_key_t *key, const char *response, size_t len) {
+    pthread_mutex_lock(&cache_mutex);
+    memory_insert(key, response, len);
+    if (disk_map != NULL) {
+        disk_store(key, response, len);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void ai_cache_count_bypass(void) {
+    pthread_mutex_lock(&cache_mutex);
+    bypasses++;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void ai_cache_get_stats(ai_cache_stats_t *stats) {
+    pthread_mutex_lock(&cache_mutex);
+    stats->memory_hits = memory_hits;
+    stats->disk_hits = disk_hits;
+    stats->misses = misses;
+    stats->bypasses = bypasses;
+    stats->entries = memory_entries;
+    stats->bytes = memory_bytes;
+    stats->disk_entries = disk_entries;
+    pthread_mutex_unlock(&cache_mutex);
+}
@@ -1,22 +1,44 @@
 #include "../include/ai_integration.h"
 #include "../include/syscalls.h"
+#include "../include/logger.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <curl/curl.h>
 #include <json-c/json.h>
 
 // DeepSeek API endpoint
 #define DEEPSEEK_API_URL "https://api.deepseek.com/v1/chat/completions"
 // Default model if none specified
-#define DEFAULT_MODEL "deepseek-chat"
+#define DEFAULT_MODEL AI_DEFAULT_MODEL
 // API key environment variable name to look for in .env file
 #define API_KEY_ENV_VAR "DEEPSEEK_API_KEY="
+// Easy handles kept between calls
+#define CURL_POOL_SIZE 8
 
 // Static variables
 static char *api_key = NULL;
+// Guards api_key: calls read it on AI worker threads while it may be reloaded
+static pthread_mutex_t api_key_lock = PTHREAD_MUTEX_INITIALIZER;
 static float temperature = 0.7f;
 
+// libcurl is set up once per process. Idle easy handles are kept in a pool
+// and each keeps its own connection open, so a call usually goes out on a
+// connection that is already open. All handles share one DNS cache and TLS
+// session cache, so a handle that has to connect skips the lookup and
+// resumes the TLS session. The connection cache is not shared: libcurl
+// does not support sharing it between handles used by concurrent threads.
+static pthread_once_t curl_once = PTHREAD_ONCE_INIT;
+static CURLcode curl_init_result = CURLE_FAILED_INIT;
+static CURLSH *curl_share = NULL;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+static CURL *curl_pool[CURL_POOL_SIZE];
+static int curl_pool_count = 0;
+static pthread_mutex_t curl_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t connections_opened = 0;
+static uint64_t connections_reused = 0;
+
 // Structure to store response data
 struct MemoryStruct {
     char *memory;
@@ -30,7 +52,7 @@ static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, voi
  
     char *ptr = realloc(mem->memory, mem->size + realsize + 1);
     if(ptr == NULL) {
-        printf("Not enough memory (realloc returned NULL)\n");
+        log_message(LOG_LEVEL_ERROR, "Not enough memory (realloc returned NULL)");
         return 0;
     }
  
@@ -138,44 +160,160 @@ bool ai_init_from_env_file(const char *env_file_path) {
     }
 }
 
+// Lock callbacks of the share: one mutex per kind of shared data
+static void lock_share(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    (void)userptr;
+    pthread_mutex_lock(&share_locks[data]);
+}
+
+static void unlock_share(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    (void)userptr;
+    pthread_mutex_unlock(&share_locks[data]);
+}
+
+static void init_curl(void) {
+    curl_init_result = curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (curl_init_result != CURLE_OK) {
+        return;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&share_locks[i], NULL);
+    }
+
+    // Without the share every handle still keeps its own DNS and TLS caches
+    curl_share = curl_share_init();
+    if (curl_share != NULL) {
+        curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, lock_share);
+        curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+}
+
+// Take an idle handle from the pool, or make one
+static CURL *take_handle(void) {
+    CURL *curl = NULL;
+    pthread_mutex_lock(&curl_pool_lock);
+    if (curl_pool_count > 0) {
+        curl = curl_pool[--curl_pool_count];
+    }
+    pthread_mutex_unlock(&curl_pool_lock);
+
+    if (curl == NULL) {
+        curl = curl_easy_init();
+        if (curl != NULL && curl_share != NULL) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+        }
+    }
+    if (curl != NULL) {
+        // Worker threads must not get signals from name lookups
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    }
+    return curl;
+}
+
+// Log how long the call took to get through each phase, then put the
+// handle back in the pool; its connection stays open for the next call
+static void return_handle(CURL *curl, const char *kind) {
+    curl_off_t dns = 0, connect = 0, tls = 0, first_byte = 0, total = 0;
+    long new_connections = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_connections);
+
+    // The times are in microseconds since the start of the call; on a
+    // reused connection the first three are (close to) zero
+    log_message(LOG_LEVEL_DEBUG,
+                "DeepSeek %s call on a %s connection: dns %.1f ms, tcp %.1f ms, tls %.1f ms, "
+                "first byte %.1f ms, total %.1f ms",
+                kind, new_connections > 0 ? "new" : "reused", dns / 1000.0,
+                connect > dns ? (connect - dns) / 1000.0 : 0.0, tls > connect ? (tls - connect) / 1000.0 : 0.0,
+                first_byte / 1000.0, total / 1000.0);
+
+    curl_easy_reset(curl);
+    pthread_mutex_lock(&curl_pool_lock);
+    if (new_connections > 0) {
+        connections_opened++;
+    } else {
+        connections_reused++;
+    }
+    if (curl_pool_count < CURL_POOL_SIZE) {
+        curl_pool[curl_pool_count++] = curl;
+        curl = NULL;
+    }
+    pthread_mutex_unlock(&curl_pool_lock);
+    if (curl != NULL) {
+        curl_easy_cleanup(curl);
+    }
+}
+
 bool ai_init(const char *key) {
     if (key == NULL || strlen(key) == 0) {
         fprintf(stderr, "Invalid API key provided\n");
         return false;
     }
 
-    // Free previous key if exists
-    if (api_key != NULL) {
-        free(api_key);
+    // Initialize libcurl once, however often the key is loaded again
+    pthread_once(&curl_once, init_curl);
+    if (curl_init_result != CURLE_OK) {
+        fprintf(stderr, "curl_global_init() failed: %s\n", curl_easy_strerror(curl_init_result));
+        return false;
     }
 
-    // Store the API key
-    api_key = strdup(key);
-    if (api_key == NULL) {
+    char *new_key = strdup(key);
+    if (new_key == NULL) {
         fprintf(stderr, "Failed to allocate memory for API key\n");
         return false;
     }
 
-    // Initialize libcurl globally
-    CURLcode res = curl_global_init(CURL_GLOBAL_DEFAULT);
-    if (res != CURLE_OK) {
-        fprintf(stderr, "curl_global_init() failed: %s\n", curl_easy_strerror(res));
-        free(api_key);
-        api_key = NULL;
-        return false;
-    }
+    // Replace the previous key; calls copy it under the lock
+    pthread_mutex_lock(&api_key_lock);
+    char *old_key = api_key;
+    api_key = new_key;
+    pthread_mutex_unlock(&api_key_lock);
+    free(old_key);
 
     return true;
 }
 
-void ai_cleanup(void) {
-    if (api_key != NULL) {
-        free(api_key);
-        api_key = NULL;
+bool ai_is_initialized(void) {
+    pthread_mutex_lock(&api_key_lock);
+    bool initialized = api_key != NULL;
+    pthread_mutex_unlock(&api_key_lock);
+    return initialized;
+}
+
+// Format the Authorization header; false if no key is loaded
+static bool format_auth_header(char *header, size_t size) {
+    pthread_mutex_lock(&api_key_lock);
+    bool initialized = api_key != NULL;
+    if (initialized) {
+        snprintf(header, size, "Authorization: Bearer %s", api_key);
     }
+    pthread_mutex_unlock(&api_key_lock);
+    return initialized;
+}
+
+void ai_cleanup(void) {
+    pthread_mutex_lock(&api_key_lock);
+    free(api_key);
+    api_key = NULL;
+    pthread_mutex_unlock(&api_key_lock);
     
-    // Cleanup curl
-    curl_global_cleanup();
+    // Close the idle connections. The share and libcurl itself stay set up
+    // until the process exits, as a call may still be running.
+    pthread_mutex_lock(&curl_pool_lock);
+    while (curl_pool_count > 0) {
+        curl_easy_cleanup(curl_pool[--curl_pool_count]);
+    }
+    pthread_mutex_unlock(&curl_pool_lock);
 }
 
 void ai_set_temperature(float temp) {
@@ -186,22 +324,234 @@ void ai_set_temperature(float temp) {
     }
 }
 
+// Add a message to the request unless it is empty
+static void add_message(struct json_object *messages, const char *role, const char *content) {
+    if (content == NULL || *content == '\0') {
+        return;
+    }
+    struct json_object *message = json_object_new_object();
+    json_object_object_add(message, "role", json_object_new_string(role));
+    json_object_object_add(message, "content", json_object_new_string(content));
+    json_object_array_add(messages, message);
+}
+
+// Build the request body. The system message and the context come first:
+// as long as they are byte for byte the same, DeepSeek serves that prefix
+// from its context cache and only the user turn is processed anew.
+static struct json_object *build_request(const ai_prompt_t *prompt, const char *model, bool stream) {
+    struct json_object *json_request = json_object_new_object();
+    json_object_object_add(json_request, "model", json_object_new_string(model));
+    json_object_object_add(json_request, "temperature", json_object_new_double(temperature));
+    if (stream) {
+        json_object_object_add(json_request, "stream", json_object_new_boolean(1));
+        // The token counts come in a last chunk, after the text
+        struct json_object *options = json_object_new_object();
+        json_object_object_add(options, "include_usage", json_object_new_boolean(1));
+        json_object_object_add(json_request, "stream_options", options);
+    }
+
+    struct json_object *messages = json_object_new_array();
+    add_message(messages, "system", prompt->system);
+    add_message(messages, "system", prompt->context);
+    add_message(messages, "user", prompt->question);
+    json_object_object_add(json_request, "messages", messages);
+    return json_request;
+}
+
+static uint64_t get_count(struct json_object *usage, const char *name) {
+    struct json_object *value;
+    if (!json_object_object_get_ex(usage, name, &value)) {
+        return 0;
+    }
+    int64_t count = json_object_get_int64(value);
+    return count > 0 ? (uint64_t)count : 0;
+}
+
+// Read the "usage" object of a response or of the last stream chunk
+static void read_usage(struct json_object *response, ai_usage_t *usage) {
+    struct json_object *obj;
+    if (usage == NULL || !json_object_object_get_ex(response, "usage", &obj) ||
+        !json_object_is_type(obj, json_type_object)) {
+        return;
+    }
+    usage->reported = true;
+    usage->prompt_tokens = get_count(obj, "prompt_tokens");
+    usage->cache_hit_tokens = get_count(obj, "prompt_cache_hit_tokens");
+    usage->cache_miss_tokens = get_count(obj, "prompt_cache_miss_tokens");
+    usage->completion_tokens = get_count(obj, "completion_tokens");
+}
+
+float ai_get_temperature(void) {
+    return temperature;
+}
+
 char *ai_generate_text(const char *prompt, const char *model_name) {
-    if (api_key == NULL) {
-        fprintf(stderr, "AI not initialized. Call ai_init first.\n");
-        return NULL;
+    ai_prompt_t chat = {NULL, NULL, prompt};
+    return ai_generate_chat(&chat, model_name, NULL);
+}
+
+// A DeepSeek call shared by identical requests made at the same time. The
+// first request makes the call; those arriving while it runs wait on the
+// condition variable and get the same text, piece by piece if it streams.
+typedef struct flight {
+    struct flight *next;
+    char *body;                 // Request body, the same for every request sharing the call
+    pthread_cond_t changed;     // Broadcast when text arrives and when the call ends
+    char *text;                 // Text received so far
+    size_t text_len;
+    size_t text_cap;
+    int refs;                   // The request making the call and its followers
+    int followers;              // Requests still waiting for the text
+    bool finished;
+    bool failed;                // The call ended without a usable answer
+} flight_t;
+
+static flight_t *flights = NULL;    // Calls in progress
+static pthread_mutex_t flights_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t upstream_calls = 0;
+static uint64_t coalesced_requests = 0;
+
+// Attach to the call in progress with the same body, or register a new one
+// and set *leader: the caller then makes the call
+static flight_t *join_flight(const char *body, bool *leader) {
+    pthread_mutex_lock(&flights_lock);
+    flight_t *flight = flights;
+    while (flight != NULL && strcmp(flight->body, body) != 0) {
+        flight = flight->next;
     }
+    if (flight != NULL) {
+        flight->refs++;
+        flight->followers++;
+        coalesced_requests++;
+        *leader = false;
+    } else {
+        flight = calloc(1, sizeof(flight_t));
+        if (flight != NULL && (flight->body = strdup(body)) == NULL) {
+            free(flight);
+            flight = NULL;
+        }
+        if (flight != NULL) {
+            pthread_cond_init(&flight->changed, NULL);
+            flight->refs = 1;
+            flight->next = flights;
+            flights = flight;
+            upstream_calls++;
+        }
+        *leader = true;
+    }
+    pthread_mutex_unlock(&flights_lock);
+    return flight;
+}
 
-    if (prompt == NULL || strlen(prompt) == 0) {
-        fprintf(stderr, "Prompt cannot be empty\n");
+// Take a call out of the table so that no more requests join it; the
+// caller holds flights_lock
+static void unlist_flight(flight_t *flight) {
+    flight_t **link = &flights;
+    while (*link != NULL && *link != flight) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        *link = flight->next;
+    }
+}
+
+// Drop a reference; the caller holds flights_lock
+static void release_flight(flight_t *flight) {
+    if (--flight->refs > 0) {
+        return;
+    }
+    pthread_cond_destroy(&flight->changed);
+    free(flight->body);
+    free(flight->text);
+    free(flight);
+}
+
+// Copy of the text of a finished call, NULL if it failed; the caller holds
+// flights_lock
+static char *copy_flight_text(const flight_t *flight) {
+    if (flight->failed || flight->text_len == 0) {
         return NULL;
     }
+    char *copy = malloc(flight->text_len + 1);
+    if (copy != NULL) {
+        memcpy(copy, flight->text, flight->text_len + 1);
+    }
+    return copy;
+}
 
-    const char *model = model_name ? model_name : DEFAULT_MODEL;
+// End the call made by the caller: set its text (unless it was streamed
+// into the flight), wake the followers up and return the caller's copy
+static char *finish_flight(flight_t *flight, char *text, bool failed) {
+    pthread_mutex_lock(&flights_lock);
+    unlist_flight(flight);
+    if (text != NULL) {
+        free(flight->text);
+        flight->text = text;
+        flight->text_len = strlen(text);
+    }
+    flight->finished = true;
+    flight->failed = failed;
+    char *result = copy_flight_text(flight);
+    pthread_cond_broadcast(&flight->changed);
+    release_flight(flight);
+    pthread_mutex_unlock(&flights_lock);
+    return result;
+}
+
+// Wait for the call another request is making and take its text. With a
+// callback the text is relayed as it arrives, and returning false detaches.
+static char *follow_flight(flight_t *flight, ai_token_callback_t on_token, void *ctx) {
+    char *result = NULL;
+    size_t relayed = 0;
+
+    pthread_mutex_lock(&flights_lock);
+    while (1) {
+        if (on_token != NULL && flight->text_len > relayed) {
+            size_t len = flight->text_len - relayed;
+            char *piece = malloc(len);
+            if (piece == NULL) {
+                break;
+            }
+            memcpy(piece, flight->text + relayed, len);
+            relayed += len;
+
+            // Relay without the lock, the client may be slow
+            pthread_mutex_unlock(&flights_lock);
+            bool more = on_token(piece, len, ctx);
+            free(piece);
+            pthread_mutex_lock(&flights_lock);
+            if (!more) {
+                break;
+            }
+        } else if (flight->finished) {
+            result = copy_flight_text(flight);
+            break;
+        } else {
+            pthread_cond_wait(&flight->changed, &flights_lock);
+        }
+    }
+    flight->followers--;
+    release_flight(flight);
+    pthread_mutex_unlock(&flights_lock);
+    return result;
+}
+
+void ai_get_call_stats(ai_call_stats_t *stats) {
+    pthread_mutex_lock(&flights_lock);
+    stats->calls = upstream_calls;
+    stats->coalesced = coalesced_requests;
+    pthread_mutex_unlock(&flights_lock);
+    pthread_mutex_lock(&curl_pool_lock);
+    stats->connections_opened = connections_opened;
+    stats->connections_reused = connections_reused;
+    pthread_mutex_unlock(&curl_pool_lock);
+}
+
+// Make a non-streamed call and return the text of the answer
+static char *post_request(const char *json_str, ai_usage_t *usage) {
     char *result = NULL;
     CURL *curl;
     CURLcode res;
-    struct json_object *json_request, *messages, *message;
     struct json_object *json_response, *choices, *choice, *message_obj, *content_obj;
     const char *content_str;
     struct MemoryStruct chunk;
@@ -210,37 +560,20 @@ char *ai_generate_text(const char *prompt, const char *model_name) {
     chunk.size = 0;            // no data at this point
     
     if (chunk.memory == NULL) {
-        fprintf(stderr, "Failed to allocate memory for response\n");
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for response");
         return NULL;
     }
 
-    curl = curl_easy_init();
+    curl = take_handle();
     if (curl) {
         struct curl_slist *headers = NULL;
         
-        // Create JSON request
-        json_request = json_object_new_object();
-        json_object_object_add(json_request, "model", json_object_new_string(model));
-        json_object_object_add(json_request, "temperature", json_object_new_double(temperature));
-        
-        // Create messages array with user's message
-        messages = json_object_new_array();
-        message = json_object_new_object();
-        json_object_object_add(message, "role", json_object_new_string("user"));
-        json_object_object_add(message, "content", json_object_new_string(prompt));
-        json_object_array_add(messages, message);
-        
-        // Add messages to request
-        json_object_object_add(json_request, "messages", messages);
-        
-        // Convert JSON object to string
-        const char *json_str = json_object_to_json_string(json_request);
-        
         // Set HTTP headers
         headers = curl_slist_append(headers, "Content-Type: application/json");
         char auth_header[256];
-        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", api_key);
-        headers = curl_slist_append(headers, auth_header);
+        if (format_auth_header(auth_header, sizeof(auth_header))) {
+            headers = curl_slist_append(headers, auth_header);
+        }
         
         // Set curl options
         curl_easy_setopt(curl, CURLOPT_URL, DEEPSEEK_API_URL);
@@ -250,11 +583,11 @@ char *ai_generate_text(const char *prompt, const char *model_name) {
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
         
         // Perform the request
-        printf("Sending request to DeepSeek API...\n");
+        log_message(LOG_LEVEL_DEBUG, "Sending request to DeepSeek API...");
         res = curl_easy_perform(curl);
         
         if (res != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+            log_message(LOG_LEVEL_ERROR, "curl_easy_perform() failed: %s", curl_easy_strerror(res));
         } else {
             // Parse JSON response
             json_response = json_tokener_parse(chunk.memory);
@@ -305,17 +638,17 @@ char *ai_generate_text(const char *prompt, const char *model_name) {
                     }
                     json_object_iter_next(&it);
                 }
+                read_usage(json_response, usage);
                 
                 json_object_put(json_response); // Free JSON object
             } else {
-                fprintf(stderr, "Failed to parse JSON response\n");
+                log_message(LOG_LEVEL_ERROR, "Failed to parse JSON response");
             }
         }
         
         // Clean up
         curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-        json_object_put(json_request); // Free JSON request
+        return_handle(curl, "chat");
     }
     
     // Free the response memory
@@ -324,6 +657,244 @@ char *ai_generate_text(const char *prompt, const char *model_name) {
     return result;
 }
 
+char *ai_generate_chat(const ai_prompt_t *prompt, const char *model_name, ai_usage_t *usage) {
+    if (!ai_is_initialized()) {
+        log_message(LOG_LEVEL_ERROR, "AI not initialized. Call ai_init first.");
+        return NULL;
+    }
+
+    if (prompt->question == NULL || strlen(prompt->question) == 0) {
+        log_message(LOG_LEVEL_ERROR, "Prompt cannot be empty");
+        return NULL;
+    }
+
+    const char *model = model_name ? model_name : DEFAULT_MODEL;
+    struct json_object *json_request = build_request(prompt, model, false);
+    const char *json_str = json_object_to_json_string(json_request);
+
+    // Identical requests in flight share one call
+    bool leader;
+    char *result = NULL;
+    flight_t *flight = join_flight(json_str, &leader);
+    if (flight == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for the request");
+    } else if (!leader) {
+        result = follow_flight(flight, NULL, NULL);
+    } else {
+        char *text = post_request(json_str, usage);
+        result = finish_flight(flight, text, text == NULL);
+    }
+
+    json_object_put(json_request);
+    return result;
+}
+
+// State of a streamed completion
+struct StreamState {
+    char *line;                 // Current SSE line, not yet complete
+    size_t line_len;
+    size_t line_cap;
+    flight_t *flight;           // Call shared with identical requests, holding the text
+    ai_token_callback_t on_token;
+    void *ctx;
+    ai_usage_t *usage;
+    bool done;                  // "data: [DONE]" was received
+    bool detached;              // The callback asked to stop, the call goes on for followers
+    bool stopped;               // The call was stopped
+    bool failed;                // Out of memory
+};
+
+// Append bytes to a growable NUL-terminated buffer
+static bool append_bytes(char **buf, size_t *len, size_t *cap, const char *data, size_t size) {
+    if (*len + size + 1 > *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 256;
+        while (*len + size + 1 > new_cap) {
+            new_cap *= 2;
+        }
+        char *ptr = realloc(*buf, new_cap);
+        if (ptr == NULL) {
+            return false;
+        }
+        *buf = ptr;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, size);
+    *len += size;
+    (*buf)[*len] = '\0';
+    return true;
+}
+
+// Add a piece of text to the shared call and pass it on. If the caller
+// asks to stop, the call goes on while other requests follow it and is
+// stopped only once nobody wants the text.
+static void relay_text(struct StreamState *state, const char *text, size_t len) {
+    flight_t *flight = state->flight;
+    pthread_mutex_lock(&flights_lock);
+    if (!append_bytes(&flight->text, &flight->text_len, &flight->text_cap, text, len)) {
+        state->failed = true;
+    }
+    pthread_cond_broadcast(&flight->changed);
+    pthread_mutex_unlock(&flights_lock);
+
+    if (!state->failed && !state->detached && !state->on_token(text, len, state->ctx)) {
+        state->detached = true;
+    }
+    if (state->detached) {
+        pthread_mutex_lock(&flights_lock);
+        if (flight->followers == 0) {
+            unlist_flight(flight);  // Nobody may join a call that is being stopped
+            state->stopped = true;
+        }
+        pthread_mutex_unlock(&flights_lock);
+    }
+}
+
+// Handle one complete line of the event stream: every "data:" line holds a
+// chunk whose choices[0].delta.content is the next piece of the response
+static void handle_stream_line(struct StreamState *state, char *line, size_t len) {
+    if (len > 0 && line[len - 1] == '\r') {
+        line[--len] = '\0';
+    }
+    if (len < 5 || strncmp(line, "data:", 5) != 0) {
+        return;     // Blank separator, comment or other field
+    }
+    const char *payload = line + 5;
+    if (*payload == ' ') {
+        payload++;
+    }
+    if (strcmp(payload, "[DONE]") == 0) {
+        state->done = true;
+        return;
+    }
+
+    struct json_object *event = json_tokener_parse(payload);
+    if (event == NULL) {
+        log_message(LOG_LEVEL_WARN, "Ignoring malformed stream event");
+        return;
+    }
+
+    struct json_object *choices, *choice, *delta, *content;
+    if (json_object_object_get_ex(event, "choices", &choices) &&
+        json_object_is_type(choices, json_type_array) &&
+        (choice = json_object_array_get_idx(choices, 0)) != NULL &&
+        json_object_object_get_ex(choice, "delta", &delta) &&
+        json_object_object_get_ex(delta, "content", &content) &&
+        json_object_is_type(content, json_type_string)) {
+        const char *text = json_object_get_string(content);
+        size_t text_len = (size_t)json_object_get_string_len(content);
+        if (text_len > 0) {
+            relay_text(state, text, text_len);
+        }
+    }
+    read_usage(event, state->usage);
+    json_object_put(event);
+}
+
+// Callback function for curl to handle a streamed response: split the
+// received bytes into lines and handle each one as soon as it is complete
+static size_t StreamCallback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct StreamState *state = (struct StreamState *)userp;
+    const char *data = contents;
+    const char *end = data + realsize;
+
+    while (data < end && !state->stopped && !state->failed) {
+        const char *newline = memchr(data, '\n', end - data);
+        const char *stop = newline ? newline : end;
+        if (!append_bytes(&state->line, &state->line_len, &state->line_cap, data, stop - data)) {
+            state->failed = true;
+            break;
+        }
+        if (newline == NULL) {
+            break;
+        }
+        handle_stream_line(state, state->line, state->line_len);
+        state->line_len = 0;
+        data = newline + 1;
+    }
+
+    // Returning less than realsize makes curl abort the transfer
+    return (state->stopped || state->failed) ? 0 : realsize;
+}
+
+char *ai_generate_text_stream(const ai_prompt_t *prompt, const char *model_name, ai_token_callback_t on_token,
+                              void *ctx, ai_usage_t *usage) {
+    if (!ai_is_initialized()) {
+        log_message(LOG_LEVEL_ERROR, "AI not initialized. Call ai_init first.");
+        return NULL;
+    }
+
+    if (prompt->question == NULL || strlen(prompt->question) == 0) {
+        log_message(LOG_LEVEL_ERROR, "Prompt cannot be empty");
+        return NULL;
+    }
+
+    const char *model = model_name ? model_name : DEFAULT_MODEL;
+    struct StreamState state = {0};
+    state.on_token = on_token;
+    state.ctx = ctx;
+    state.usage = usage;
+
+    // Same request as ai_generate_chat, with "stream": true
+    struct json_object *json_request = build_request(prompt, model, true);
+    const char *json_str = json_object_to_json_string(json_request);
+
+    // Identical requests in flight share one call
+    bool leader;
+    state.flight = join_flight(json_str, &leader);
+    if (state.flight == NULL || !leader) {
+        char *result = state.flight != NULL ? follow_flight(state.flight, on_token, ctx) : NULL;
+        json_object_put(json_request);
+        return result;
+    }
+
+    CURL *curl = take_handle();
+    if (curl == NULL) {
+        json_object_put(json_request);
+        return finish_flight(state.flight, NULL, true);
+    }
+
+    struct curl_slist *headers = NULL;
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    headers = curl_slist_append(headers, "Accept: text/event-stream");
+    char auth_header[256];
+    if (format_auth_header(auth_header, sizeof(auth_header))) {
+        headers = curl_slist_append(headers, auth_header);
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, DEEPSEEK_API_URL);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_str);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, StreamCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&state);
+
+    log_message(LOG_LEVEL_DEBUG, "Sending streaming request to DeepSeek API...");
+    CURLcode res = curl_easy_perform(curl);
+
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    if (state.stopped) {
+        log_message(LOG_LEVEL_DEBUG, "Streaming request stopped by the caller");
+    } else if (state.failed) {
+        log_message(LOG_LEVEL_ERROR, "Out of memory while receiving the DeepSeek stream");
+    } else if (res != CURLE_OK) {
+        log_message(LOG_LEVEL_ERROR, "curl_easy_perform() failed: %s", curl_easy_strerror(res));
+    } else if (status != 200) {
+        log_message(LOG_LEVEL_ERROR, "DeepSeek API returned HTTP %ld", status);
+    } else if (!state.done) {
+        log_message(LOG_LEVEL_WARN, "DeepSeek stream ended without [DONE]");
+    }
+
+    curl_slist_free_all(headers);
+    return_handle(curl, "streaming");
+    json_object_put(json_request);
+    free(state.line);
+
+    // Keep a partial answer if the stream was cut off after some text. Only
+    // this thread writes the text, so its length can be read unlocked.
+    return finish_flight(state.flight, NULL, state.stopped || state.failed || state.flight->text_len == 0);
+}
+
 void demo_ai_operations(void) {
     char api_key_input[256] = {0};
     char prompt[1024] = {0};
@@ -353,7 +924,7 @@ void demo_ai_operations(void) {
     }
     
     // Ask for API key if not already set
-    if (!api_key_loaded && api_key == NULL) {
+    if (!api_key_loaded && !ai_is_initialized()) {
         print_message("Enter your DeepSeek API Key (or path to .env file): ");
         
         // Read API key
@@ -0,0 +1,275 @@
+#include "../../include/arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define ALIGNMENT _Alignof(max_align_t)
+#define ALIGN_UP(n) (((n) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+// Header of a pooled block or of a large allocation; the memory follows it
+typedef struct block {
+    struct block *next;
+    size_t size;            // Total size including this header
+    size_t used;            // Bytes handed out, including this header
+} block_t;
+
+#define BLOCK_HEADER ALIGN_UP(sizeof(block_t))
+
+struct arena_pool {
+    size_t block_size;
+    size_t max_free;
+    pthread_mutex_t lock;
+    block_t *free_blocks;
+    size_t free_count;
+    size_t blocks_in_use;
+    size_t arenas_in_use;
+    unsigned long limit_failures;
+};
+
+// Lives at the start of the arena's first block
+struct arena {
+    arena_pool_t *pool;
+    block_t *blocks;        // Pooled blocks, the current one first
+    block_t *large;         // Allocations bigger than a block, the latest first
+    size_t limit;
+    size_t used;            // Memory charged against the limit
+};
+
+arena_pool_t *arena_pool_create(size_t block_size, size_t max_free_blocks) {
+    // A block must at least hold its header and the arena
+    size_t min_size = BLOCK_HEADER + ALIGN_UP(sizeof(arena_t)) + ALIGNMENT;
+    if (block_size < min_size) {
+        block_size = min_size;
+    }
+
+    arena_pool_t *pool = calloc(1, sizeof(arena_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->block_size = ALIGN_UP(block_size);
+    pool->max_free = max_free_blocks;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+void arena_pool_free(arena_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    block_t *block = pool->free_blocks;
+    while (block != NULL) {
+        block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void arena_pool_get_stats(arena_pool_t *pool, arena_pool_stats_t *stats) {
+    pthread_mutex_lock(&pool->lock);
+    stats->arenas_in_use = pool->arenas_in_use;
+    stats->blocks_in_use = pool->blocks_in_use;
+    stats->blocks_free = pool->free_count;
+    stats->limit_failures = pool->limit_failures;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Take a free block, or allocate one if the pool is empty
+static block_t *take_block(arena_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    block_t *block = pool->free_blocks;
+    if (block != NULL) {
+        pool->free_blocks = block->next;
+        pool->free_count--;
+    }
+    pool->blocks_in_use++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (block == NULL) {
+        block = malloc(pool->block_size);
+        if (block == NULL) {
+            pthread_mutex_lock(&pool->lock);
+            pool->blocks_in_use--;
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+    }
+    block->next = NULL;
+    block->size = pool->block_size;
+    block->used = BLOCK_HEADER;
+    return block;
+}
+
+static void count_limit_failure(arena_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->limit_failures++;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+arena_t *arena_acquire(arena_pool_t *pool, size_t limit) {
+    if (limit < pool->block_size) {
+        return NULL;
+    }
+    block_t *block = take_block(pool);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    arena_t *arena = (arena_t *)((char *)block + block->used);
+    block->used += ALIGN_UP(sizeof(arena_t));
+    arena->pool = pool;
+    arena->blocks = block;
+    arena->large = NULL;
+    arena->limit = limit;
+    arena->used = pool->block_size;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->arenas_in_use++;
+    pthread_mutex_unlock(&pool->lock);
+    return arena;
+}
+
+void arena_release(arena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    arena_pool_t *pool = arena->pool;
+    block_t *blocks = arena->blocks;    // The arena itself is in the last of these
+
+    block_t *large = arena->large;
+    while (large != NULL) {
+        block_t *next = large->next;
+        free(large);
+        large = next;
+    }
+
+    // Keep up to max_free blocks for the next requests, free the rest
+    block_t *surplus = NULL;
+    pthread_mutex_lock(&pool->lock);
+    while (blocks != NULL) {
+        block_t *next = blocks->next;
+        if (pool->free_count < pool->max_free) {
+            blocks->next = pool->free_blocks;
+            pool->free_blocks = blocks;
+            pool->free_count++;
+        } else {
+            blocks->next = surplus;
+            surplus = blocks;
+        }
+        pool->blocks_in_use--;
+        blocks = next;
+    }
+    pool->arenas_in_use--;
+    pthread_mutex_unlock(&pool->lock);
+
+    while (surplus != NULL) {
+        block_t *next = surplus->next;
+        free(surplus);
+        surplus = next;
+    }
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_pool_t *pool = arena->pool;
+    size_t need = ALIGN_UP(size > 0 ? size : 1);
+    block_t *block = arena->blocks;
+
+    if (need <= block->size - block->used) {
+        void *ptr = (char *)block + block->used;
+        block->used += need;
+        return ptr;
+    }
+
+    // Too big for any block: allocate it on its own
+    if (need > pool->block_size - BLOCK_HEADER) {
+        if (need + BLOCK_HEADER > arena->limit - arena->used) {
+            count_limit_failure(pool);
+            return NULL;
+        }
+        block_t *large = malloc(BLOCK_HEADER + need);
+        if (large == NULL) {
+            return NULL;
+        }
+        large->size = BLOCK_HEADER + need;
+        large->used = large->size;
+        large->next = arena->large;
+        arena->large = large;
+        arena->used += large->size;
+        return (char *)large + BLOCK_HEADER;
+    }
+
+    // Start a new block; what is left of the current one is not used
+    if (pool->block_size > arena->limit - arena->used) {
+        count_limit_failure(pool);
+        return NULL;
+    }
+    block = take_block(pool);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->used += pool->block_size;
+
+    void *ptr = (char *)block + block->used;
+    block->used += need;
+    return ptr;
+}
+
+void *arena_calloc(arena_t *arena, size_t size) {
+    void *ptr = arena_alloc(arena, size);
+    if (ptr != NULL) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    size_t old_need = ALIGN_UP(old_size > 0 ? old_size : 1);
+    size_t need = ALIGN_UP(new_size);
+
+    // The latest allocation of the current block can extend into its free space
+    block_t *block = arena->blocks;
+    if ((char *)ptr + old_need == (char *)block + block->used &&
+        need - old_need <= block->size - block->used) {
+        block->used += need - old_need;
+        return ptr;
+    }
+
+    // The latest large allocation is resized on its own
+    block_t *large = arena->large;
+    if (large != NULL && ptr == (char *)large + BLOCK_HEADER) {
+        size_t old_total = large->size;
+        if (BLOCK_HEADER + need > arena->limit - (arena->used - old_total)) {
+            count_limit_failure(arena->pool);
+            return NULL;
+        }
+        block_t *resized = realloc(large, BLOCK_HEADER + need);
+        if (resized == NULL) {
+            return NULL;
+        }
+        resized->size = BLOCK_HEADER + need;
+        resized->used = resized->size;
+        arena->large = resized;
+        arena->used = arena->used - old_total + resized->size;
+        return (char *)resized + BLOCK_HEADER;
+    }
+
+    void *grown = arena_alloc(arena, new_size);
+    if (grown != NULL) {
+        memcpy(grown, ptr, old_size);
+    }
+    return grown;
+}
+
+size_t arena_used(const arena_t *arena) {
+    return arena->used;
+}
@@ -0,0 +1,265 @@
+#include "../../include/demo_zygote.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+// Server side of the zygote connection
+static int zygote_sock = -1;
+static pid_t zygote_pid = -1;
+static pthread_mutex_t zygote_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Send a message with a descriptor attached (none if fd is -1)
+static int send_with_fd(int sock, void *data, size_t size, int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {data, size};
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd != -1) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    return sent == (ssize_t)size ? 0 : -1;
+}
+
+// Receive a message sent by send_with_fd; returns 1 on success, 0 when the
+// peer closed the socket and -1 on error. *fd is -1 if no descriptor was
+// attached.
+static int recv_with_fd(int sock, void *data, size_t size, int *fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {data, size};
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *fd = -1;
+    ssize_t received;
+    do {
+        received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (received == -1 && errno == EINTR);
+    if (received <= 0) {
+        return received == 0 ? 0 : -1;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    if (received != (ssize_t)size) {
+        if (*fd != -1) {
+            close(*fd);
+            *fd = -1;
+        }
+        return -1;
+    }
+    return 1;
+}
+
+// Reap every worker that has exited. The zygote reaps workers itself instead
+// of ignoring SIGCHLD so a worker's PID cannot be reused before the zygote
+// has opened its pidfd.
+static void reap_workers(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+    }
+    errno = saved_errno;
+}
+
+// Worker: run one demo with its output on fd
+static void run_worker(int fd, unsigned int index, demo_zygote_runner_t runner) {
+    // Demos expect the default dispositions the zygote changed
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    if (dup2(fd, STDOUT_FILENO) == -1 || dup2(fd, STDERR_FILENO) == -1) {
+        perror("dup2");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    // Flush every line so output reaches the pipe as it is printed
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    runner(index);
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
+}
+
+// Zygote: fork a worker for every request until the server goes away
+static void zygote_main(int sock, demo_zygote_runner_t runner) {
+    // Ctrl+C is handled by the server, which stops the zygote by closing
+    // the socket
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = reap_workers;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGINT, SIG_IGN);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    // The server blocks its shutdown signals before starting; workers and
+    // the zygote's own SIGTERM on server death need them unblocked
+    sigset_t sigchld, unblocked;
+    sigemptyset(&unblocked);
+    sigprocmask(SIG_SETMASK, &unblocked, NULL);
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+
+    while (1) {
+        uint32_t index;
+        int fd;
+        if (recv_with_fd(sock, &index, sizeof(index), &fd) <= 0) {
+            break;
+        }
+
+        int32_t reply;
+        int pidfd = -1;
+        if (fd == -1) {
+            reply = -EINVAL;
+        } else {
+            // Keep the worker unreaped until its pidfd is open, so the
+            // descriptor cannot refer to another process
+            sigprocmask(SIG_BLOCK, &sigchld, &unblocked);
+            pid_t pid = fork();
+            if (pid == 0) {
+                sigprocmask(SIG_SETMASK, &unblocked, NULL);
+                close(sock);
+                run_worker(fd, index, runner);
+            }
+            reply = pid == -1 ? -errno : pid;
+            if (pid != -1) {
+                // Kernels without pidfds (before 5.3) get no descriptor;
+                // the server then never signals the worker
+                pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+            }
+            sigprocmask(SIG_SETMASK, &unblocked, NULL);
+            close(fd);
+        }
+
+        int sent = send_with_fd(sock, &reply, sizeof(reply), pidfd);
+        if (pidfd != -1) {
+            close(pidfd);
+        }
+        if (sent != 0) {
+            break;
+        }
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+int demo_zygote_start(demo_zygote_runner_t runner) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair");
+        return -1;
+    }
+
+    // Flush so buffered output is not written twice by the child
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        close(sv[0]);
+        zygote_main(sv[1], runner);
+    }
+
+    close(sv[1]);
+    zygote_sock = sv[0];
+    zygote_pid = pid;
+    return 0;
+}
+
+pid_t demo_zygote_spawn(unsigned int index, int output_fd, int *pidfd) {
+    int32_t reply = -1;
+    int received = -1;
+
+    *pidfd = -1;
+    pthread_mutex_lock(&zygote_lock);
+    if (zygote_sock == -1) {
+        pthread_mutex_unlock(&zygote_lock);
+        return -1;
+    }
+
+    // Requests and replies are paired, so one request is in flight at a time
+    if (send_with_fd(zygote_sock, &index, sizeof(index), output_fd) == 0) {
+        received = recv_with_fd(zygote_sock, &reply, sizeof(reply), pidfd);
+    }
+
+    if (received != 1) {
+        // The zygote is gone; callers fall back to forking themselves
+        fprintf(stderr, "Demo zygote stopped responding\n");
+        close(zygote_sock);
+        zygote_sock = -1;
+        pthread_mutex_unlock(&zygote_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&zygote_lock);
+
+    if (reply < 0) {
+        errno = -reply;
+        return -1;
+    }
+    return reply;
+}
+
+int demo_zygote_running(void) {
+    pthread_mutex_lock(&zygote_lock);
+    int running = zygote_sock != -1;
+    pthread_mutex_unlock(&zygote_lock);
+    return running;
+}
+
+void demo_zygote_stop(void) {
+    pthread_mutex_lock(&zygote_lock);
+    if (zygote_sock != -1) {
+        close(zygote_sock);
+        zygote_sock = -1;
+    }
+    pid_t pid = zygote_pid;
+    zygote_pid = -1;
+    pthread_mutex_unlock(&zygote_lock);
+
+    if (pid != -1) {
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+        }
+    }
+}
@@ -0,0 +1,345 @@
+#include "../../include/json_escape.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+// Replacement for bytes that are not part of valid UTF-8 (U+FFFD)
+static const char replacement_char[] = "\xEF\xBF\xBD";
+#define REPLACEMENT_LEN 3
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Extra output bytes for each ASCII byte: 1 for a two-character escape,
+// 5 for \u00XX and 0 for bytes copied unchanged
+static const unsigned char escape_extra[128] = {
+    5, 5, 5, 5, 5, 5, 5, 5, 1, 1, 1, 5, 1, 1, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    ['"'] = 1, ['\\'] = 1,
+};
+
+// Second character of the two-character escapes
+static const char escape_short[128] = {
+    ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', ['\f'] = 'f', ['\r'] = 'r',
+    ['"'] = '"', ['\\'] = '\\',
+};
+
+// Once the block loop stops at non-ASCII text, bytes are handled one at a
+// time until a run of plain ASCII as long as the smallest block is seen;
+// anything shorter could not fill an ASCII block anyway
+#define PLAIN_RUN 16
+
+// Write the escape for an ASCII byte that needs one
+static inline size_t write_escape(char *dst, unsigned char c) {
+    dst[0] = '\\';
+    if (escape_short[c] != 0) {
+        dst[1] = escape_short[c];
+        return 2;
+    }
+    dst[1] = 'u';
+    dst[2] = '0';
+    dst[3] = '0';
+    dst[4] = hex_digits[c >> 4];
+    dst[5] = hex_digits[c & 0xF];
+    return 6;
+}
+
+#ifdef HAVE_X86_SIMD
+// Copy a block of ASCII text, escaping the bytes whose bits are set in mask
+static inline char *escape_block(char *dst, const char *src, size_t width, uint32_t mask) {
+    size_t pos = 0;
+    while (mask != 0) {
+        size_t k = __builtin_ctz(mask);
+        memcpy(dst, src + pos, k - pos);
+        dst += k - pos;
+        dst += write_escape(dst, (unsigned char)src[k]);
+        pos = k + 1;
+        mask &= mask - 1;
+    }
+    memcpy(dst, src + pos, width - pos);
+    return dst + width - pos;
+}
+
+// The block functions handle the ASCII text at the start of src, 16 or 32
+// bytes per step, and stop at the first block holding a byte >= 0x80 or
+// shorter than a full step; they return the number of bytes consumed.
+// Escaping takes the escapes from a bit mask, and counting adds them up
+// with popcount, so text with many escapes needs no byte loop either.
+// A signed compare against 0x20 finds the control characters, which is
+// safe because blocks with bytes >= 0x80 were ruled out first.
+__attribute__((target("sse2")))
+static size_t escape_ascii_sse2(char **out, const char *src, size_t len) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    char *dst = *out;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(v) != 0) {
+            break;
+        }
+        __m128i special = _mm_or_si128(_mm_cmplt_epi8(v, space),
+                                       _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(special);
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i *)dst, v);
+            dst += 16;
+        } else {
+            dst = escape_block(dst, src + i, 16, mask);
+        }
+    }
+    *out = dst;
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t count_ascii_sse2(const char *src, size_t len, size_t *out) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(v) != 0) {
+            break;
+        }
+        __m128i two = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        two = _mm_or_si128(two, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        two = _mm_or_si128(two, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+        two = _mm_or_si128(two, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+        two = _mm_or_si128(two, _mm_cmpeq_epi8(v, _mm_set1_epi8('\b')));
+        two = _mm_or_si128(two, _mm_cmpeq_epi8(v, _mm_set1_epi8('\f')));
+        uint32_t two_mask = (uint32_t)_mm_movemask_epi8(two);
+        uint32_t unicode_mask = (uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(v, space)) & ~two_mask;
+        *out += 16 + __builtin_popcount(two_mask) + 5 * __builtin_popcount(unicode_mask);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t escape_ascii_avx2(char **out, const char *src, size_t len) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    char *dst = *out;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        if (_mm256_movemask_epi8(v) != 0) {
+            break;
+        }
+        // AVX2 has no signed less-than, so test 0x20 > v instead
+        __m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(space, v),
+                                          _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                                          _mm256_cmpeq_epi8(v, backslash)));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(special);
+        if (mask == 0) {
+            _mm256_storeu_si256((__m256i *)dst, v);
+            dst += 32;
+        } else {
+            dst = escape_block(dst, src + i, 32, mask);
+        }
+    }
+    *out = dst;
+    // GCC leaves the upper halves dirty when calling a local function, which
+    // makes every SSE2 instruction after this point pay a transition penalty
+    _mm256_zeroupper();
+    return i + escape_ascii_sse2(out, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_ascii_avx2(const char *src, size_t len, size_t *out) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        if (_mm256_movemask_epi8(v) != 0) {
+            break;
+        }
+        __m256i two = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        two = _mm256_or_si256(two, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        two = _mm256_or_si256(two, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+        two = _mm256_or_si256(two, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+        two = _mm256_or_si256(two, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\b')));
+        two = _mm256_or_si256(two, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\f')));
+        uint32_t two_mask = (uint32_t)_mm256_movemask_epi8(two);
+        uint32_t unicode_mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(space, v)) & ~two_mask;
+        *out += 32 + __builtin_popcount(two_mask) + 5 * __builtin_popcount(unicode_mask);
+    }
+    _mm256_zeroupper();
+    return i + count_ascii_sse2(src + i, len - i, out);
+}
+
+static int has_avx2(void) {
+    static int cached = -1;
+    if (cached == -1) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return cached;
+}
+#else
+// Length of the run of ASCII bytes that need no escaping
+static size_t scan_plain(const char *src, size_t len) {
+    size_t i = 0;
+    while (i < len && (unsigned char)src[i] < 0x80 && escape_extra[(unsigned char)src[i]] == 0) {
+        i++;
+    }
+    return i;
+}
+#endif
+
+// Escape the leading ASCII text; returns the bytes consumed
+static size_t escape_ascii(char **out, const char *src, size_t len) {
+#ifdef HAVE_X86_SIMD
+    return has_avx2() ? escape_ascii_avx2(out, src, len) : escape_ascii_sse2(out, src, len);
+#else
+    size_t plain = scan_plain(src, len);
+    memcpy(*out, src, plain);
+    *out += plain;
+    return plain;
+#endif
+}
+
+// Output length of the leading ASCII text; returns the bytes consumed
+static size_t count_ascii(const char *src, size_t len, size_t *out) {
+#ifdef HAVE_X86_SIMD
+    return has_avx2() ? count_ascii_avx2(src, len, out) : count_ascii_sse2(src, len, out);
+#else
+    size_t plain = scan_plain(src, len);
+    *out += plain;
+    return plain;
+#endif
+}
+
+// Length of the valid UTF-8 sequence at src, or 0 if it is invalid
+static inline size_t utf8_sequence_length(const unsigned char *src, size_t len) {
+    unsigned char c = src[0];
+    size_t n;
+    unsigned char min = 0x80, max = 0xBF;   // Allowed range of the second byte
+
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        if (c == 0xE0) min = 0xA0;          // Overlong
+        if (c == 0xED) max = 0x9F;          // Surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        if (c == 0xF0) min = 0x90;          // Overlong
+        if (c == 0xF4) max = 0x8F;          // Above U+10FFFF
+    } else {
+        return 0;
+    }
+
+    if (len < n || src[1] < min || src[1] > max) {
+        return 0;
+    }
+    for (size_t i = 2; i < n; i++) {
+        if ((src[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+size_t json_escaped_length(const char *src, size_t len) {
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        i += count_ascii(src + i, len - i, &out);
+
+        size_t run = 0;
+        while (i < len && run < PLAIN_RUN) {
+            unsigned char c = (unsigned char)src[i];
+            if (c < 0x80) {
+                unsigned int extra = escape_extra[c];
+                out += 1 + extra;
+                run = extra == 0 ? run + 1 : 0;
+                i++;
+            } else {
+                size_t n = utf8_sequence_length((const unsigned char *)src + i, len - i);
+                out += n ? n : REPLACEMENT_LEN;
+                i += n ? n : 1;
+                run = 0;
+            }
+        }
+    }
+    return out;
+}
+
+size_t json_escape(char *dst, const char *src, size_t len) {
+    char *out = dst;
+    size_t i = 0;
+
+    while (i < len) {
+        i += escape_ascii(&out, src + i, len - i);
+
+        size_t run = 0;
+        while (i < len && run < PLAIN_RUN) {
+            unsigned char c = (unsigned char)src[i];
+            if (c < 0x80) {
+                if (escape_extra[c] == 0) {
+                    *out++ = (char)c;
+                    run++;
+                } else {
+                    out += write_escape(out, c);
+                    run = 0;
+                }
+                i++;
+            } else {
+                size_t n = utf8_sequence_length((const unsigned char *)src + i, len - i);
+                if (n != 0) {
+                    memcpy(out, src + i, n);
+                    out += n;
+                    i += n;
+                } else {
+                    memcpy(out, replacement_char, REPLACEMENT_LEN);
+                    out += REPLACEMENT_LEN;
+                    i++;
+                }
+                run = 0;
+            }
+        }
+    }
+    return out - dst;
+}
+
+char *json_wrap_string(const char *prefix, const char *src, size_t len, const char *suffix, size_t *out_len) {
+    size_t prefix_len = strlen(prefix);
+    size_t suffix_len = strlen(suffix);
+    size_t escaped_len = json_escaped_length(src, len);
+    size_t total = prefix_len + escaped_len + suffix_len;
+
+    char *json = malloc(total + 1);
+    if (json == NULL) {
+        return NULL;
+    }
+
+    memcpy(json, prefix, prefix_len);
+    json_escape(json + prefix_len, src, len);
+    memcpy(json + prefix_len + escaped_len, suffix, suffix_len + 1);
+
+    if (out_len != NULL) {
+        *out_len = total;
+    }
+    return json;
+}
+
+const char *json_escape_implementation(void) {
+#ifdef HAVE_X86_SIMD
+    return has_avx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,603 @@
+#include "../../include/json_stream.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Member names are only kept up to this length; longer keys never match
+#define MAX_KEY_LEN 64
+
+// Written in place of unpaired surrogates
+#define REPLACEMENT_CODE_POINT 0xFFFD
+
+typedef enum {
+    STATE_VALUE,            // Expecting a value
+    STATE_ARRAY_FIRST,      // After '[': a value or ']'
+    STATE_OBJECT_FIRST,     // After '{': a key or '}'
+    STATE_KEY,              // After ',' in an object: a key
+    STATE_COLON,            // After a key
+    STATE_AFTER_VALUE,      // After a value: ',' or a closing bracket
+    STATE_STRING,           // Inside a key or string value
+    STATE_ESCAPE,           // After a backslash in a string
+    STATE_UNICODE,          // Reading the hex digits of \uXXXX
+    STATE_LITERAL,          // Inside true, false or null
+    STATE_NUMBER,           // Inside a number
+    STATE_DONE              // The top-level value is complete
+} parse_state_t;
+
+// Position in the number grammar
+typedef enum {
+    NUMBER_MINUS,           // After '-'
+    NUMBER_ZERO,            // Integer part is "0"
+    NUMBER_INT,             // In the integer digits
+    NUMBER_DOT,             // After '.'
+    NUMBER_FRACTION,        // In the fraction digits
+    NUMBER_EXP,             // After 'e' or 'E'
+    NUMBER_EXP_SIGN,        // After the exponent's sign
+    NUMBER_EXP_INT          // In the exponent digits
+} number_state_t;
+
+// A member of the top-level object the caller asked for
+typedef struct {
+    const char *name;
+    json_type_t type;
+    char *value;            // NUL-terminated text of the value
+    size_t len;
+    size_t cap;
+} field_t;
+
+struct json_stream {
+    arena_t *arena;                 // Source of all memory, NULL for malloc
+    json_stream_status_t status;
+    parse_state_t state;
+    size_t size;                    // Bytes consumed so far
+    size_t max_size;
+    unsigned int depth;
+    unsigned int max_depth;
+    char *containers;               // '{' or '[' for each open level
+
+    // String being read
+    int in_key;
+    char key[MAX_KEY_LEN];
+    size_t key_len;                 // MAX_KEY_LEN + 1 once the key is too long
+    unsigned int code_unit;         // \uXXXX being read
+    int hex_digits;
+    unsigned int high_surrogate;    // Waiting for its low half, 0 if none
+
+    // Literal or number being read
+    const char *literal;            // Characters of true/false/null still expected
+    number_state_t number;
+
+    field_t *capture;               // Field receiving the current value, if any
+    size_t field_count;
+    field_t fields[];
+};
+
+static int is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int hex_value(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+json_stream_t *json_stream_create(arena_t *arena, const char *const *fields, size_t max_size,
+                                  unsigned int max_depth) {
+    size_t count = 0;
+    while (fields != NULL && fields[count] != NULL) {
+        count++;
+    }
+    if (max_depth == 0) {
+        max_depth = 1;
+    }
+
+    size_t size = sizeof(json_stream_t) + count * sizeof(field_t);
+    json_stream_t *stream = arena != NULL ? arena_calloc(arena, size) : calloc(1, size);
+    if (stream == NULL) {
+        return NULL;
+    }
+    stream->containers = arena != NULL ? arena_alloc(arena, max_depth) : malloc(max_depth);
+    if (stream->containers == NULL) {
+        if (arena == NULL) {
+            free(stream);
+        }
+        return NULL;
+    }
+
+    stream->arena = arena;
+    stream->status = JSON_STREAM_OK;
+    stream->state = STATE_VALUE;
+    stream->max_size = max_size;
+    stream->max_depth = max_depth;
+    stream->field_count = count;
+    for (size_t i = 0; i < count; i++) {
+        stream->fields[i].name = fields[i];
+        stream->fields[i].type = JSON_TYPE_NONE;
+    }
+    return stream;
+}
+
+void json_stream_free(json_stream_t *stream) {
+    // Arena memory goes back with the arena
+    if (stream == NULL || stream->arena != NULL) {
+        return;
+    }
+    for (size_t i = 0; i < stream->field_count; i++) {
+        free(stream->fields[i].value);
+    }
+    free(stream->containers);
+    free(stream);
+}
+
+// Append bytes to the value being captured
+static void capture_bytes(json_stream_t *stream, const char *data, size_t len) {
+    field_t *field = stream->capture;
+    if (field->len + len + 1 > field->cap) {
+        size_t cap = field->cap ? field->cap : 64;
+        while (field->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        char *value = stream->arena != NULL ? arena_grow(stream->arena, field->value, field->cap, cap)
+                                            : realloc(field->value, cap);
+        if (value == NULL) {
+            stream->status = JSON_STREAM_ERROR_MEMORY;
+            return;
+        }
+        field->value = value;
+        field->cap = cap;
+    }
+    memcpy(field->value + field->len, data, len);
+    field->len += len;
+    field->value[field->len] = '\0';
+}
+
+// Append decoded bytes to the current key or captured string
+static void string_bytes(json_stream_t *stream, const char *data, size_t len) {
+    if (stream->in_key) {
+        if (stream->key_len + len <= MAX_KEY_LEN) {
+            memcpy(stream->key + stream->key_len, data, len);
+            stream->key_len += len;
+        } else {
+            stream->key_len = MAX_KEY_LEN + 1;
+        }
+    } else if (stream->capture != NULL) {
+        capture_bytes(stream, data, len);
+    }
+}
+
+static void string_code_point(json_stream_t *stream, unsigned int cp) {
+    char utf8[4];
+    size_t n;
+
+    if (cp < 0x80) {
+        utf8[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        utf8[0] = (char)(0xC0 | (cp >> 6));
+        utf8[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        utf8[0] = (char)(0xE0 | (cp >> 12));
+        utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        utf8[0] = (char)(0xF0 | (cp >> 18));
+        utf8[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    string_bytes(stream, utf8, n);
+}
+
+// A high surrogate not followed by its low half becomes U+FFFD
+static void flush_surrogate(json_stream_t *stream) {
+    if (stream->high_surrogate != 0) {
+        stream->high_surrogate = 0;
+        string_code_point(stream, REPLACEMENT_CODE_POINT);
+    }
+}
+
+// Handle the code unit of a complete \uXXXX escape
+static void string_code_unit(json_stream_t *stream, unsigned int unit) {
+    if (stream->high_surrogate != 0) {
+        if (unit >= 0xDC00 && unit <= 0xDFFF) {
+            unsigned int cp = 0x10000 + ((stream->high_surrogate - 0xD800) << 10) + (unit - 0xDC00);
+            stream->high_surrogate = 0;
+            string_code_point(stream, cp);
+            return;
+        }
+        flush_surrogate(stream);
+    }
+
+    if (unit >= 0xD800 && unit <= 0xDBFF) {
+        stream->high_surrogate = unit;
+    } else if (unit >= 0xDC00 && unit <= 0xDFFF) {
+        string_code_point(stream, REPLACEMENT_CODE_POINT);
+    } else {
+        string_code_point(stream, unit);
+    }
+}
+
+// Called when a value of the given type starts
+static void begin_value(json_stream_t *stream, json_type_t type) {
+    field_t *field = stream->capture;
+    if (field == NULL) {
+        return;
+    }
+    // A repeated member replaces the earlier value
+    field->type = type;
+    field->len = 0;
+    if (field->value != NULL) {
+        field->value[0] = '\0';
+    }
+    // Members of nested objects and arrays are not captured
+    if (type == JSON_TYPE_OBJECT || type == JSON_TYPE_ARRAY) {
+        stream->capture = NULL;
+    }
+}
+
+static void end_value(json_stream_t *stream) {
+    stream->capture = NULL;
+    stream->state = stream->depth == 0 ? STATE_DONE : STATE_AFTER_VALUE;
+}
+
+static void open_container(json_stream_t *stream, char c) {
+    if (stream->depth == stream->max_depth) {
+        stream->status = JSON_STREAM_ERROR_DEPTH;
+        return;
+    }
+    begin_value(stream, c == '{' ? JSON_TYPE_OBJECT : JSON_TYPE_ARRAY);
+    stream->containers[stream->depth++] = c;
+    stream->state = c == '{' ? STATE_OBJECT_FIRST : STATE_ARRAY_FIRST;
+}
+
+static void close_container(json_stream_t *stream, char c) {
+    char open = c == '}' ? '{' : '[';
+    if (stream->depth == 0 || stream->containers[stream->depth - 1] != open) {
+        stream->status = JSON_STREAM_ERROR_SYNTAX;
+        return;
+    }
+    stream->depth--;
+    end_value(stream);
+}
+
+static void begin_string(json_stream_t *stream, int is_key) {
+    stream->in_key = is_key;
+    stream->key_len = 0;
+    stream->high_surrogate = 0;
+    if (!is_key) {
+        begin_value(stream, JSON_TYPE_STRING);
+    }
+    stream->state = STATE_STRING;
+}
+
+static void end_string(json_stream_t *stream) {
+    flush_surrogate(stream);
+    if (!stream->in_key) {
+        end_value(stream);
+        return;
+    }
+
+    // Only members of the top-level object are captured
+    stream->in_key = 0;
+    stream->capture = NULL;
+    if (stream->depth == 1 && stream->containers[0] == '{' && stream->key_len <= MAX_KEY_LEN) {
+        for (size_t i = 0; i < stream->field_count; i++) {
+            const char *name = stream->fields[i].name;
+            if (strlen(name) == stream->key_len && memcmp(name, stream->key, stream->key_len) == 0) {
+                stream->capture = &stream->fields[i];
+                break;
+            }
+        }
+    }
+    stream->state = STATE_COLON;
+}
+
+static void begin_literal(json_stream_t *stream, unsigned char c) {
+    json_type_t type;
+    switch (c) {
+        case 't': stream->literal = "rue"; type = JSON_TYPE_TRUE; break;
+        case 'f': stream->literal = "alse"; type = JSON_TYPE_FALSE; break;
+        default: stream->literal = "ull"; type = JSON_TYPE_NULL; break;
+    }
+    begin_value(stream, type);
+    if (stream->capture != NULL) {
+        capture_bytes(stream, (const char *)&c, 1);
+    }
+    stream->state = STATE_LITERAL;
+}
+
+static void begin_number(json_stream_t *stream, unsigned char c) {
+    begin_value(stream, JSON_TYPE_NUMBER);
+    if (stream->capture != NULL) {
+        capture_bytes(stream, (const char *)&c, 1);
+    }
+    stream->number = c == '-' ? NUMBER_MINUS : c == '0' ? NUMBER_ZERO : NUMBER_INT;
+    stream->state = STATE_NUMBER;
+}
+
+// Advance the number grammar; returns 0 if c does not continue the number
+static int number_char(json_stream_t *stream, unsigned char c) {
+    int digit = c >= '0' && c <= '9';
+
+    switch (stream->number) {
+        case NUMBER_MINUS:
+            if (!digit) return 0;
+            stream->number = c == '0' ? NUMBER_ZERO : NUMBER_INT;
+            break;
+        case NUMBER_ZERO:
+        case NUMBER_INT:
+            if (digit && stream->number == NUMBER_INT) {
+                break;
+            } else if (c == '.') {
+                stream->number = NUMBER_DOT;
+            } else if (c == 'e' || c == 'E') {
+                stream->number = NUMBER_EXP;
+            } else {
+                return 0;
+            }
+            break;
+        case NUMBER_DOT:
+        case NUMBER_FRACTION:
+            if (digit) {
+                stream->number = NUMBER_FRACTION;
+            } else if (stream->number == NUMBER_FRACTION && (c == 'e' || c == 'E')) {
+                stream->number = NUMBER_EXP;
+            } else {
+                return 0;
+            }
+            break;
+        case NUMBER_EXP:
+            if (c == '+' || c == '-') {
+                stream->number = NUMBER_EXP_SIGN;
+                break;
+            }
+            /* fall through */
+        case NUMBER_EXP_SIGN:
+        case NUMBER_EXP_INT:
+            if (!digit) return 0;
+            stream->number = NUMBER_EXP_INT;
+            break;
+    }
+
+    if (stream->capture != NULL) {
+        capture_bytes(stream, (const char *)&c, 1);
+    }
+    return 1;
+}
+
+// A number may only end after a digit
+static int number_complete(const json_stream_t *stream) {
+    return stream->number == NUMBER_ZERO || stream->number == NUMBER_INT ||
+           stream->number == NUMBER_FRACTION || stream->number == NUMBER_EXP_INT;
+}
+
+// Consume one byte outside the bulk string copy
+static void consume(json_stream_t *stream, unsigned char c) {
+    switch (stream->state) {
+        case STATE_NUMBER:
+            if (number_char(stream, c)) {
+                return;
+            }
+            if (!number_complete(stream)) {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+                return;
+            }
+            // The byte after a number belongs to what follows it
+            end_value(stream);
+            consume(stream, c);
+            return;
+
+        case STATE_VALUE:
+        case STATE_ARRAY_FIRST:
+            if (is_space(c)) {
+                return;
+            }
+            if (c == ']' && stream->state == STATE_ARRAY_FIRST) {
+                close_container(stream, c);
+            } else if (c == '{' || c == '[') {
+                open_container(stream, c);
+            } else if (c == '"') {
+                begin_string(stream, 0);
+            } else if (c == '-' || (c >= '0' && c <= '9')) {
+                begin_number(stream, c);
+            } else if (c == 't' || c == 'f' || c == 'n') {
+                begin_literal(stream, c);
+            } else {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+            }
+            return;
+
+        case STATE_OBJECT_FIRST:
+        case STATE_KEY:
+            if (is_space(c)) {
+                return;
+            }
+            if (c == '}' && stream->state == STATE_OBJECT_FIRST) {
+                close_container(stream, c);
+            } else if (c == '"') {
+                begin_string(stream, 1);
+            } else {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+            }
+            return;
+
+        case STATE_COLON:
+            if (is_space(c)) {
+                return;
+            }
+            if (c == ':') {
+                stream->state = STATE_VALUE;
+            } else {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+            }
+            return;
+
+        case STATE_AFTER_VALUE:
+            if (is_space(c)) {
+                return;
+            }
+            if (c == ',') {
+                stream->state = stream->containers[stream->depth - 1] == '{' ? STATE_KEY : STATE_VALUE;
+            } else if (c == '}' || c == ']') {
+                close_container(stream, c);
+            } else {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+            }
+            return;
+
+        case STATE_STRING:
+            if (c == '"') {
+                end_string(stream);
+            } else if (c == '\\') {
+                stream->state = STATE_ESCAPE;
+            } else if (c < 0x20) {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+            } else {
+                flush_surrogate(stream);
+                string_bytes(stream, (const char *)&c, 1);
+            }
+            return;
+
+        case STATE_ESCAPE: {
+            char decoded;
+            switch (c) {
+                case '"': decoded = '"'; break;
+                case '\\': decoded = '\\'; break;
+                case '/': decoded = '/'; break;
+                case 'b': decoded = '\b'; break;
+                case 'f': decoded = '\f'; break;
+                case 'n': decoded = '\n'; break;
+                case 'r': decoded = '\r'; break;
+                case 't': decoded = '\t'; break;
+                case 'u':
+                    stream->code_unit = 0;
+                    stream->hex_digits = 0;
+                    stream->state = STATE_UNICODE;
+                    return;
+                default:
+                    stream->status = JSON_STREAM_ERROR_SYNTAX;
+                    return;
+            }
+            flush_surrogate(stream);
+            string_bytes(stream, &decoded, 1);
+            stream->state = STATE_STRING;
+            return;
+        }
+
+        case STATE_UNICODE: {
+            int value = hex_value(c);
+            if (value < 0) {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+                return;
+            }
+            stream->code_unit = (stream->code_unit << 4) | (unsigned int)value;
+            if (++stream->hex_digits == 4) {
+                stream->state = STATE_STRING;
+                string_code_unit(stream, stream->code_unit);
+            }
+            return;
+        }
+
+        case STATE_LITERAL:
+            if (c != (unsigned char)*stream->literal) {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+                return;
+            }
+            if (stream->capture != NULL) {
+                capture_bytes(stream, (const char *)&c, 1);
+            }
+            if (*++stream->literal == '\0') {
+                end_value(stream);
+            }
+            return;
+
+        case STATE_DONE:
+            if (!is_space(c)) {
+                stream->status = JSON_STREAM_ERROR_SYNTAX;
+            }
+            return;
+    }
+}
+
+json_stream_status_t json_stream_feed(json_stream_t *stream, const char *data, size_t len) {
+    if (stream->status != JSON_STREAM_OK) {
+        return stream->status;
+    }
+    if (len > stream->max_size - stream->size) {
+        stream->status = JSON_STREAM_ERROR_SIZE;
+        return stream->status;
+    }
+    stream->size += len;
+
+    size_t i = 0;
+    while (i < len && stream->status == JSON_STREAM_OK) {
+        if (stream->state == STATE_STRING && stream->high_surrogate == 0) {
+            // Copy the plain part of a string in one go
+            size_t run = 0;
+            while (i + run < len) {
+                unsigned char c = (unsigned char)data[i + run];
+                if (c == '"' || c == '\\' || c < 0x20) {
+                    break;
+                }
+                run++;
+            }
+            if (run > 0) {
+                string_bytes(stream, data + i, run);
+                i += run;
+                continue;
+            }
+        }
+        consume(stream, (unsigned char)data[i++]);
+    }
+    return stream->status;
+}
+
+json_stream_status_t json_stream_finish(json_stream_t *stream) {
+    if (stream->status != JSON_STREAM_OK) {
+        return stream->status;
+    }
+    if (stream->state == STATE_NUMBER && number_complete(stream)) {
+        end_value(stream);
+    }
+    if (stream->state != STATE_DONE) {
+        stream->status = JSON_STREAM_ERROR_SYNTAX;
+    }
+    return stream->status;
+}
+
+const char *json_stream_field(const json_stream_t *stream, const char *name, json_type_t *type, size_t *len) {
+    const field_t *field = NULL;
+    for (size_t i = 0; i < stream->field_count; i++) {
+        if (strcmp(stream->fields[i].name, name) == 0) {
+            field = &stream->fields[i];
+            break;
+        }
+    }
+
+    json_type_t field_type = field != NULL ? field->type : JSON_TYPE_NONE;
+    if (type != NULL) {
+        *type = field_type;
+    }
+    if (len != NULL) {
+        *len = field_type != JSON_TYPE_NONE ? field->len : 0;
+    }
+    if (field_type == JSON_TYPE_NONE || field_type == JSON_TYPE_OBJECT || field_type == JSON_TYPE_ARRAY) {
+        return NULL;
+    }
+    return field->value != NULL ? field->value : "";
+}
+
+const char *json_stream_strerror(json_stream_status_t status) {
+    switch (status) {
+        case JSON_STREAM_OK: return "OK";
+        case JSON_STREAM_ERROR_SYNTAX: return "Invalid JSON";
+        case JSON_STREAM_ERROR_DEPTH: return "JSON nested too deeply";
+        case JSON_STREAM_ERROR_SIZE: return "Request body too large";
+        case JSON_STREAM_ERROR_MEMORY: return "Not enough memory for the request";
+    }
+    return "Unknown error";
+}
@@ -0,0 +1,307 @@
+#include "../../include/logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#define RING_MASK (LOG_RING_SLOTS - 1)
+#define WRITER_IDLE_MS 10       // How long the writer sleeps when every ring is empty
+
+// One queued message
+typedef struct {
+    struct timespec time;
+    unsigned char level;
+    unsigned short len;
+    char text[LOG_MESSAGE_MAX];
+} log_record_t;
+
+// Ring of one producer thread. head is only written by the producer and
+// tail only by the writer, each published with release ordering.
+typedef struct log_ring {
+    struct log_ring *next;
+    atomic_size_t head;
+    char pad1[64];                  // Keep the producer and writer indexes on separate cache lines
+    atomic_size_t tail;
+    char pad2[64];
+    atomic_ulong dropped;
+    atomic_int closed;              // The producer thread has exited
+    log_record_t records[LOG_RING_SLOTS];
+} log_ring_t;
+
+static const char level_letters[] = "DIWE";
+static const char *const level_names[] = {"debug", "info", "warn", "error"};
+
+static atomic_int min_level = LOG_LEVEL_INFO;
+static atomic_int running = 0;
+static unsigned int generation = 0;     // Bumped by every logger_start, invalidates old thread rings
+static FILE *log_out = NULL;
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t *rings = NULL;
+static pthread_key_t ring_key;
+static unsigned long retired_drops = 0;  // Drops of rings already freed, protected by rings_lock
+static atomic_ulong lines_written = 0;
+
+static __thread log_ring_t *local_ring = NULL;
+static __thread unsigned int local_generation = 0;
+
+static pthread_t writer_thread;
+static int stop_pipe[2] = {-1, -1};
+
+// Write a message synchronously when the writer thread is not running
+static void write_direct(log_level_t level, const char *format, va_list args) {
+    FILE *out = level >= LOG_LEVEL_WARN ? stderr : stdout;
+    vfprintf(out, format, args);
+    fputc('\n', out);
+}
+
+// Mark the ring of an exiting thread so the writer frees it once drained
+static void close_ring(void *ptr) {
+    log_ring_t *ring = ptr;
+    atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
+
+// Create and register the ring of the calling thread
+static log_ring_t *register_ring(void) {
+    log_ring_t *ring = calloc(1, sizeof(log_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+    local_generation = generation;
+    return ring;
+}
+
+void log_message(log_level_t level, const char *format, ...) {
+    if ((int)level < atomic_load_explicit(&min_level, memory_order_relaxed)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    if (!atomic_load_explicit(&running, memory_order_acquire)) {
+        write_direct(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    log_ring_t *ring = local_ring;
+    if (ring == NULL || local_generation != generation) {
+        ring = register_ring();
+        if (ring == NULL) {
+            va_end(args);
+            return;
+        }
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == LOG_RING_SLOTS) {
+        // The writer is behind: lose the message rather than wait
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    log_record_t *record = &ring->records[head & RING_MASK];
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->level = (unsigned char)level;
+    int len = vsnprintf(record->text, sizeof(record->text), format, args);
+    va_end(args);
+    if (len < 0) {
+        len = 0;
+    } else if ((size_t)len >= sizeof(record->text)) {
+        len = sizeof(record->text) - 1;
+    }
+    while (len > 0 && record->text[len - 1] == '\n') {
+        len--;
+    }
+    record->len = (unsigned short)len;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Timestamp prefix of the current second, reformatted only when it changes
+static time_t prefix_second = -1;
+static char prefix[32];
+
+static void write_record(const log_record_t *record) {
+    if (record->time.tv_sec != prefix_second) {
+        struct tm tm;
+        localtime_r(&record->time.tv_sec, &tm);
+        strftime(prefix, sizeof(prefix), "%Y-%m-%dT%H:%M:%S", &tm);
+        prefix_second = record->time.tv_sec;
+    }
+    fprintf(log_out, "%s.%03ld %c %.*s\n", prefix, record->time.tv_nsec / 1000000,
+            level_letters[record->level], (int)record->len, record->text);
+}
+
+// Write out every published record and free the rings of exited threads,
+// returns the number of records written
+static size_t drain_rings(void) {
+    size_t count = 0;
+    pthread_mutex_lock(&rings_lock);
+
+    log_ring_t **link = &rings;
+    while (*link != NULL) {
+        log_ring_t *ring = *link;
+        int closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            write_record(&ring->records[tail & RING_MASK]);
+            count++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        // Everything the thread logged was published before it exited
+        if (closed) {
+            *link = ring->next;
+            retired_drops += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+
+    pthread_mutex_unlock(&rings_lock);
+    atomic_fetch_add_explicit(&lines_written, count, memory_order_relaxed);
+    return count;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    unsigned long reported_drops = 0;
+    int stopping = 0;
+
+    while (1) {
+        size_t count = drain_rings();
+
+        logger_stats_t stats;
+        logger_get_stats(&stats);
+        if (stats.dropped != reported_drops) {
+            log_record_t note = {.level = LOG_LEVEL_WARN};
+            clock_gettime(CLOCK_REALTIME, &note.time);
+            note.len = (unsigned short)snprintf(note.text, sizeof(note.text), "log: %lu messages dropped",
+                                                stats.dropped - reported_drops);
+            write_record(&note);
+            reported_drops = stats.dropped;
+            count++;
+        }
+
+        if (count > 0) {
+            fflush(log_out);
+            continue;
+        }
+        if (stopping) {
+            break;
+        }
+
+        struct pollfd fd = {.fd = stop_pipe[0], .events = POLLIN};
+        if (poll(&fd, 1, WRITER_IDLE_MS) > 0) {
+            // Drain what is left, then exit
+            stopping = 1;
+        }
+    }
+
+    return NULL;
+}
+
+int logger_start(FILE *out, log_level_t level) {
+    if (atomic_load(&running)) {
+        return 0;
+    }
+    logger_set_level(level);
+    log_out = out;
+
+    if (pthread_key_create(&ring_key, close_ring) != 0) {
+        return -1;
+    }
+    if (pipe2(stop_pipe, O_CLOEXEC) == -1) {
+        pthread_key_delete(ring_key);
+        return -1;
+    }
+
+    generation++;
+    retired_drops = 0;
+    atomic_store(&lines_written, 0);
+    prefix_second = -1;
+
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        stop_pipe[0] = stop_pipe[1] = -1;
+        pthread_key_delete(ring_key);
+        return -1;
+    }
+    atomic_store_explicit(&running, 1, memory_order_release);
+    return 0;
+}
+
+void logger_stop(void) {
+    if (!atomic_load(&running)) {
+        return;
+    }
+    atomic_store_explicit(&running, 0, memory_order_release);
+
+    if (write(stop_pipe[1], "x", 1) == -1) {
+        perror("write");
+    }
+    pthread_join(writer_thread, NULL);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    stop_pipe[0] = stop_pipe[1] = -1;
+
+    // Threads still alive keep a pointer to their ring; the new generation
+    // makes them register a fresh one if the log is started again
+    pthread_mutex_lock(&rings_lock);
+    while (rings != NULL) {
+        log_ring_t *next = rings->next;
+        free(rings);
+        rings = next;
+    }
+    pthread_mutex_unlock(&rings_lock);
+    pthread_setspecific(ring_key, NULL);
+    pthread_key_delete(ring_key);
+}
+
+void logger_set_level(log_level_t level) {
+    atomic_store_explicit(&min_level, (int)level, memory_order_relaxed);
+}
+
+void logger_get_stats(logger_stats_t *stats) {
+    pthread_mutex_lock(&rings_lock);
+    unsigned long dropped = retired_drops;
+    for (log_ring_t *ring = rings; ring != NULL; ring = ring->next) {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    stats->written = atomic_load_explicit(&lines_written, memory_order_relaxed);
+    stats->dropped = dropped;
+}
+
+int log_level_parse(const char *name, log_level_t *level) {
+    for (int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_ERROR; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            *level = (log_level_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,280 @@
+#include "../../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+
+// A registered series
+typedef struct {
+    metric_type_t type;
+    const char *name;
+    const char *labels;
+    const char *help;
+    int histogram;              // Index into the histogram arrays, -1 for other types
+    metrics_read_t read;        // Set for series read when rendering
+    void *ctx;
+} series_t;
+
+// Counts of one thread. Only the owning thread writes them; readers may see
+// a slightly stale value but never a torn one.
+typedef struct shard {
+    struct shard *next;
+    atomic_uint_fast64_t values[METRICS_MAX_SERIES];
+    atomic_uint_fast64_t buckets[METRICS_MAX_HISTOGRAMS][METRICS_HISTOGRAM_BUCKETS + 1];
+    atomic_uint_fast64_t sums[METRICS_MAX_HISTOGRAMS];
+} shard_t;
+
+static series_t series[METRICS_MAX_SERIES];
+static int series_count = 0;
+static int histogram_count = 0;
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static shard_t *shards = NULL;
+static shard_t retired;                 // Counts of exited threads, protected by shards_lock
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+static __thread shard_t *local_shard = NULL;
+
+// Fold the counts of an exiting thread into the retired totals
+static void retire_shard(void *ptr) {
+    shard_t *shard = ptr;
+    pthread_mutex_lock(&shards_lock);
+    for (shard_t **link = &shards; *link != NULL; link = &(*link)->next) {
+        if (*link == shard) {
+            *link = shard->next;
+            break;
+        }
+    }
+    for (int i = 0; i < METRICS_MAX_SERIES; i++) {
+        atomic_fetch_add_explicit(&retired.values[i], atomic_load_explicit(&shard->values[i], memory_order_relaxed),
+                                  memory_order_relaxed);
+    }
+    for (int h = 0; h < METRICS_MAX_HISTOGRAMS; h++) {
+        for (int b = 0; b <= METRICS_HISTOGRAM_BUCKETS; b++) {
+            atomic_fetch_add_explicit(&retired.buckets[h][b],
+                                      atomic_load_explicit(&shard->buckets[h][b], memory_order_relaxed),
+                                      memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&retired.sums[h], atomic_load_explicit(&shard->sums[h], memory_order_relaxed),
+                                  memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shards_lock);
+    free(shard);
+}
+
+static void create_shard_key(void) {
+    pthread_key_create(&shard_key, retire_shard);
+}
+
+// Shard of the calling thread, created on its first observation
+static shard_t *get_shard(void) {
+    if (local_shard != NULL) {
+        return local_shard;
+    }
+    shard_t *shard = calloc(1, sizeof(shard_t));
+    if (shard == NULL) {
+        return NULL;
+    }
+    pthread_once(&shard_key_once, create_shard_key);
+    pthread_setspecific(shard_key, shard);
+
+    pthread_mutex_lock(&shards_lock);
+    shard->next = shards;
+    shards = shard;
+    pthread_mutex_unlock(&shards_lock);
+
+    local_shard = shard;
+    return shard;
+}
+
+// Add to a counter owned by the calling thread: no read-modify-write
+// instruction is needed since no other thread writes it
+static inline void shard_add(atomic_uint_fast64_t *counter, uint64_t delta) {
+    uint64_t value = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, value + delta, memory_order_relaxed);
+}
+
+static int add_series(metric_type_t type, const char *name, const char *labels, const char *help) {
+    if (series_count == METRICS_MAX_SERIES) {
+        return -1;
+    }
+    int histogram = -1;
+    if (type == METRIC_HISTOGRAM) {
+        if (histogram_count == METRICS_MAX_HISTOGRAMS) {
+            return -1;
+        }
+        histogram = histogram_count++;
+    }
+    series[series_count] = (series_t){type, name, labels, help, histogram, NULL, NULL};
+    return series_count++;
+}
+
+int metrics_register(metric_type_t type, const char *name, const char *labels, const char *help) {
+    return add_series(type, name, labels, help);
+}
+
+int metrics_register_read(metric_type_t type, const char *name, const char *labels, const char *help,
+                          metrics_read_t read, void *ctx) {
+    if (type == METRIC_HISTOGRAM) {
+        return -1;
+    }
+    int id = add_series(type, name, labels, help);
+    if (id == -1) {
+        return -1;
+    }
+    series[id].read = read;
+    series[id].ctx = ctx;
+    return 0;
+}
+
+void metrics_add(int id, int64_t delta) {
+    if (id < 0) {
+        return;
+    }
+    shard_t *shard = get_shard();
+    if (shard != NULL) {
+        // Gauges wrap around: the sum over all shards is still exact
+        shard_add(&shard->values[id], (uint64_t)delta);
+    }
+}
+
+void metrics_observe(int id, uint64_t microseconds) {
+    if (id < 0 || series[id].histogram < 0) {
+        return;
+    }
+    shard_t *shard = get_shard();
+    if (shard == NULL) {
+        return;
+    }
+
+    // Smallest bucket whose bound 2^i us holds the value
+    int bucket = microseconds <= 1 ? 0 : 64 - __builtin_clzll(microseconds - 1);
+    if (bucket > METRICS_HISTOGRAM_BUCKETS) {
+        bucket = METRICS_HISTOGRAM_BUCKETS;
+    }
+    int h = series[id].histogram;
+    shard_add(&shard->buckets[h][bucket], 1);
+    shard_add(&shard->sums[h], microseconds);
+}
+
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Growable output text
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} text_t;
+
+static void append(text_t *text, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(text_t *text, const char *format, ...) {
+    if (text->failed) {
+        return;
+    }
+    while (1) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text->data + text->len, text->cap - text->len, format, args);
+        va_end(args);
+        if (n < 0) {
+            text->failed = 1;
+            return;
+        }
+        if ((size_t)n < text->cap - text->len) {
+            text->len += n;
+            return;
+        }
+        size_t cap = text->cap * 2 + n;
+        char *data = realloc(text->data, cap);
+        if (data == NULL) {
+            text->failed = 1;
+            return;
+        }
+        text->data = data;
+        text->cap = cap;
+    }
+}
+
+// Sum of one counter over the retired totals and the live shards
+static uint64_t total(const atomic_uint_fast64_t *retired_counter, size_t offset) {
+    uint64_t sum = atomic_load_explicit(retired_counter, memory_order_relaxed);
+    for (shard_t *shard = shards; shard != NULL; shard = shard->next) {
+        const atomic_uint_fast64_t *counter = (const atomic_uint_fast64_t *)((const char *)shard + offset);
+        sum += atomic_load_explicit(counter, memory_order_relaxed);
+    }
+    return sum;
+}
+
+#define TOTAL(field) total(&retired.field, offsetof(shard_t, field))
+
+static void render_histogram(text_t *text, const series_t *s) {
+    int h = s->histogram;
+    const char *labels = s->labels != NULL ? s->labels : "";
+    const char *sep = s->labels != NULL ? "," : "";
+
+    uint64_t cumulative = 0;
+    for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+        cumulative += TOTAL(buckets[h][b]);
+        append(text, "%s_bucket{%s%sle=\"%g\"} %llu\n", s->name, labels, sep,
+               (double)(1ULL << b) / 1e6, (unsigned long long)cumulative);
+    }
+    cumulative += TOTAL(buckets[h][METRICS_HISTOGRAM_BUCKETS]);
+    append(text, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", s->name, labels, sep, (unsigned long long)cumulative);
+
+    const char *open = s->labels != NULL ? "{" : "";
+    const char *close = s->labels != NULL ? "}" : "";
+    append(text, "%s_sum%s%s%s %.6f\n", s->name, open, labels, close, TOTAL(sums[h]) / 1e6);
+    append(text, "%s_count%s%s%s %llu\n", s->name, open, labels, close, (unsigned long long)cumulative);
+}
+
+char *metrics_render(size_t *len) {
+    text_t text = {malloc(4096), 0, 4096, 0};
+    if (text.data == NULL) {
+        return NULL;
+    }
+    text.data[0] = '\0';
+
+    static const char *const type_names[] = {"counter", "gauge", "histogram"};
+
+    pthread_mutex_lock(&shards_lock);
+    for (int i = 0; i < series_count; i++) {
+        const series_t *s = &series[i];
+        if (i == 0 || strcmp(series[i - 1].name, s->name) != 0) {
+            append(&text, "# HELP %s %s\n# TYPE %s %s\n", s->name, s->help, s->name, type_names[s->type]);
+        }
+
+        if (s->type == METRIC_HISTOGRAM) {
+            render_histogram(&text, s);
+            continue;
+        }
+
+        const char *open = s->labels != NULL ? "{" : "";
+        const char *labels = s->labels != NULL ? s->labels : "";
+        const char *close = s->labels != NULL ? "}" : "";
+        if (s->read != NULL) {
+            append(&text, "%s%s%s%s %.17g\n", s->name, open, labels, close, s->read(s->ctx));
+        } else if (s->type == METRIC_GAUGE) {
+            append(&text, "%s%s%s%s %lld\n", s->name, open, labels, close, (long long)(int64_t)TOTAL(values[i]));
+        } else {
+            append(&text, "%s%s%s%s %llu\n", s->name, open, labels, close, (unsigned long long)TOTAL(values[i]));
+        }
+    }
+    pthread_mutex_unlock(&shards_lock);
+
+    if (text.failed) {
+        free(text.data);
+        return NULL;
+    }
+    *len = text.len;
+    return text.data;
+}
@@ -0,0 +1,722 @@
+#include "../../include/project_index.h"
+#include "../../include/source_index.h"
+#include "../../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+// How often replaced snapshots still held by a reader are checked again
+#define RECLAIM_INTERVAL_MS 1000
+// Blocks of the arenas holding parsed files and snapshots
+#define INDEX_ARENA_BLOCK_SIZE (8 * 1024)
+#define INDEX_ARENA_FREE_BLOCKS 64
+
+// A file or directory of the project. Only the index thread touches the tree.
+typedef struct node {
+    char *path;                 // Relative to the root, "" for the root itself
+    const char *name;           // Last component of path
+    int is_dir;
+    int depth;                  // 0 for the root; directories deeper than the limit are not read
+    int wd;                     // inotify watch of a directory, -1 if none
+    source_file_t *source;      // Parsed contents of a source file, NULL otherwise
+    struct node **children;     // Sorted by name
+    size_t child_count;
+    size_t child_capacity;
+} node_t;
+
+typedef struct {
+    int wd;
+    node_t *dir;
+} watch_t;
+
+// A published snapshot, allocated from its own arena
+typedef struct snapshot {
+    project_snapshot_t info;
+    struct snapshot *next_retired;
+    arena_t *arena;
+    source_file_t **sources;    // A reference to every indexed file
+    size_t source_count;
+    source_index_t *search;     // NULL if the index could not be built
+} snapshot_t;
+
+// A reader thread's announcement of the snapshot it is using. Each slot
+// sits on its own cache line so readers do not slow each other down.
+typedef struct {
+    _Atomic(snapshot_t *) hazard;
+    atomic_int used;
+} __attribute__((aligned(64))) reader_slot_t;
+
+static char root_dir[PATH_MAX];
+static arena_pool_t *index_arenas = NULL;
+static node_t *root = NULL;
+static watch_t *watches = NULL;
+static size_t watch_count = 0;
+static size_t watch_capacity = 0;
+static int inotify_fd = -1;
+static int stop_pipe[2] = {-1, -1};
+static pthread_t index_thread;
+static int index_running = 0;
+
+static _Atomic(snapshot_t *) current = NULL;
+static atomic_uint_fast64_t current_epoch = 0;
+static snapshot_t *retired = NULL;     // Replaced snapshots, owned by the index thread
+static uint64_t next_epoch = 1;
+
+static reader_slot_t reader_slots[PROJECT_INDEX_MAX_READERS];
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+static __thread reader_slot_t *local_slot = NULL;
+
+// Growable output text
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} text_t;
+
+static void append(text_t *text, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(text_t *text, const char *format, ...) {
+    if (text->failed) {
+        return;
+    }
+    while (1) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text->data + text->len, text->cap - text->len, format, args);
+        va_end(args);
+        if (n < 0) {
+            text->failed = 1;
+            return;
+        }
+        if ((size_t)n < text->cap - text->len) {
+            text->len += n;
+            return;
+        }
+        size_t cap = text->cap * 2 + n;
+        char *data = realloc(text->data, cap);
+        if (data == NULL) {
+            text->failed = 1;
+            return;
+        }
+        text->data = data;
+        text->cap = cap;
+    }
+}
+
+// Path of an entry on disk
+static void disk_path(char *out, size_t size, const char *rel_path) {
+    if (rel_path[0] == '\0') {
+        snprintf(out, size, "%s", root_dir);
+    } else {
+        snprintf(out, size, "%s/%s", root_dir, rel_path);
+    }
+}
+
+static node_t *node_create(const node_t *parent, const char *name, int is_dir) {
+    node_t *node = calloc(1, sizeof(node_t));
+    if (node == NULL) {
+        return NULL;
+    }
+    if (parent == NULL) {
+        node->path = strdup("");
+    } else if (parent->path[0] == '\0') {
+        node->path = strdup(name);
+    } else {
+        size_t len = strlen(parent->path) + strlen(name) + 2;
+        node->path = malloc(len);
+        if (node->path != NULL) {
+            snprintf(node->path, len, "%s/%s", parent->path, name);
+        }
+    }
+    if (node->path == NULL) {
+        free(node);
+        return NULL;
+    }
+    const char *slash = strrchr(node->path, '/');
+    node->name = slash != NULL ? slash + 1 : node->path;
+    node->is_dir = is_dir;
+    node->depth = parent != NULL ? parent->depth + 1 : 0;
+    node->wd = -1;
+    return node;
+}
+
+static void remove_watch(node_t *dir) {
+    if (dir->wd == -1) {
+        return;
+    }
+    // Fails harmlessly if the directory is already gone
+    inotify_rm_watch(inotify_fd, dir->wd);
+    for (size_t i = 0; i < watch_count; i++) {
+        if (watches[i].wd == dir->wd) {
+            watches[i] = watches[--watch_count];
+            break;
+        }
+    }
+    dir->wd = -1;
+}
+
+static void node_free(node_t *node) {
+    for (size_t i = 0; i < node->child_count; i++) {
+        node_free(node->children[i]);
+    }
+    remove_watch(node);
+    source_file_unref(node->source);
+    free(node->children);
+    free(node->path);
+    free(node);
+}
+
+// Index of the child with this name, or where it would be inserted
+static size_t child_position(const node_t *dir, const char *name, int *found) {
+    size_t low = 0, high = dir->child_count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        int cmp = strcmp(dir->children[mid]->name, name);
+        if (cmp == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *found = 0;
+    return low;
+}
+
+static void remove_child(node_t *dir, const char *name) {
+    int found;
+    size_t i = child_position(dir, name, &found);
+    if (!found) {
+        return;
+    }
+    node_free(dir->children[i]);
+    memmove(&dir->children[i], &dir->children[i + 1], (dir->child_count - i - 1) * sizeof(node_t *));
+    dir->child_count--;
+}
+
+// Insert a child, replacing one of the same name
+static int insert_child(node_t *dir, node_t *child) {
+    int found;
+    size_t i = child_position(dir, child->name, &found);
+    if (found) {
+        node_free(dir->children[i]);
+        dir->children[i] = child;
+        return 0;
+    }
+    if (dir->child_count == dir->child_capacity) {
+        size_t capacity = dir->child_capacity ? dir->child_capacity * 2 : 8;
+        node_t **children = realloc(dir->children, capacity * sizeof(node_t *));
+        if (children == NULL) {
+            return -1;
+        }
+        dir->children = children;
+        dir->child_capacity = capacity;
+    }
+    memmove(&dir->children[i + 1], &dir->children[i], (dir->child_count - i) * sizeof(node_t *));
+    dir->children[i] = child;
+    dir->child_count++;
+    return 0;
+}
+
+static void add_watch(node_t *dir) {
+    if (inotify_fd == -1) {
+        return;
+    }
+    char path[PATH_MAX * 2];
+    disk_path(path, sizeof(path), dir->path);
+
+    int wd = inotify_add_watch(inotify_fd, path, WATCH_MASK);
+    if (wd == -1) {
+        log_message(LOG_LEVEL_WARN, "Project index cannot watch %s: %s", path, strerror(errno));
+        return;
+    }
+
+    // The same directory reached twice (through a symlink) keeps its first node
+    for (size_t i = 0; i < watch_count; i++) {
+        if (watches[i].wd == wd) {
+            return;
+        }
+    }
+
+    if (watch_count == watch_capacity) {
+        size_t capacity = watch_capacity ? watch_capacity * 2 : 64;
+        watch_t *new_watches = realloc(watches, capacity * sizeof(watch_t));
+        if (new_watches == NULL) {
+            return;
+        }
+        watches = new_watches;
+        watch_capacity = capacity;
+    }
+    watches[watch_count].wd = wd;
+    watches[watch_count].dir = dir;
+    watch_count++;
+    dir->wd = wd;
+}
+
+static node_t *find_watch_dir(int wd) {
+    for (size_t i = 0; i < watch_count; i++) {
+        if (watches[i].wd == wd) {
+            return watches[i].dir;
+        }
+    }
+    return NULL;
+}
+
+static void scan_dir(node_t *dir);
+
+// Add (or replace) the entry `name` of a directory from what is on disk
+static void load_child(node_t *dir, const char *name) {
+    char rel[PATH_MAX];
+    if (snprintf(rel, sizeof(rel), "%s%s%s", dir->path, dir->path[0] ? "/" : "", name) >= (int)sizeof(rel)) {
+        return;
+    }
+
+    char path[PATH_MAX * 2];
+    disk_path(path, sizeof(path), rel);
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        remove_child(dir, name);
+        return;
+    }
+
+    node_t *child = node_create(dir, name, S_ISDIR(st.st_mode));
+    if (child == NULL) {
+        return;
+    }
+    if (insert_child(dir, child) != 0) {
+        node_free(child);
+        return;
+    }
+    if (child->is_dir && child->depth <= PROJECT_INDEX_MAX_DEPTH) {
+        scan_dir(child);
+    } else if (!child->is_dir && source_file_is_indexed(name)) {
+        child->source = source_file_load(index_arenas, path, rel);
+    }
+}
+
+// Parse a source file again after it was written; returns 1 if it is indexed
+static int reload_source(node_t *dir, const char *name) {
+    int found;
+    size_t i = child_position(dir, name, &found);
+    if (!found || dir->children[i]->is_dir || !source_file_is_indexed(name)) {
+        return 0;
+    }
+    node_t *file = dir->children[i];
+    char path[PATH_MAX * 2];
+    disk_path(path, sizeof(path), file->path);
+    source_file_unref(file->source);
+    file->source = source_file_load(index_arenas, path, file->path);
+    return 1;
+}
+
+// Watch a directory and read its entries, recursively
+static void scan_dir(node_t *dir) {
+    // Watch before reading so entries created during the scan are not missed
+    add_watch(dir);
+
+    char path[PATH_MAX * 2];
+    disk_path(path, sizeof(path), dir->path);
+    DIR *d = opendir(path);
+    if (d == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        // Skip hidden files and special directories
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        load_child(dir, entry->d_name);
+    }
+    closedir(d);
+}
+
+static void build_tree(void) {
+    if (root != NULL) {
+        node_free(root);
+    }
+    root = node_create(NULL, "", 1);
+    if (root != NULL) {
+        scan_dir(root);
+    }
+}
+
+// Render the directory tree and take a reference to every parsed file
+static void render_dir(text_t *text, const node_t *dir, snapshot_t *snapshot, size_t *capacity) {
+    for (size_t i = 0; i < dir->child_count; i++) {
+        const node_t *child = dir->children[i];
+        append(text, "%*s- %s%s\n", dir->depth * 2, "", child->name, child->is_dir ? "/" : "");
+        if (child->is_dir) {
+            snapshot->info.dirs++;
+            render_dir(text, child, snapshot, capacity);
+            continue;
+        }
+        snapshot->info.files++;
+        if (child->source == NULL) {
+            continue;
+        }
+        if (snapshot->source_count == *capacity) {
+            size_t new_capacity = *capacity ? *capacity * 2 : 64;
+            source_file_t **sources = realloc(snapshot->sources, new_capacity * sizeof(source_file_t *));
+            if (sources == NULL) {
+                text->failed = 1;
+                return;
+            }
+            snapshot->sources = sources;
+            *capacity = new_capacity;
+        }
+        source_file_ref(child->source);
+        snapshot->sources[snapshot->source_count++] = child->source;
+    }
+}
+
+static void free_snapshot(snapshot_t *snapshot) {
+    if (snapshot == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < snapshot->source_count; i++) {
+        source_file_unref(snapshot->sources[i]);
+    }
+    free(snapshot->sources);
+    arena_release(snapshot->arena);
+}
+
+static int reader_holds(const snapshot_t *snapshot) {
+    for (int i = 0; i < PROJECT_INDEX_MAX_READERS; i++) {
+        if (atomic_load(&reader_slots[i].hazard) == snapshot) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Free the replaced snapshots that no reader holds any more
+static void reclaim_snapshots(void) {
+    snapshot_t **link = &retired;
+    while (*link != NULL) {
+        snapshot_t *snapshot = *link;
+        if (reader_holds(snapshot)) {
+            link = &snapshot->next_retired;
+        } else {
+            *link = snapshot->next_retired;
+            free_snapshot(snapshot);
+        }
+    }
+}
+
+// FNV-1a hash of the overview, its version in prompts
+static uint64_t hash_text(const char *text, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Render the tree and index the parsed files into a new snapshot, then
+// make it current
+static void publish_snapshot(void) {
+    arena_t *arena = arena_acquire(index_arenas, SIZE_MAX);
+    snapshot_t *snapshot = arena != NULL ? arena_calloc(arena, sizeof(snapshot_t)) : NULL;
+    text_t text = {malloc(65536), 0, 65536, 0};
+    if (snapshot == NULL || text.data == NULL) {
+        free(text.data);
+        arena_release(arena);
+        log_message(LOG_LEVEL_ERROR, "Project index: out of memory, keeping the previous snapshot");
+        return;
+    }
+    snapshot->arena = arena;
+
+    size_t capacity = 0;
+    append(&text, "Project Structure Overview:\n\n");
+    if (root != NULL) {
+        render_dir(&text, root, snapshot, &capacity);
+    }
+    char *overview = text.failed ? NULL : arena_alloc(arena, text.len + 1);
+    if (overview != NULL) {
+        memcpy(overview, text.data, text.len + 1);
+        snapshot->search = source_index_build(arena, snapshot->sources, snapshot->source_count);
+    }
+    free(text.data);
+    if (snapshot->search == NULL) {
+        free_snapshot(snapshot);
+        log_message(LOG_LEVEL_ERROR, "Project index: out of memory, keeping the previous snapshot");
+        return;
+    }
+    snapshot->info.epoch = next_epoch++;
+    snapshot->info.snippets = source_index_snippets(snapshot->search);
+    snapshot->info.version = hash_text(overview, text.len);
+    snapshot->info.size = text.len;
+    snapshot->info.text = overview;
+
+    snapshot_t *old = atomic_exchange(&current, snapshot);
+    atomic_store(&current_epoch, snapshot->info.epoch);
+    if (old != NULL) {
+        old->next_retired = retired;
+        retired = old;
+    }
+    reclaim_snapshots();
+
+    log_message(snapshot->info.epoch == 1 ? LOG_LEVEL_INFO : LOG_LEVEL_DEBUG,
+                "Project index: %zu files, %zu directories, %zu snippets from %zu sources (epoch %llu)",
+                snapshot->info.files, snapshot->info.dirs, snapshot->info.snippets, snapshot->source_count,
+                (unsigned long long)snapshot->info.epoch);
+}
+
+// Apply one inotify event to the tree; returns 1 if the overview may have changed
+static int handle_event(const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost - read everything again
+        build_tree();
+        return 1;
+    }
+    if (event->len == 0 || event->name[0] == '.') {
+        return 0;
+    }
+
+    node_t *dir = find_watch_dir(event->wd);
+    if (dir == NULL) {
+        return 0;
+    }
+
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        load_child(dir, event->name);
+        return 1;
+    }
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        remove_child(dir, event->name);
+        return 1;
+    }
+    // A rewritten file only matters if it is indexed
+    return reload_source(dir, event->name);
+}
+
+static void release_slot(void *ptr) {
+    reader_slot_t *slot = ptr;
+    atomic_store(&slot->hazard, NULL);
+    atomic_store_explicit(&slot->used, 0, memory_order_release);
+}
+
+static void create_slot_key(void) {
+    pthread_key_create(&slot_key, release_slot);
+}
+
+// Index thread: build the first snapshot, then follow the changes until asked to stop
+static void *index_main(void *arg) {
+    (void)arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int dirty = 0;
+
+    build_tree();
+    publish_snapshot();
+
+    while (1) {
+        struct pollfd fds[2] = {
+            {.fd = stop_pipe[0], .events = POLLIN},
+            {.fd = inotify_fd, .events = POLLIN},
+        };
+        int timeout = dirty ? PROJECT_INDEX_SETTLE_MS : retired != NULL ? RECLAIM_INTERVAL_MS : -1;
+
+        int ready = poll(fds, inotify_fd != -1 ? 2 : 1, timeout);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_message(LOG_LEVEL_ERROR, "Project index: poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            break;
+        }
+
+        if (ready == 0) {
+            // Quiet for a while: publish the changes as one snapshot
+            if (dirty) {
+                publish_snapshot();
+                dirty = 0;
+            } else {
+                reclaim_snapshots();
+            }
+            continue;
+        }
+
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            continue;
+        }
+        for (char *ptr = buf; ptr < buf + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            dirty |= handle_event(event);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+int project_index_start(const char *dir) {
+    snprintf(root_dir, sizeof(root_dir), "%s", dir);
+    pthread_once(&slot_key_once, create_slot_key);
+
+    index_arenas = arena_pool_create(INDEX_ARENA_BLOCK_SIZE, INDEX_ARENA_FREE_BLOCKS);
+    if (index_arenas == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Project index: cannot create the arena pool");
+        return -1;
+    }
+
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        log_message(LOG_LEVEL_WARN, "Project index: inotify unavailable (%s), the index will not be updated",
+                    strerror(errno));
+    }
+
+    if (pipe2(stop_pipe, O_CLOEXEC) == -1) {
+        log_message(LOG_LEVEL_ERROR, "Project index: pipe2 failed: %s", strerror(errno));
+        project_index_stop();
+        return -1;
+    }
+
+    if (pthread_create(&index_thread, NULL, index_main, NULL) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to start the project index thread");
+        project_index_stop();
+        return -1;
+    }
+    index_running = 1;
+    return 0;
+}
+
+void project_index_stop(void) {
+    if (index_running) {
+        if (write(stop_pipe[1], "x", 1) == -1) {
+            log_message(LOG_LEVEL_ERROR, "Project index: write failed: %s", strerror(errno));
+        }
+        pthread_join(index_thread, NULL);
+        index_running = 0;
+    }
+
+    if (stop_pipe[0] != -1) {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        stop_pipe[0] = stop_pipe[1] = -1;
+    }
+
+    if (root != NULL) {
+        node_free(root);
+        root = NULL;
+    }
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    free(watches);
+    watches = NULL;
+    watch_count = watch_capacity = 0;
+
+    // No reader is left, so every snapshot can go
+    snapshot_t *snapshot = atomic_exchange(&current, NULL);
+    atomic_store(&current_epoch, 0);
+    free_snapshot(snapshot);
+    while (retired != NULL) {
+        snapshot = retired;
+        retired = snapshot->next_retired;
+        free_snapshot(snapshot);
+    }
+    arena_pool_free(index_arenas);
+    index_arenas = NULL;
+}
+
+// Slot of the calling thread, claimed on its first read
+static reader_slot_t *get_slot(void) {
+    if (local_slot != NULL) {
+        return local_slot;
+    }
+    for (int i = 0; i < PROJECT_INDEX_MAX_READERS; i++) {
+        int unused = 0;
+        if (atomic_compare_exchange_strong(&reader_slots[i].used, &unused, 1)) {
+            pthread_setspecific(slot_key, &reader_slots[i]);
+            local_slot = &reader_slots[i];
+            return local_slot;
+        }
+    }
+    return NULL;
+}
+
+const project_snapshot_t *project_index_acquire(void) {
+    reader_slot_t *slot = get_slot();
+    if (slot == NULL) {
+        log_message(LOG_LEVEL_WARN, "Project index: more than %d reader threads", PROJECT_INDEX_MAX_READERS);
+        return NULL;
+    }
+
+    // Announce the snapshot, then check it is still current: if it is, the
+    // index thread will see the announcement before it could free it
+    snapshot_t *snapshot = atomic_load(&current);
+    while (1) {
+        atomic_store(&slot->hazard, snapshot);
+        snapshot_t *again = atomic_load(&current);
+        if (again == snapshot) {
+            break;
+        }
+        snapshot = again;
+    }
+
+    if (snapshot == NULL) {
+        atomic_store(&slot->hazard, NULL);
+        return NULL;
+    }
+    return &snapshot->info;
+}
+
+void project_index_release(const project_snapshot_t *snapshot) {
+    if (snapshot == NULL || local_slot == NULL) {
+        return;
+    }
+    atomic_store_explicit(&local_slot->hazard, NULL, memory_order_release);
+}
+
+uint64_t project_index_epoch(void) {
+    return atomic_load_explicit(&current_epoch, memory_order_relaxed);
+}
+
+void project_index_context(const project_snapshot_t *info, const char *question, size_t token_budget,
+                           project_context_t *context) {
+    const snapshot_t *snapshot = (const snapshot_t *)((const char *)info - offsetof(snapshot_t, info));
+
+    // As much of the tree as fits in half the budget, ending at a line
+    size_t size = info->size;
+    size_t limit = token_budget / 2 * SOURCE_BYTES_PER_TOKEN;
+    if (size > limit) {
+        size = limit;
+        while (size > 0 && info->text[size - 1] != '\n') {
+            size--;
+        }
+    }
+    context->overview = info->text;
+    context->overview_len = size;
+
+    size_t used = (size + SOURCE_BYTES_PER_TOKEN - 1) / SOURCE_BYTES_PER_TOKEN;
+    context->snippets = source_index_select(snapshot->search, question, token_budget - used,
+                                            &context->snippets_len);
+    if (context->snippets == NULL) {
+        context->snippets_len = 0;
+    }
+}
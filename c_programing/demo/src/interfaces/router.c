@@ -0,0 +1,273 @@
+#include "../../include/router.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Method names indexed by http_method_t
+static const char *const method_names[HTTP_METHOD_COUNT] = {
+    [HTTP_METHOD_GET] = "GET",
+    [HTTP_METHOD_HEAD] = "HEAD",
+    [HTTP_METHOD_POST] = "POST",
+    [HTTP_METHOD_PUT] = "PUT",
+    [HTTP_METHOD_DELETE] = "DELETE",
+    [HTTP_METHOD_OPTIONS] = "OPTIONS",
+};
+
+typedef struct {
+    int id;
+    const void *ctx;
+} route_target_t;
+
+// One byte of a route pattern. Parameter and wildcard nodes stand for a
+// whole segment (or the rest of the path) and carry the parameter name.
+typedef struct route_node {
+    char byte;
+    char *name;                     // Parameter name of ':' and '*' nodes
+    struct route_node *child;       // First literal child
+    struct route_node *sibling;     // Next literal child of the same parent
+    struct route_node *param;       // ":name" child
+    struct route_node *wildcard;    // "*name" child
+    unsigned methods;               // Methods of the route ending here
+    route_target_t *targets;        // Indexed by http_method_t, NULL if no route ends here
+} route_node_t;
+
+struct router {
+    route_node_t root;
+};
+
+static route_node_t *new_node(char byte) {
+    route_node_t *node = calloc(1, sizeof(route_node_t));
+    if (node != NULL) {
+        node->byte = byte;
+    }
+    return node;
+}
+
+static void free_children(route_node_t *node) {
+    route_node_t *child = node->child;
+    while (child != NULL) {
+        route_node_t *next = child->sibling;
+        free_children(child);
+        free(child);
+        child = next;
+    }
+    if (node->param != NULL) {
+        free_children(node->param);
+        free(node->param);
+    }
+    if (node->wildcard != NULL) {
+        free_children(node->wildcard);
+        free(node->wildcard);
+    }
+    free(node->name);
+    free(node->targets);
+}
+
+static route_node_t *find_child(const route_node_t *node, char byte) {
+    for (route_node_t *child = node->child; child != NULL; child = child->sibling) {
+        if (child->byte == byte) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+static int parse_method(const char *method) {
+    for (int i = 0; i < HTTP_METHOD_COUNT; i++) {
+        if (strcmp(method, method_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Get or create the ':' or '*' child of a node
+static route_node_t *segment_child(route_node_t **slot, const char *name, size_t len) {
+    if (*slot == NULL) {
+        route_node_t *node = new_node(0);
+        if (node == NULL) {
+            return NULL;
+        }
+        node->name = strndup(name, len);
+        if (node->name == NULL) {
+            free(node);
+            return NULL;
+        }
+        *slot = node;
+        return node;
+    }
+
+    // Two routes may not name the same parameter differently
+    if (strlen((*slot)->name) != len || strncmp((*slot)->name, name, len) != 0) {
+        return NULL;
+    }
+    return *slot;
+}
+
+router_t *router_create(void) {
+    return calloc(1, sizeof(router_t));
+}
+
+void router_free(router_t *router) {
+    if (router == NULL) {
+        return;
+    }
+    free_children(&router->root);
+    free(router);
+}
+
+int router_add(router_t *router, unsigned methods, const char *pattern, int id, const void *ctx) {
+    if (pattern == NULL || pattern[0] != '/' || methods == 0) {
+        return -1;
+    }
+
+    route_node_t *node = &router->root;
+    const char *p = pattern;
+
+    while (*p != '\0') {
+        // Parameters and wildcards are only recognised at the start of a segment
+        if (p > pattern && p[-1] == '/' && (*p == ':' || *p == '*')) {
+            const char *name = p + 1;
+            size_t len = *p == ':' ? strcspn(name, "/") : strlen(name);
+            if (len == 0) {
+                fprintf(stderr, "Route %s: unnamed parameter\n", pattern);
+                return -1;
+            }
+
+            node = segment_child(*p == ':' ? &node->param : &node->wildcard, name, len);
+            if (node == NULL) {
+                fprintf(stderr, "Route %s: conflicting parameter name\n", pattern);
+                return -1;
+            }
+            p = name + len;
+            continue;
+        }
+
+        route_node_t *child = find_child(node, *p);
+        if (child == NULL) {
+            child = new_node(*p);
+            if (child == NULL) {
+                return -1;
+            }
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+        p++;
+    }
+
+    if (node->targets == NULL) {
+        node->targets = calloc(HTTP_METHOD_COUNT, sizeof(route_target_t));
+        if (node->targets == NULL) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < HTTP_METHOD_COUNT; i++) {
+        if (methods & (1u << i)) {
+            node->targets[i].id = id;
+            node->targets[i].ctx = ctx;
+        }
+    }
+    node->methods |= methods;
+    return 0;
+}
+
+static void push_param(route_match_t *match, const char *name, const char *value, size_t len) {
+    if (match->param_count < ROUTER_MAX_PARAMS) {
+        route_param_t *param = &match->params[match->param_count++];
+        param->name = name;
+        param->value = value;
+        param->len = len;
+    }
+}
+
+// Walk the trie, preferring literal bytes over parameters over wildcards
+static const route_node_t *match_node(const route_node_t *node, const char *path, route_match_t *match) {
+    size_t param_count = match->param_count;
+
+    if (*path == '\0') {
+        if (node->methods != 0) {
+            return node;
+        }
+    } else {
+        const route_node_t *child = find_child(node, *path);
+        if (child != NULL) {
+            const route_node_t *found = match_node(child, path + 1, match);
+            if (found != NULL) {
+                return found;
+            }
+            match->param_count = param_count;
+        }
+
+        if (node->param != NULL && *path != '/') {
+            size_t len = strcspn(path, "/");
+            push_param(match, node->param->name, path, len);
+            const route_node_t *found = match_node(node->param, path + len, match);
+            if (found != NULL) {
+                return found;
+            }
+            match->param_count = param_count;
+        }
+    }
+
+    if (node->wildcard != NULL) {
+        push_param(match, node->wildcard->name, path, strlen(path));
+        return node->wildcard;
+    }
+    return NULL;
+}
+
+route_status_t router_match(const router_t *router, const char *method, const char *path,
+                            route_match_t *match) {
+    match->param_count = 0;
+    match->allowed = 0;
+
+    const route_node_t *node = match_node(&router->root, path, match);
+    if (node == NULL) {
+        match->param_count = 0;
+        return ROUTE_NOT_FOUND;
+    }
+
+    match->allowed = node->methods;
+    int index = parse_method(method);
+    if (index < 0 || !(node->methods & (1u << index))) {
+        match->param_count = 0;
+        return ROUTE_METHOD_NOT_ALLOWED;
+    }
+
+    match->id = node->targets[index].id;
+    match->ctx = node->targets[index].ctx;
+    return ROUTE_FOUND;
+}
+
+const char *route_param(const route_match_t *match, const char *name, size_t *len) {
+    for (size_t i = 0; i < match->param_count; i++) {
+        if (strcmp(match->params[i].name, name) == 0) {
+            if (len != NULL) {
+                *len = match->params[i].len;
+            }
+            return match->params[i].value;
+        }
+    }
+    return NULL;
+}
+
+void router_format_allow(unsigned methods, char *buf, size_t size) {
+    size_t pos = 0;
+
+    if (size == 0) {
+        return;
+    }
+    buf[0] = '\0';
+
+    for (int i = 0; i < HTTP_METHOD_COUNT; i++) {
+        if (!(methods & (1u << i))) {
+            continue;
+        }
+        int written = snprintf(buf + pos, size - pos, "%s%s", pos > 0 ? ", " : "", method_names[i]);
+        if (written < 0 || (size_t)written >= size - pos) {
+            return;
+        }
+        pos += written;
+    }
+}
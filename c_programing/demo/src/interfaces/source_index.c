@@ -0,0 +1,579 @@
+#include "../../include/source_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Longest term kept, longer identifiers are cut
+#define MAX_TERM 48
+// Times the words of a file's path count in each of its snippets
+#define PATH_TERM_WEIGHT 3
+// A snippet is also cut at a blank line once it has this many lines
+#define SNIPPET_SOFT_LINES 12
+// BM25 parameters
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+// A term and how often it occurs in a snippet
+typedef struct {
+    const char *term;
+    uint32_t count;
+} term_count_t;
+
+typedef struct {
+    const source_file_t *file;
+    int first_line;
+    int last_line;
+    const char *text;
+    size_t len;
+    const term_count_t *terms;  // Sorted, each term once
+    size_t term_count;
+    uint32_t length;            // Terms in the snippet, repeats included
+} snippet_t;
+
+struct source_file {
+    int refs;
+    arena_t *arena;             // Holds the file and everything below
+    const char *path;
+    const char *data;
+    size_t size;
+    snippet_t *snippets;
+    size_t snippet_count;
+};
+
+// The snippets containing a term
+typedef struct {
+    uint32_t snippet;
+    uint32_t count;
+} posting_t;
+
+typedef struct {
+    const char *term;           // NULL for an empty slot
+    uint32_t hash;
+    uint32_t df;                // Snippets containing the term
+    uint32_t filled;
+    posting_t *postings;
+} term_entry_t;
+
+struct source_index {
+    const snippet_t **snippets; // In file order, then line order
+    size_t snippet_count;
+    double average_length;
+    term_entry_t *table;        // Open addressing, size is a power of two
+    size_t table_size;
+    size_t term_count;
+};
+
+// Words too common to say anything about relevance: C keywords and the
+// filler of a question. Sorted for bsearch.
+static const char *const stopwords[] = {
+    "about", "an", "and", "are", "break", "can", "case", "char", "const", "continue", "default", "define",
+    "do", "does", "else", "endif", "enum", "explain", "for", "from", "how", "if", "ifdef", "ifndef", "in",
+    "include", "int", "is", "it", "long", "me", "my", "null", "of", "on", "or", "return", "short",
+    "signed", "sizeof", "static", "struct", "switch", "that", "the", "this", "to", "typedef", "unsigned",
+    "void", "what", "when", "where", "which", "while", "why", "with", "you",
+};
+
+#define STOPWORD_COUNT (sizeof(stopwords) / sizeof(stopwords[0]))
+
+// Terms found in some text, repeats included
+typedef struct {
+    char (*terms)[MAX_TERM];
+    size_t count;
+    size_t capacity;
+    int failed;
+} term_list_t;
+
+static int compare_stopword(const void *key, const void *element) {
+    return strcmp(key, *(const char *const *)element);
+}
+
+static void add_term(term_list_t *list, const char *word, size_t len) {
+    if (len < 2 || list->failed) {
+        return;
+    }
+    if (len >= MAX_TERM) {
+        len = MAX_TERM - 1;
+    }
+    char term[MAX_TERM];
+    for (size_t i = 0; i < len; i++) {
+        term[i] = (char)tolower((unsigned char)word[i]);
+    }
+    term[len] = '\0';
+    if (bsearch(term, stopwords, STOPWORD_COUNT, sizeof(stopwords[0]), compare_stopword) != NULL) {
+        return;
+    }
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        char (*terms)[MAX_TERM] = realloc(list->terms, capacity * MAX_TERM);
+        if (terms == NULL) {
+            list->failed = 1;
+            return;
+        }
+        list->terms = terms;
+        list->capacity = capacity;
+    }
+    memcpy(list->terms[list->count++], term, len + 1);
+}
+
+// Add every identifier of the text, then its snake_case and camelCase parts
+static void collect_terms(term_list_t *list, const char *text, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c = text[i];
+        if (!isalpha(c) && c != '_') {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while (i < len && (isalnum((unsigned char)text[i]) || text[i] == '_')) {
+            i++;
+        }
+        add_term(list, text + start, i - start);
+
+        // Parts of at least three letters, e.g. "sys" and "open" of sys_open
+        size_t part = start;
+        for (size_t j = start; j <= i; j++) {
+            int boundary = j == i || text[j] == '_' ||
+                           (j > start && isupper((unsigned char)text[j]) && islower((unsigned char)text[j - 1]));
+            if (!boundary) {
+                continue;
+            }
+            int whole = part == start && j == i;
+            if (!whole && j - part >= 3) {
+                add_term(list, text + part, j - part);
+            }
+            part = j < i && text[j] == '_' ? j + 1 : j;
+        }
+    }
+}
+
+static int compare_terms(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+int source_file_is_indexed(const char *name) {
+    const char *dot = strrchr(name, '.');
+    if (dot != NULL && (strcmp(dot, ".c") == 0 || strcmp(dot, ".h") == 0)) {
+        return 1;
+    }
+    return strcmp(name, "Makefile") == 0;
+}
+
+// Index the terms of one snippet; path_terms are added to every snippet
+static int add_snippet(source_file_t *file, snippet_t *snippet, term_list_t *list, const term_list_t *path_terms) {
+    list->count = 0;
+    collect_terms(list, snippet->text, snippet->len);
+    for (int w = 0; w < PATH_TERM_WEIGHT; w++) {
+        for (size_t i = 0; i < path_terms->count; i++) {
+            add_term(list, path_terms->terms[i], strlen(path_terms->terms[i]));
+        }
+    }
+    if (list->failed) {
+        return -1;
+    }
+
+    qsort(list->terms, list->count, MAX_TERM, compare_terms);
+    size_t unique = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (i == 0 || strcmp(list->terms[i], list->terms[i - 1]) != 0) {
+            unique++;
+        }
+    }
+
+    term_count_t *terms = arena_alloc(file->arena, (unique ? unique : 1) * sizeof(term_count_t));
+    if (terms == NULL) {
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (i > 0 && strcmp(list->terms[i], list->terms[i - 1]) == 0) {
+            terms[n - 1].count++;
+            continue;
+        }
+        size_t term_len = strlen(list->terms[i]);
+        char *term = arena_alloc(file->arena, term_len + 1);
+        if (term == NULL) {
+            return -1;
+        }
+        memcpy(term, list->terms[i], term_len + 1);
+        terms[n].term = term;
+        terms[n].count = 1;
+        n++;
+    }
+    snippet->terms = terms;
+    snippet->term_count = n;
+    snippet->length = (uint32_t)list->count;
+    return 0;
+}
+
+static int is_blank(const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!isspace((unsigned char)text[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Move past the snippet starting at *pos: it ends after a line that closes
+// a top-level block, after a blank line once it is long enough, or at the
+// line limit. *line follows the line number.
+static void skip_snippet(const source_file_t *file, size_t *pos, int *line) {
+    int lines = 0;
+    while (*pos < file->size) {
+        const char *start = file->data + *pos;
+        const char *newline = memchr(start, '\n', file->size - *pos);
+        size_t line_len = newline ? (size_t)(newline - start) + 1 : file->size - *pos;
+        int closes_block = start[0] == '}';
+        int blank = is_blank(start, line_len);
+        *pos += line_len;
+        (*line)++;
+        lines++;
+        if (closes_block || lines >= SOURCE_SNIPPET_MAX_LINES || (blank && lines >= SNIPPET_SOFT_LINES)) {
+            return;
+        }
+    }
+}
+
+// Cut the file into snippets and index each of them
+static int parse_snippets(source_file_t *file) {
+    size_t count = 0, pos = 0;
+    int line = 1;
+    while (pos < file->size) {
+        size_t start = pos;
+        skip_snippet(file, &pos, &line);
+        count += !is_blank(file->data + start, pos - start);
+    }
+    file->snippets = arena_alloc(file->arena, (count ? count : 1) * sizeof(snippet_t));
+    if (file->snippets == NULL) {
+        return -1;
+    }
+
+    term_list_t list = {NULL, 0, 0, 0};
+    term_list_t path_terms = {NULL, 0, 0, 0};
+    collect_terms(&path_terms, file->path, strlen(file->path));
+    int result = path_terms.failed ? -1 : 0;
+
+    pos = 0;
+    line = 1;
+    while (pos < file->size && result == 0) {
+        size_t start = pos;
+        int first_line = line;
+        skip_snippet(file, &pos, &line);
+        if (is_blank(file->data + start, pos - start)) {
+            continue;
+        }
+        snippet_t *snippet = &file->snippets[file->snippet_count];
+        *snippet = (snippet_t){file, first_line, line - 1, file->data + start, pos - start, NULL, 0, 0};
+        result = add_snippet(file, snippet, &list, &path_terms);
+        if (result == 0) {
+            file->snippet_count++;
+        }
+    }
+
+    free(list.terms);
+    free(path_terms.terms);
+    return result;
+}
+
+source_file_t *source_file_load(arena_pool_t *pool, const char *disk_path, const char *path) {
+    int fd = open(disk_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size > SOURCE_MAX_FILE_BYTES) {
+        close(fd);
+        return NULL;
+    }
+
+    arena_t *arena = arena_acquire(pool, SIZE_MAX);
+    source_file_t *file = arena != NULL ? arena_calloc(arena, sizeof(source_file_t)) : NULL;
+    char *data = file != NULL ? arena_alloc(arena, (size_t)st.st_size + 1) : NULL;
+    char *path_copy = data != NULL ? arena_alloc(arena, strlen(path) + 1) : NULL;
+    if (path_copy == NULL) {
+        close(fd);
+        arena_release(arena);
+        return NULL;
+    }
+
+    size_t total = 0;
+    while (total < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + total, st.st_size - total);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    close(fd);
+    data[total] = '\0';
+    strcpy(path_copy, path);
+
+    file->refs = 1;
+    file->arena = arena;
+    file->path = path_copy;
+    file->data = data;
+    file->size = total;
+
+    // Binary files are not indexed
+    if (memchr(data, '\0', total) != NULL || parse_snippets(file) != 0) {
+        arena_release(arena);
+        return NULL;
+    }
+    return file;
+}
+
+void source_file_ref(source_file_t *file) {
+    file->refs++;
+}
+
+void source_file_unref(source_file_t *file) {
+    if (file != NULL && --file->refs == 0) {
+        arena_release(file->arena);
+    }
+}
+
+// FNV-1a hash of a term
+static uint32_t hash_term(const char *term) {
+    uint32_t hash = 2166136261u;
+    while (*term) {
+        hash ^= (unsigned char)*term++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static term_entry_t *find_entry(term_entry_t *table, size_t size, const char *term, uint32_t hash) {
+    size_t i = hash & (size - 1);
+    while (table[i].term != NULL && (table[i].hash != hash || strcmp(table[i].term, term) != 0)) {
+        i = (i + 1) & (size - 1);
+    }
+    return &table[i];
+}
+
+// Double the table; the old one stays in the arena until the index is freed
+static int grow_table(arena_t *arena, source_index_t *index) {
+    size_t size = index->table_size * 2;
+    term_entry_t *table = arena_calloc(arena, size * sizeof(term_entry_t));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < index->table_size; i++) {
+        if (index->table[i].term != NULL) {
+            *find_entry(table, size, index->table[i].term, index->table[i].hash) = index->table[i];
+        }
+    }
+    index->table = table;
+    index->table_size = size;
+    return 0;
+}
+
+source_index_t *source_index_build(arena_t *arena, source_file_t *const *files, size_t count) {
+    source_index_t *index = arena_calloc(arena, sizeof(source_index_t));
+    if (index == NULL) {
+        return NULL;
+    }
+
+    size_t snippet_count = 0;
+    for (size_t f = 0; f < count; f++) {
+        snippet_count += files[f]->snippet_count;
+    }
+    index->snippets = arena_alloc(arena, (snippet_count ? snippet_count : 1) * sizeof(snippet_t *));
+    index->table_size = 1024;
+    index->table = arena_calloc(arena, index->table_size * sizeof(term_entry_t));
+    if (index->snippets == NULL || index->table == NULL) {
+        return NULL;
+    }
+
+    // Count the snippets of every term
+    uint64_t total_length = 0;
+    for (size_t f = 0; f < count; f++) {
+        for (size_t s = 0; s < files[f]->snippet_count; s++) {
+            const snippet_t *snippet = &files[f]->snippets[s];
+            index->snippets[index->snippet_count++] = snippet;
+            total_length += snippet->length;
+
+            for (size_t t = 0; t < snippet->term_count; t++) {
+                const char *term = snippet->terms[t].term;
+                uint32_t hash = hash_term(term);
+                term_entry_t *entry = find_entry(index->table, index->table_size, term, hash);
+                if (entry->term == NULL) {
+                    if ((index->term_count + 1) * 2 > index->table_size) {
+                        if (grow_table(arena, index) != 0) {
+                            return NULL;
+                        }
+                        entry = find_entry(index->table, index->table_size, term, hash);
+                    }
+                    entry->term = term;
+                    entry->hash = hash;
+                    index->term_count++;
+                }
+                entry->df++;
+            }
+        }
+    }
+    index->average_length = index->snippet_count ? (double)total_length / index->snippet_count : 1;
+
+    // Then fill in the postings
+    for (size_t i = 0; i < index->table_size; i++) {
+        term_entry_t *entry = &index->table[i];
+        if (entry->term != NULL) {
+            entry->postings = arena_alloc(arena, entry->df * sizeof(posting_t));
+            if (entry->postings == NULL) {
+                return NULL;
+            }
+        }
+    }
+    for (size_t id = 0; id < index->snippet_count; id++) {
+        const snippet_t *snippet = index->snippets[id];
+        for (size_t t = 0; t < snippet->term_count; t++) {
+            const term_count_t *term = &snippet->terms[t];
+            term_entry_t *entry = find_entry(index->table, index->table_size, term->term, hash_term(term->term));
+            entry->postings[entry->filled++] = (posting_t){(uint32_t)id, term->count};
+        }
+    }
+    return index;
+}
+
+size_t source_index_snippets(const source_index_t *index) {
+    return index->snippet_count;
+}
+
+typedef struct {
+    double score;
+    uint32_t snippet;
+} candidate_t;
+
+static int compare_candidates(const void *a, const void *b) {
+    const candidate_t *x = a, *y = b;
+    if (x->score != y->score) {
+        return x->score < y->score ? 1 : -1;
+    }
+    return (x->snippet > y->snippet) - (x->snippet < y->snippet);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static const char snippet_header[] = "File: %s (lines %d-%d)\n```\n";
+static const char snippet_footer[] = "```\n\n";
+
+// Add the BM25 score of every snippet for the distinct terms of a question
+static void score_snippets(const source_index_t *index, const term_list_t *query, double *scores) {
+    double n = (double)index->snippet_count;
+    for (size_t q = 0; q < query->count; q++) {
+        if (q > 0 && strcmp(query->terms[q], query->terms[q - 1]) == 0) {
+            continue;
+        }
+        const term_entry_t *entry = find_entry(index->table, index->table_size, query->terms[q],
+                                               hash_term(query->terms[q]));
+        if (entry->term == NULL) {
+            continue;
+        }
+        double idf = log(1.0 + (n - entry->df + 0.5) / (entry->df + 0.5));
+        for (uint32_t p = 0; p < entry->df; p++) {
+            const posting_t *posting = &entry->postings[p];
+            double length = index->snippets[posting->snippet]->length / index->average_length;
+            double tf = posting->count;
+            scores[posting->snippet] += idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * (1 - BM25_B + BM25_B * length));
+        }
+    }
+}
+
+// Bytes a snippet takes in the result, at most
+static size_t snippet_cost(const snippet_t *snippet) {
+    return snippet->len + strlen(snippet->file->path) + sizeof(snippet_header) + sizeof(snippet_footer) + 16;
+}
+
+static char *render_snippets(const source_index_t *index, const uint32_t *chosen, size_t count, size_t capacity,
+                             size_t *len) {
+    char *result = malloc(capacity);
+    if (result == NULL) {
+        return NULL;
+    }
+    size_t pos = 0;
+    for (size_t c = 0; c < count; c++) {
+        const snippet_t *snippet = index->snippets[chosen[c]];
+        pos += snprintf(result + pos, capacity - pos, snippet_header, snippet->file->path,
+                        snippet->first_line, snippet->last_line);
+        memcpy(result + pos, snippet->text, snippet->len);
+        pos += snippet->len;
+        if (snippet->text[snippet->len - 1] != '\n') {
+            result[pos++] = '\n';
+        }
+        pos += snprintf(result + pos, capacity - pos, snippet_footer);
+    }
+    *len = pos;
+    return result;
+}
+
+// Take the best scoring snippets that fit the budget
+static char *select_best(const source_index_t *index, const double *scores, size_t token_budget, size_t *len) {
+    candidate_t *candidates = malloc(index->snippet_count * sizeof(candidate_t));
+    uint32_t *chosen = malloc(index->snippet_count * sizeof(uint32_t));
+    char *result = NULL;
+
+    if (candidates != NULL && chosen != NULL) {
+        size_t candidate_count = 0;
+        for (size_t id = 0; id < index->snippet_count; id++) {
+            if (scores[id] > 0) {
+                candidates[candidate_count++] = (candidate_t){scores[id], (uint32_t)id};
+            }
+        }
+        qsort(candidates, candidate_count, sizeof(candidate_t), compare_candidates);
+
+        // Best first, skipping snippets that no longer fit
+        size_t budget = token_budget * SOURCE_BYTES_PER_TOKEN;
+        size_t used = 0, chosen_count = 0;
+        for (size_t c = 0; c < candidate_count; c++) {
+            size_t cost = snippet_cost(index->snippets[candidates[c].snippet]);
+            if (used + cost <= budget) {
+                used += cost;
+                chosen[chosen_count++] = candidates[c].snippet;
+            }
+        }
+
+        // Show them in file order, so neighbouring snippets read in sequence
+        if (chosen_count > 0) {
+            qsort(chosen, chosen_count, sizeof(uint32_t), compare_ids);
+            result = render_snippets(index, chosen, chosen_count, used + 1, len);
+        }
+    }
+
+    free(candidates);
+    free(chosen);
+    return result;
+}
+
+char *source_index_select(const source_index_t *index, const char *question, size_t token_budget, size_t *len) {
+    term_list_t query = {NULL, 0, 0, 0};
+    collect_terms(&query, question, strlen(question));
+    if (query.failed || query.count == 0 || index->snippet_count == 0) {
+        free(query.terms);
+        return NULL;
+    }
+    qsort(query.terms, query.count, MAX_TERM, compare_terms);
+
+    char *result = NULL;
+    double *scores = calloc(index->snippet_count, sizeof(double));
+    if (scores != NULL) {
+        score_snippets(index, &query, scores);
+        result = select_best(index, scores, token_budget, len);
+    }
+    free(scores);
+    free(query.terms);
+    return result;
+}
@@ -0,0 +1,670 @@
+#include "../../include/static_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define CACHE_BUCKETS 1024
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+// Cache entry - the file contents (if any) are stored inline after the header.
+// Hits only take the read lock: they count their reference and stamp the
+// entry atomically, and the writer evicts the entry with the oldest stamp.
+typedef struct cache_entry {
+    static_asset_t asset;
+    struct cache_entry *hash_next;
+    unsigned int hash;
+    atomic_int refcount;        // References held by callers, plus one while in the table
+    atomic_uint_fast64_t last_used;     // Coarse milliseconds of the latest hit
+    int in_table;       // Entry is reachable through the hash table, protected by cache_lock
+    unsigned int generation;    // Full scan during which the entry was loaded
+    char *path;         // Stored right after the file contents
+    char data[];
+} cache_entry_t;
+
+// Directory watched through inotify
+typedef struct {
+    int wd;
+    char *rel_dir;      // Directory relative to root_dir ("" for the root)
+} watch_t;
+
+static char root_dir[PATH_MAX];
+static size_t max_cache_bytes = DEFAULT_STATIC_CACHE_BYTES;
+static size_t cached_bytes = 0;
+static size_t sendfile_min_size = DEFAULT_SENDFILE_THRESHOLD;
+static size_t cached_fds = 0;
+
+static cache_entry_t *buckets[CACHE_BUCKETS];
+static size_t entry_count = 0;
+// Read-locked by lookups, write-locked by the watcher and by misses. Writers
+// are preferred so a steady stream of hits cannot hold off a reload.
+static pthread_rwlock_t cache_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+static unsigned int scan_generation = 0;    // Bumped before each full rescan
+
+static int inotify_fd = -1;
+static int stop_pipe[2] = {-1, -1};
+static pthread_t watcher_thread;
+static int watcher_running = 0;
+static static_cache_listener_t change_listener = NULL;
+static void *change_listener_ctx = NULL;
+static watch_t *watches = NULL;
+static size_t watch_count = 0;
+static size_t watch_capacity = 0;
+
+// FNV-1a hash of the URL path
+static unsigned int hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Build the URL path of a file inside a watched directory, -1 if it is too long
+static int make_url_path(char *out, size_t size, const char *rel_dir, const char *name) {
+    int n = rel_dir[0] == '\0' ? snprintf(out, size, "/%s", name)
+                               : snprintf(out, size, "/%s/%s", rel_dir, name);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+// 64-bit FNV-1a, continued from a previous value
+static uint64_t hash_bytes(uint64_t hash, const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+#define HASH_BYTES_INIT 14695981039346656037ull
+
+static void format_etag(uint64_t hash, char *etag) {
+    snprintf(etag, ETAG_SIZE, "\"%016llx\"", (unsigned long long)hash);
+}
+
+void static_cache_etag(const void *data, size_t size, char *etag) {
+    format_etag(hash_bytes(HASH_BYTES_INIT, data, size), etag);
+}
+
+// Hash a descriptor-backed file once when it is opened
+static void etag_from_fd(int fd, size_t size, char *etag) {
+    unsigned char buf[65536];
+    uint64_t hash = HASH_BYTES_INIT;
+    off_t offset = 0;
+
+    while ((size_t)offset < size) {
+        ssize_t n = pread(fd, buf, sizeof(buf), offset);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        hash = hash_bytes(hash, buf, n);
+        offset += n;
+    }
+
+    format_etag(hash, etag);
+}
+
+static cache_entry_t *entry_from_asset(const static_asset_t *asset) {
+    return (cache_entry_t *)((char *)asset - offsetof(cache_entry_t, asset));
+}
+
+static void free_entry(cache_entry_t *entry) {
+    if (entry->asset.fd != -1) {
+        close(entry->asset.fd);
+    }
+    free(entry);
+}
+
+// Milliseconds from a clock read without a system call; precise enough to
+// tell recently used entries from idle ones
+static uint64_t coarse_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Record a hit; the stamp is only written when it changes, so hits on a hot
+// entry mostly leave its cache line shared
+static void touch_entry(cache_entry_t *entry) {
+    uint64_t now = coarse_now_ms();
+    if (atomic_load_explicit(&entry->last_used, memory_order_relaxed) != now) {
+        atomic_store_explicit(&entry->last_used, now, memory_order_relaxed);
+    }
+}
+
+// Drop one reference; the last one frees the entry
+static void put_entry(cache_entry_t *entry) {
+    if (atomic_fetch_sub_explicit(&entry->refcount, 1, memory_order_acq_rel) == 1) {
+        free_entry(entry);
+    }
+}
+
+// Bytes of memory an entry counts against the cache cap
+static size_t entry_bytes(const cache_entry_t *entry) {
+    return entry->asset.data != NULL ? entry->asset.size : 0;
+}
+
+// Remove an entry from the table; it is freed once the last reference is dropped
+static void detach_entry(cache_entry_t *entry) {
+    cache_entry_t **link = &buckets[entry->hash % CACHE_BUCKETS];
+    while (*link != NULL && *link != entry) {
+        link = &(*link)->hash_next;
+    }
+    if (*link == entry) {
+        *link = entry->hash_next;
+    }
+    entry->in_table = 0;
+    entry_count--;
+    cached_bytes -= entry_bytes(entry);
+    if (entry->asset.fd != -1) {
+        cached_fds--;
+    }
+
+    // Drop the table's reference
+    put_entry(entry);
+}
+
+// The entry hit least recently; a full walk, but only on the writer side
+// and the table holds a few hundred files at most
+static cache_entry_t *oldest_entry(void) {
+    cache_entry_t *oldest = NULL;
+    uint64_t oldest_used = UINT64_MAX;
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        for (cache_entry_t *entry = buckets[i]; entry != NULL; entry = entry->hash_next) {
+            uint64_t used = atomic_load_explicit(&entry->last_used, memory_order_relaxed);
+            if (used < oldest_used) {
+                oldest = entry;
+                oldest_used = used;
+            }
+        }
+    }
+    return oldest;
+}
+
+static cache_entry_t *find_entry(const char *url_path, unsigned int hash) {
+    cache_entry_t *entry = buckets[hash % CACHE_BUCKETS];
+    while (entry != NULL) {
+        if (entry->hash == hash && strcmp(entry->path, url_path) == 0) {
+            return entry;
+        }
+        entry = entry->hash_next;
+    }
+    return NULL;
+}
+
+// Insert an entry, replacing any older version and evicting the least
+// recently hit entries to stay under the cap. Called with cache_lock written.
+static void insert_entry(cache_entry_t *entry) {
+    cache_entry_t *old = find_entry(entry->path, entry->hash);
+    if (old != NULL) {
+        detach_entry(old);
+    }
+
+    // Files larger than the whole cache are served once and never cached
+    size_t bytes = entry_bytes(entry);
+    if (bytes > max_cache_bytes) {
+        return;
+    }
+
+    int fds = entry->asset.fd != -1 ? 1 : 0;
+    while ((cached_bytes + bytes > max_cache_bytes || cached_fds + fds > MAX_CACHED_FDS) &&
+           entry_count > 0) {
+        detach_entry(oldest_entry());
+    }
+
+    unsigned int bucket = entry->hash % CACHE_BUCKETS;
+    entry->hash_next = buckets[bucket];
+    buckets[bucket] = entry;
+    atomic_fetch_add_explicit(&entry->refcount, 1, memory_order_relaxed);
+    atomic_store_explicit(&entry->last_used, coarse_now_ms(), memory_order_relaxed);
+    entry->in_table = 1;
+    entry_count++;
+    entry->generation = scan_generation;
+    cached_bytes += bytes;
+    cached_fds += fds;
+}
+
+// Read a file from disk into a new, unlinked entry
+static cache_entry_t *load_entry(const char *url_path) {
+    char file_path[PATH_MAX * 2];
+    snprintf(file_path, sizeof(file_path), "%s%s", root_dir, url_path + 1);
+
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Large files keep their descriptor open and are never copied into memory
+    int keep_fd = sendfile_min_size > 0 && (size_t)st.st_size >= sendfile_min_size;
+    size_t data_size = keep_fd ? 0 : (size_t)st.st_size + 1;
+
+    size_t path_len = strlen(url_path);
+    cache_entry_t *entry = malloc(sizeof(cache_entry_t) + data_size + path_len + 1);
+    if (entry == NULL) {
+        close(fd);
+        return NULL;
+    }
+    memset(entry, 0, sizeof(cache_entry_t));
+    atomic_init(&entry->refcount, 0);
+    atomic_init(&entry->last_used, 0);
+
+    entry->path = entry->data + data_size;
+    memcpy(entry->path, url_path, path_len + 1);
+    entry->hash = hash_path(entry->path);
+    entry->asset.url_path = entry->path;
+    entry->asset.mtime = st.st_mtime;
+
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(entry->asset.last_modified, HTTP_DATE_SIZE, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    if (keep_fd) {
+        entry->asset.data = NULL;
+        entry->asset.fd = fd;
+        entry->asset.size = st.st_size;
+        etag_from_fd(fd, st.st_size, entry->asset.etag);
+        return entry;
+    }
+
+    size_t total = 0;
+    while (total < (size_t)st.st_size) {
+        ssize_t n = read(fd, entry->data + total, st.st_size - total);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    close(fd);
+    entry->data[total] = '\0';
+
+    entry->asset.data = entry->data;
+    entry->asset.fd = -1;
+    entry->asset.size = total;
+    static_cache_etag(entry->data, total, entry->asset.etag);
+    return entry;
+}
+
+// Load (or reload) a file and publish it in the cache
+static void refresh_file(const char *url_path) {
+    cache_entry_t *entry = load_entry(url_path);
+
+    pthread_rwlock_wrlock(&cache_lock);
+    if (entry != NULL) {
+        insert_entry(entry);
+        if (!entry->in_table) {
+            free_entry(entry);
+        }
+    } else {
+        // The file is gone or unreadable
+        cache_entry_t *old = find_entry(url_path, hash_path(url_path));
+        if (old != NULL) {
+            detach_entry(old);
+        }
+    }
+    pthread_rwlock_unlock(&cache_lock);
+}
+
+// Drop every cached file below a directory that was moved away
+static void remove_prefix(const char *prefix) {
+    size_t len = strlen(prefix);
+
+    pthread_rwlock_wrlock(&cache_lock);
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        cache_entry_t *entry = buckets[i];
+        while (entry != NULL) {
+            cache_entry_t *next = entry->hash_next;
+            if (strncmp(entry->path, prefix, len) == 0) {
+                detach_entry(entry);
+            }
+            entry = next;
+        }
+    }
+    pthread_rwlock_unlock(&cache_lock);
+}
+
+// Drop every cached file that was not loaded since the rescan began: it
+// was deleted while inotify events were being lost
+static void remove_stale(unsigned int generation) {
+    pthread_rwlock_wrlock(&cache_lock);
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        cache_entry_t *entry = buckets[i];
+        while (entry != NULL) {
+            cache_entry_t *next = entry->hash_next;
+            if (entry->generation != generation) {
+                detach_entry(entry);
+            }
+            entry = next;
+        }
+    }
+    pthread_rwlock_unlock(&cache_lock);
+}
+
+static void add_watch(const char *rel_dir) {
+    if (inotify_fd == -1) {
+        return;
+    }
+
+    char dir_path[PATH_MAX * 2];
+    snprintf(dir_path, sizeof(dir_path), "%s%s", root_dir, rel_dir);
+
+    int wd = inotify_add_watch(inotify_fd, dir_path, WATCH_MASK);
+    if (wd == -1) {
+        perror("inotify_add_watch");
+        return;
+    }
+
+    // inotify returns the same descriptor when a directory is watched twice
+    for (size_t i = 0; i < watch_count; i++) {
+        if (watches[i].wd == wd) {
+            return;
+        }
+    }
+
+    if (watch_count == watch_capacity) {
+        size_t new_capacity = watch_capacity ? watch_capacity * 2 : 16;
+        watch_t *new_watches = realloc(watches, new_capacity * sizeof(watch_t));
+        if (new_watches == NULL) {
+            return;
+        }
+        watches = new_watches;
+        watch_capacity = new_capacity;
+    }
+
+    watches[watch_count].wd = wd;
+    watches[watch_count].rel_dir = strdup(rel_dir);
+    watch_count++;
+}
+
+static const char *find_watch_dir(int wd) {
+    for (size_t i = 0; i < watch_count; i++) {
+        if (watches[i].wd == wd) {
+            return watches[i].rel_dir;
+        }
+    }
+    return NULL;
+}
+
+// Recursively watch and load a directory ("" for the root)
+static void scan_tree(const char *rel_dir) {
+    char dir_path[PATH_MAX * 2];
+    snprintf(dir_path, sizeof(dir_path), "%s%s", root_dir, rel_dir);
+
+    // Watch before reading so files created during the scan are not missed
+    add_watch(rel_dir);
+
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Skip hidden files, editor swap files and special directories
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        char url_path[PATH_MAX];
+        if (make_url_path(url_path, sizeof(url_path), rel_dir, entry->d_name) == -1) {
+            continue;
+        }
+
+        char full_path[PATH_MAX * 2];
+        snprintf(full_path, sizeof(full_path), "%s%s", root_dir, url_path + 1);
+
+        struct stat st;
+        if (stat(full_path, &st) == -1) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            scan_tree(url_path + 1);
+        } else if (S_ISREG(st.st_mode)) {
+            refresh_file(url_path);
+        }
+    }
+
+    closedir(dir);
+}
+
+static void notify_change(const char *url_path) {
+    if (change_listener != NULL) {
+        change_listener(url_path, change_listener_ctx);
+    }
+}
+
+// Apply one inotify event to the cache
+static void handle_event(const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost - reload everything and forget what is gone
+        pthread_rwlock_wrlock(&cache_lock);
+        unsigned int generation = ++scan_generation;
+        pthread_rwlock_unlock(&cache_lock);
+        scan_tree("");
+        remove_stale(generation);
+        notify_change("/");
+        return;
+    }
+
+    if (event->len == 0 || event->name[0] == '.') {
+        return;
+    }
+
+    const char *rel_dir = find_watch_dir(event->wd);
+    if (rel_dir == NULL) {
+        return;
+    }
+
+    char url_path[PATH_MAX];
+    if (make_url_path(url_path, sizeof(url_path), rel_dir, event->name) == -1) {
+        return;
+    }
+
+    if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            scan_tree(url_path + 1);
+        } else if (event->mask & IN_MOVED_FROM) {
+            char prefix[PATH_MAX + 1];
+            snprintf(prefix, sizeof(prefix), "%s/", url_path);
+            remove_prefix(prefix);
+        }
+        notify_change(url_path);
+        return;
+    }
+
+    // New files are picked up when they are closed after writing
+    if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)) {
+        refresh_file(url_path);
+        notify_change(url_path);
+    }
+}
+
+// Watcher thread - waits for inotify events until asked to stop
+static void *watcher_main(void *arg) {
+    (void)arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        struct pollfd fds[2] = {
+            {.fd = inotify_fd, .events = POLLIN},
+            {.fd = stop_pipe[0], .events = POLLIN},
+        };
+
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            continue;
+        }
+
+        for (char *ptr = buf; ptr < buf + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            handle_event(event);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+void static_cache_set_listener(static_cache_listener_t listener, void *ctx) {
+    change_listener = listener;
+    change_listener_ctx = ctx;
+}
+
+int static_cache_init(const char *dir, size_t max_bytes, size_t sendfile_threshold) {
+    snprintf(root_dir, sizeof(root_dir), "%s", dir);
+    max_cache_bytes = max_bytes;
+    sendfile_min_size = sendfile_threshold;
+
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("inotify_init1");
+        // Still serve from the cache, just without live updates
+    }
+
+    scan_tree("");
+    printf("Static cache: %zu bytes loaded, %zu large files opened from %s (limit %zu bytes)\n",
+           cached_bytes, cached_fds, root_dir, max_cache_bytes);
+
+    if (inotify_fd == -1) {
+        return 0;
+    }
+
+    if (pipe2(stop_pipe, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return -1;
+    }
+
+    if (pthread_create(&watcher_thread, NULL, watcher_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start static cache watcher thread\n");
+        return -1;
+    }
+    watcher_running = 1;
+
+    return 0;
+}
+
+void static_cache_shutdown(void) {
+    if (watcher_running) {
+        if (write(stop_pipe[1], "x", 1) == -1) {
+            perror("write");
+        }
+        pthread_join(watcher_thread, NULL);
+        watcher_running = 0;
+    }
+
+    if (stop_pipe[0] != -1) {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        stop_pipe[0] = stop_pipe[1] = -1;
+    }
+
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+
+    for (size_t i = 0; i < watch_count; i++) {
+        free(watches[i].rel_dir);
+    }
+    free(watches);
+    watches = NULL;
+    watch_count = watch_capacity = 0;
+
+    pthread_rwlock_wrlock(&cache_lock);
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        while (buckets[i] != NULL) {
+            detach_entry(buckets[i]);
+        }
+    }
+    pthread_rwlock_unlock(&cache_lock);
+}
+
+const static_asset_t *static_cache_acquire_cached(const char *url_path) {
+    unsigned int hash = hash_path(url_path);
+
+    // The read lock keeps the entry in the table while its reference is taken
+    pthread_rwlock_rdlock(&cache_lock);
+    cache_entry_t *entry = find_entry(url_path, hash);
+    if (entry != NULL) {
+        atomic_fetch_add_explicit(&entry->refcount, 1, memory_order_relaxed);
+        touch_entry(entry);
+    }
+    pthread_rwlock_unlock(&cache_lock);
+
+    return entry != NULL ? &entry->asset : NULL;
+}
+
+const static_asset_t *static_cache_acquire(const char *url_path) {
+    const static_asset_t *asset = static_cache_acquire_cached(url_path);
+    if (asset != NULL) {
+        return asset;
+    }
+
+    // Miss - the file was evicted or is larger than the cache
+    cache_entry_t *entry;
+    if (url_path[0] != '/' || strstr(url_path, "..") != NULL) {
+        return NULL;
+    }
+
+    entry = load_entry(url_path);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    atomic_store_explicit(&entry->refcount, 1, memory_order_relaxed);
+    pthread_rwlock_wrlock(&cache_lock);
+    insert_entry(entry);
+    pthread_rwlock_unlock(&cache_lock);
+
+    return &entry->asset;
+}
+
+void static_cache_release(const static_asset_t *asset) {
+    if (asset == NULL) {
+        return;
+    }
+
+    put_entry(entry_from_asset(asset));
+}
+
+void static_cache_release_buffer(void *data) {
+    cache_entry_t *entry = (cache_entry_t *)((char *)data - offsetof(cache_entry_t, data));
+    static_cache_release(&entry->asset);
+}
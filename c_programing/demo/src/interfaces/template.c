@@ -0,0 +1,314 @@
+#include "../../include/template.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Maximum nesting of partials, guards against templates including themselves
+#define MAX_PARTIAL_DEPTH 8
+
+typedef enum {
+    SEG_LITERAL,
+    SEG_VAR,
+    SEG_SECTION,    // Repeats segments up to 'end' for every item
+    SEG_PARTIAL
+} segment_type_t;
+
+typedef struct {
+    segment_type_t type;
+    const char *text;   // Literal text, or the NUL-terminated tag name
+    size_t len;         // Length of literal text
+    size_t end;         // SEG_SECTION: index just past the section body
+} segment_t;
+
+typedef struct {
+    char *name;
+    char *source;       // Owned copy of the source, tag names are terminated in place
+    segment_t *segments;
+    size_t count;
+} template_t;
+
+struct template_set {
+    template_t **templates;
+    size_t count;
+    size_t capacity;
+};
+
+// A piece of output: template text or a value returned by a callback
+typedef struct {
+    const char *text;
+    size_t len;
+} piece_t;
+
+// Output of a render, collected as pieces and copied out once at the end
+typedef struct {
+    piece_t *pieces;
+    size_t count;
+    size_t capacity;
+    size_t size;        // Total length of the pieces
+    int failed;         // Out of memory, or the output would overflow size_t
+} writer_t;
+
+static void template_free(template_t *tpl) {
+    if (tpl == NULL) {
+        return;
+    }
+    free(tpl->name);
+    free(tpl->source);
+    free(tpl->segments);
+    free(tpl);
+}
+
+static int add_segment(template_t *tpl, size_t *capacity, segment_type_t type,
+                       const char *text, size_t len) {
+    if (tpl->count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 32;
+        segment_t *segments = realloc(tpl->segments, new_capacity * sizeof(segment_t));
+        if (segments == NULL) {
+            return -1;
+        }
+        tpl->segments = segments;
+        *capacity = new_capacity;
+    }
+
+    segment_t *seg = &tpl->segments[tpl->count++];
+    seg->type = type;
+    seg->text = text;
+    seg->len = len;
+    seg->end = 0;
+    return 0;
+}
+
+// Trim spaces around a tag name and terminate it in place
+static char *trim_tag(char *start, char *end) {
+    while (start < end && *start == ' ') start++;
+    while (end > start && end[-1] == ' ') end--;
+    *end = '\0';
+    return start;
+}
+
+static template_t *compile(const char *name, const char *text, size_t len) {
+    template_t *tpl = calloc(1, sizeof(template_t));
+    if (tpl == NULL) {
+        return NULL;
+    }
+
+    tpl->name = strdup(name);
+    tpl->source = malloc(len + 1);
+    if (tpl->name == NULL || tpl->source == NULL) {
+        template_free(tpl);
+        return NULL;
+    }
+    memcpy(tpl->source, text, len);
+    tpl->source[len] = '\0';
+
+    size_t capacity = 0;
+    size_t open_sections[16];
+    size_t depth = 0;
+    char *pos = tpl->source;
+    char *end = tpl->source + len;
+
+    while (pos < end) {
+        char *tag = strstr(pos, "{{");
+        if (tag == NULL) {
+            tag = end;
+        }
+
+        if (tag > pos && add_segment(tpl, &capacity, SEG_LITERAL, pos, tag - pos) == -1) {
+            goto fail;
+        }
+        if (tag == end) {
+            break;
+        }
+
+        char *close = strstr(tag + 2, "}}");
+        if (close == NULL) {
+            fprintf(stderr, "Template %s: unterminated tag\n", name);
+            goto fail;
+        }
+        pos = close + 2;
+
+        char kind = tag[2];
+        if (kind == '#') {
+            if (depth == sizeof(open_sections) / sizeof(open_sections[0])) {
+                fprintf(stderr, "Template %s: sections nested too deeply\n", name);
+                goto fail;
+            }
+            open_sections[depth++] = tpl->count;
+            if (add_segment(tpl, &capacity, SEG_SECTION, trim_tag(tag + 3, close), 0) == -1) {
+                goto fail;
+            }
+        } else if (kind == '/') {
+            const char *tag_name = trim_tag(tag + 3, close);
+            if (depth == 0 || strcmp(tpl->segments[open_sections[depth - 1]].text, tag_name) != 0) {
+                fprintf(stderr, "Template %s: unexpected {{/%s}}\n", name, tag_name);
+                goto fail;
+            }
+            tpl->segments[open_sections[--depth]].end = tpl->count;
+        } else if (kind == '>') {
+            if (add_segment(tpl, &capacity, SEG_PARTIAL, trim_tag(tag + 3, close), 0) == -1) {
+                goto fail;
+            }
+        } else {
+            if (add_segment(tpl, &capacity, SEG_VAR, trim_tag(tag + 2, close), 0) == -1) {
+                goto fail;
+            }
+        }
+    }
+
+    if (depth != 0) {
+        fprintf(stderr, "Template %s: unclosed section {{#%s}}\n",
+                name, tpl->segments[open_sections[depth - 1]].text);
+        goto fail;
+    }
+
+    return tpl;
+
+fail:
+    template_free(tpl);
+    return NULL;
+}
+
+static const template_t *find_template(const template_set_t *set, const char *name) {
+    for (size_t i = 0; i < set->count; i++) {
+        if (strcmp(set->templates[i]->name, name) == 0) {
+            return set->templates[i];
+        }
+    }
+    return NULL;
+}
+
+static void emit(writer_t *out, const char *text, size_t len) {
+    if (out->failed || len == 0) {
+        return;
+    }
+    if (len > SIZE_MAX - 1 - out->size) {
+        out->failed = 1;
+        return;
+    }
+    if (out->count == out->capacity) {
+        size_t new_capacity = out->capacity ? out->capacity * 2 : 64;
+        piece_t *pieces = realloc(out->pieces, new_capacity * sizeof(piece_t));
+        if (pieces == NULL) {
+            out->failed = 1;
+            return;
+        }
+        out->pieces = pieces;
+        out->capacity = new_capacity;
+    }
+    out->pieces[out->count].text = text;
+    out->pieces[out->count].len = len;
+    out->count++;
+    out->size += len;
+}
+
+static void render_range(const template_set_t *set, const template_t *tpl, size_t begin, size_t end,
+                         const template_data_t *data, const void *item, int depth, writer_t *out) {
+    for (size_t i = begin; i < end; i++) {
+        const segment_t *seg = &tpl->segments[i];
+
+        switch (seg->type) {
+            case SEG_LITERAL:
+                emit(out, seg->text, seg->len);
+                break;
+
+            case SEG_VAR: {
+                const char *value = data->get_var ? data->get_var(seg->text, item, data->ctx) : NULL;
+                if (value != NULL) {
+                    emit(out, value, strlen(value));
+                }
+                break;
+            }
+
+            case SEG_SECTION: {
+                size_t count = data->section_count ? data->section_count(seg->text, data->ctx) : 0;
+                for (size_t n = 0; n < count; n++) {
+                    const void *section_item = data->section_item(seg->text, n, data->ctx);
+                    render_range(set, tpl, i + 1, seg->end, data, section_item, depth, out);
+                }
+                i = seg->end - 1;
+                break;
+            }
+
+            case SEG_PARTIAL: {
+                const template_t *partial = find_template(set, seg->text);
+                if (partial != NULL && depth < MAX_PARTIAL_DEPTH) {
+                    render_range(set, partial, 0, partial->count, data, item, depth + 1, out);
+                }
+                break;
+            }
+        }
+    }
+}
+
+template_set_t *template_set_create(void) {
+    return calloc(1, sizeof(template_set_t));
+}
+
+void template_set_free(template_set_t *set) {
+    if (set == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        template_free(set->templates[i]);
+    }
+    free(set->templates);
+    free(set);
+}
+
+int template_set_compile(template_set_t *set, const char *name, const char *text, size_t len) {
+    template_t *tpl = compile(name, text, len);
+    if (tpl == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < set->count; i++) {
+        if (strcmp(set->templates[i]->name, name) == 0) {
+            template_free(set->templates[i]);
+            set->templates[i] = tpl;
+            return 0;
+        }
+    }
+
+    if (set->count == set->capacity) {
+        size_t new_capacity = set->capacity ? set->capacity * 2 : 8;
+        template_t **templates = realloc(set->templates, new_capacity * sizeof(template_t *));
+        if (templates == NULL) {
+            template_free(tpl);
+            return -1;
+        }
+        set->templates = templates;
+        set->capacity = new_capacity;
+    }
+
+    set->templates[set->count++] = tpl;
+    return 0;
+}
+
+char *template_render(const template_set_t *set, const char *name,
+                      const template_data_t *data, size_t *len) {
+    const template_t *tpl = find_template(set, name);
+    if (tpl == NULL) {
+        return NULL;
+    }
+
+    // One walk collects the pieces, then they are copied into an exact-size
+    // buffer, so every callback is called once per placeholder
+    writer_t out = {NULL, 0, 0, 0, 0};
+    render_range(set, tpl, 0, tpl->count, data, NULL, 0, &out);
+
+    char *buf = out.failed ? NULL : malloc(out.size + 1);
+    if (buf != NULL) {
+        size_t pos = 0;
+        for (size_t i = 0; i < out.count; i++) {
+            memcpy(buf + pos, out.pieces[i].text, out.pieces[i].len);
+            pos += out.pieces[i].len;
+        }
+        buf[pos] = '\0';
+        if (len != NULL) {
+            *len = pos;
+        }
+    }
+    free(out.pieces);
+    return buf;
+}
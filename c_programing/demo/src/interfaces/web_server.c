@@ -1,40 +1,288 @@
 #include "../../include/web_server.h"
 #include "../../include/ai_integration.h"
+#include "../../include/template.h"
+#include "../../include/router.h"
+#include "../../include/demo_zygote.h"
+#include "../../include/json_escape.h"
+#include "../../include/json_stream.h"
+#include "../../include/arena.h"
+#include "../../include/logger.h"
+#include "../../include/metrics.h"
+#include "../../include/work_queue.h"
+#include "../../include/project_index.h"
+#include "../../include/ai_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <ctype.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
 
-// Structure to store POST request data
+// A chat prompt, the buffers behind it and its key in the response cache.
+// The buffers are malloc'd: a streamed reply outlives the request's arena.
+typedef struct {
+    ai_prompt_t prompt;
+    char* context_block;
+    char* question;
+    ai_cache_key_t key;
+    int fresh;              // The client asked not to be answered from the cache
+} chat_prompt_t;
+
+// State of a POST request while its body arrives, or of a request waiting
+// for a worker thread; it lives in its own arena
 struct PostConnectionData {
-    char *data;
-    size_t size;
-    int is_first_call;
+    arena_t *arena;         // Everything the request allocates, released when it completes
+    json_stream_t *json;    // Tokenizer for the body, created with the first chunk
+    int answered;           // An error was queued before the body was read
+    int cancelled;          // The worker job was dropped because the server is shutting down
+    uint64_t started;       // metrics_now_us() when the headers arrived
+    
+    // Set while the connection is suspended waiting for an AI or demo worker
+    int suspended;
+    struct MHD_Connection* connection;
+    chat_prompt_t chat;     // Prompt of a chat request, freed when the request completes
+    const char* cache_status;   // AI_CACHE_HEADER value of the reply
+    char* ai_response;      // Reply of the AI worker, malloc'd
+    unsigned int ai_status; // MHD_HTTP_OK, or the error to answer with
+    
+    // /run/<demo>: the demo and the output captured by a demo worker
+    const demo_info_t* demo;
+    demo_output_t demo_output;
+    unsigned int demo_status;   // MHD_HTTP_OK, or the error to answer with
 };
 
+// Connection context of requests that keep no state
+static int request_marker;
+
+// Arenas of POST requests, recycled across requests
+static arena_pool_t* request_arenas = NULL;
+static size_t request_memory_limit = DEFAULT_REQUEST_MEMORY_LIMIT;
+
+// Threads that run the blocking DeepSeek calls of /api/chat
+static work_queue_t* ai_workers = NULL;
+
+// Threads that run demos for /run/<demo>, one per demo slot
+static work_queue_t* demo_workers = NULL;
+
+// Members of the /api/chat body the server reads
+static const char* const chat_fields[] = {"message", "stream", NULL};
+
 // Forward declarations to fix implicit declaration errors
-char* extract_json_value(const char* json, const char* key);
 char* create_json_response(const char* message);
-char* process_ai_request(const char* message);
-char* generate_project_context(void);
-void scan_directory(const char *path, char *buffer, size_t *pos, size_t *buffer_size, int depth, int max_depth);
-void add_file_content(const char *file_path, char *buffer, size_t *pos, size_t *buffer_size, int max_lines);
+static int build_chat_prompt(const char* message, chat_prompt_t* chat);
+static void free_chat_prompt(chat_prompt_t* chat);
+char* process_ai_request(const chat_prompt_t* chat, ai_token_callback_t on_token, void* ctx);
 char* load_template(const char* filename);
 char* generate_demo_html(void);
-char* capture_demo_output(void (*demo_func)(void));
+int capture_demo_output(const demo_info_t* demo, demo_output_t* output);
+static void run_demo_at(unsigned int index);
+static ssize_t read_demo_stream(void* cls, uint64_t pos, char* buf, size_t max);
+static void free_demo_stream(void* cls);
+static void run_demo_stream_job(void* arg, int cancelled);
 const char* get_content_type(const char* filename);
+static struct MHD_Response* create_asset_response(const static_asset_t* asset);
+static int is_compressible(const char* content_type);
+static const char* get_cache_control(const char* content_type);
+static int is_not_modified(struct MHD_Connection* connection, const char* etag, time_t mtime);
+static void add_validator_headers(struct MHD_Response* response, const char* etag,
+                                  const char* last_modified, const char* cache_control);
+static int queue_html_page(struct MHD_Connection* connection, char* html);
+static void load_templates(void);
+static void rebuild_pages(void);
+static void on_static_file_changed(const char* url_path, void* ctx);
+static int queue_cached_page(struct MHD_Connection* connection, int page);
+static const static_asset_t* acquire_precompressed(const char* url, const static_asset_t* asset,
+                                                   const char* accept_encoding, const char** encoding);
+static router_t* build_routes(void);
+static int is_static_file(const char* url);
+static int queue_not_found(struct MHD_Connection* connection);
+static int queue_method_not_allowed(struct MHD_Connection* connection, unsigned allowed);
+static void request_completed(void* cls, struct MHD_Connection* connection,
+                              void** con_cls, enum MHD_RequestTerminationCode toe);
+static void connection_changed(void* cls, struct MHD_Connection* connection,
+                               void** socket_context, enum MHD_ConnectionNotificationCode toe);
+static void register_metrics(void);
+static void run_chat_job(void* arg, int cancelled);
+static void run_demo_job(void* arg, int cancelled);
+static int queue_demo_result(struct MHD_Connection* connection, struct PostConnectionData* state);
+static int queue_chat_reply(struct MHD_Connection* connection, void** con_cls);
+static int queue_chat_stream(struct MHD_Connection* connection, void** con_cls);
+static int queue_cached_chat_reply(struct MHD_Connection* connection, char* cached, size_t len, int stream);
+
+// Signature shared by all route handlers
+typedef int (*route_handler_t)(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                               const char* upload_data, size_t* upload_data_size, void** con_cls);
+
+static int handle_index_page(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                             const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_chat_page(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                            const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_chat_api(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                           const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_preflight(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                            const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_project_context(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                                  const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_static_file(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                              const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_run_demo(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                           const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_unknown_demo(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                               const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_stream_demo(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                              const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_demo_cache_stats(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                                   const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int handle_metrics(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                          const char* upload_data, size_t* upload_data_size, void** con_cls);
+static int queue_cached_demo_result(struct MHD_Connection* connection, const demo_info_t* demo, int stream, int* ret);
+static void store_demo_result(const demo_info_t* demo, struct MHD_Response* response,
+                              const char* output, size_t size, int truncated);
+static struct MHD_Response* create_demo_json_response(const char* output, size_t size, int truncated);
+static void add_demo_stream_headers(struct MHD_Response* response);
+
+// Route identifiers, indexes into route_handlers
+enum {
+    ROUTE_ID_INDEX,
+    ROUTE_ID_CHAT_PAGE,
+    ROUTE_ID_CHAT_API,
+    ROUTE_ID_PREFLIGHT,
+    ROUTE_ID_PROJECT_CONTEXT,
+    ROUTE_ID_RUN_DEMO,
+    ROUTE_ID_UNKNOWN_DEMO,
+    ROUTE_ID_STREAM_DEMO,
+    ROUTE_ID_DEMO_CACHE_STATS,
+    ROUTE_ID_STATIC,
+    ROUTE_ID_METRICS,
+    ROUTE_ID_COUNT
+};
+
+static const route_handler_t route_handlers[] = {
+    [ROUTE_ID_INDEX] = handle_index_page,
+    [ROUTE_ID_CHAT_PAGE] = handle_chat_page,
+    [ROUTE_ID_CHAT_API] = handle_chat_api,
+    [ROUTE_ID_PREFLIGHT] = handle_preflight,
+    [ROUTE_ID_PROJECT_CONTEXT] = handle_project_context,
+    [ROUTE_ID_RUN_DEMO] = handle_run_demo,
+    [ROUTE_ID_UNKNOWN_DEMO] = handle_unknown_demo,
+    [ROUTE_ID_STREAM_DEMO] = handle_stream_demo,
+    [ROUTE_ID_DEMO_CACHE_STATS] = handle_demo_cache_stats,
+    [ROUTE_ID_STATIC] = handle_static_file,
+    [ROUTE_ID_METRICS] = handle_metrics,
+};
+
+// Route label of each request latency histogram; requests that match no
+// route are counted under ROUTE_ID_COUNT
+static const char* const route_labels[ROUTE_ID_COUNT + 1] = {
+    [ROUTE_ID_INDEX] = "route=\"/\"",
+    [ROUTE_ID_CHAT_PAGE] = "route=\"/deepseek-chat\"",
+    [ROUTE_ID_CHAT_API] = "route=\"/api/chat\"",
+    [ROUTE_ID_PREFLIGHT] = "route=\"preflight\"",
+    [ROUTE_ID_PROJECT_CONTEXT] = "route=\"/api/project-context\"",
+    [ROUTE_ID_RUN_DEMO] = "route=\"/run/<demo>\"",
+    [ROUTE_ID_UNKNOWN_DEMO] = "route=\"unknown demo\"",
+    [ROUTE_ID_STREAM_DEMO] = "route=\"/stream/<demo>\"",
+    [ROUTE_ID_DEMO_CACHE_STATS] = "route=\"/api/demo-cache\"",
+    [ROUTE_ID_STATIC] = "route=\"static\"",
+    [ROUTE_ID_METRICS] = "route=\"/metrics\"",
+    [ROUTE_ID_COUNT] = "route=\"unmatched\"",
+};
 
-// Buffer for capturing demo output
-static char output_buffer[65536];
-static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Series ids, registered once by register_metrics
+static int route_latency[ROUTE_ID_COUNT + 1];
+static int connections_in_flight = -1;
+static int connections_total = -1;
+static int demo_spawn_zygote = -1;
+static int demo_spawn_fork = -1;
+static int demo_bytes_run = -1;
+static int demo_bytes_stream = -1;
+static int deepseek_latency = -1;
+static int deepseek_first_token = -1;
+static int deepseek_cache_hit_tokens = -1;
+static int deepseek_cache_miss_tokens = -1;
+static int deepseek_completion_tokens = -1;
 
-// Global project context for DeepSeek AI
-static char *project_context = NULL;
-static pthread_mutex_t context_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Route table, built once at startup and read-only afterwards
+static router_t* routes = NULL;
+
+// Precompressed variants written by `make precompress`, in order of preference
+static const struct {
+    const char* encoding;
+    const char* suffix;
+} precompressed_variants[] = {
+    {"br", ".br"},
+    {"gzip", ".gz"},
+};
+
+// Template files compiled at startup and whenever one of them changes
+static const char* template_files[] = {
+    "header.html",
+    "footer.html",
+    "index.html",
+    "deepseek_chat.html",
+};
+static template_set_t* templates = NULL;
+static pthread_mutex_t templates_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Pages rendered once and shared by every request
+enum { PAGE_INDEX, PAGE_CHAT, PAGE_COUNT };
+static struct {
+    const char* template_name;
+    struct MHD_Response* response;
+    char etag[ETAG_SIZE];
+} cached_pages[PAGE_COUNT] = {
+    [PAGE_INDEX] = {"index.html", NULL, ""},
+    [PAGE_CHAT] = {"deepseek_chat.html", NULL, ""},
+};
+static pthread_mutex_t pages_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Limits for demo runs; each run captures into its own buffer
+static sem_t demo_slots;
+static size_t demo_output_limit = DEFAULT_DEMO_OUTPUT_LIMIT;
+static size_t context_token_budget = DEFAULT_CONTEXT_TOKENS;
+
+// A running demo
+typedef struct {
+    int fd;             // Read end of the demo's pipe, -1 once finished
+    pid_t pid;
+    int pidfd;          // Zygote workers: pidfd to stop them with, -1 if none
+    int reap;           // Forked by the server itself (zygote workers are reaped by the zygote)
+} demo_process_t;
+
+// A demo whose output is forwarded to the client as it is produced. A demo
+// worker reads the pipe and appends the output, the connection's content
+// reader sends it; each side drops its reference when done with it.
+typedef struct {
+    pthread_mutex_t lock;
+    struct MHD_Connection* connection;
+    const demo_info_t* demo;
+    char* data;                 // Output not yet sent
+    size_t len;
+    size_t cap;
+    size_t sent;
+    int done;                   // The worker appended the end of the output
+    int reader_waiting;         // The reader suspended the connection until more output arrives
+    int closed;                 // The client went away
+    int refs;
+} demo_stream_t;
+
+static int spawn_demo(const demo_info_t* demo, demo_process_t* process);
+static void finish_demo(demo_process_t* process, int stop);
+static void release_demo_stream(demo_stream_t* stream);
+
+// Set once the chat page asked for the project context; from then on every
+// prompt carries the parts of the current snapshot relevant to its question
+static atomic_int project_context_enabled = 0;
 
 // Demo function declarations - from your existing code
 extern void demo_file_operations();
@@ -64,56 +312,204 @@ extern void demo_file_locking();
 
 // List of all available demos
 static const demo_info_t demos[] = {
-    {"file_operations", "File Operations", demo_file_operations},
-    {"process_operations", "Process Operations", demo_process_operations},
-    {"directory_operations", "Directory Operations", demo_directory_operations},
-    {"pipe_operations", "Pipe Operations", demo_pipe_operations},
-    {"time_operations", "Time Operations", demo_time_operations},
-    {"signal_operations", "Signal Handling", demo_signal_operations},
-    {"memory_operations", "Memory Management", demo_memory_operations},
-    {"file_permission_operations", "File Permission Management", demo_file_permission_operations},
-    {"system_info_operations", "System Information", demo_system_info_operations},
-    {"user_group_operations", "User and Group Management", demo_user_group_operations},
-    {"filesystem_operations", "Filesystem Operations", demo_filesystem_operations},
-    {"terminal_operations", "Terminal I/O Operations", demo_terminal_operations},
-    {"message_queue_operations", "Message Queue Operations", demo_message_queue_operations},
-    {"event_monitoring", "Event Monitoring", demo_event_monitoring},
-    {"file_monitoring", "File Monitoring", demo_file_monitoring},
-    {"process_scheduling", "Process Scheduling", demo_process_scheduling},
-    {"advanced_file_operations", "Advanced File Operations", demo_advanced_file_operations},
-    {"extended_attributes", "Extended Attributes", demo_extended_attributes},
-    {"advanced_memory_management", "Advanced Memory Management", demo_advanced_memory_management},
-    {"advanced_networking", "Advanced Networking", demo_advanced_networking},
-    {"system_timers", "System Timers", demo_system_timers},
-    {"process_priority", "Process Priority & Resource Usage", demo_process_priority},
-    {"user_group_ids", "User and Group IDs", demo_user_group_ids},
-    {"file_locking", "File Locking", demo_file_locking},
-    {NULL, NULL, NULL} // Terminator
+    {"file_operations", "File Operations", demo_file_operations, DEMO_CACHE_NEVER, 0},
+    {"process_operations", "Process Operations", demo_process_operations, DEMO_CACHE_NEVER, 0},
+    {"directory_operations", "Directory Operations", demo_directory_operations, DEMO_CACHE_NEVER, 0},
+    {"pipe_operations", "Pipe Operations", demo_pipe_operations, DEMO_CACHE_NEVER, 0},
+    {"time_operations", "Time Operations", demo_time_operations, DEMO_CACHE_NEVER, 0},
+    {"signal_operations", "Signal Handling", demo_signal_operations, DEMO_CACHE_NEVER, 0},
+    {"memory_operations", "Memory Management", demo_memory_operations, DEMO_CACHE_NEVER, 0},
+    {"file_permission_operations", "File Permission Management", demo_file_permission_operations, DEMO_CACHE_NEVER, 0},
+    {"system_info_operations", "System Information", demo_system_info_operations, DEMO_CACHE_TTL, 10},
+    {"user_group_operations", "User and Group Management", demo_user_group_operations, DEMO_CACHE_TTL, 60},
+    {"filesystem_operations", "Filesystem Operations", demo_filesystem_operations, DEMO_CACHE_TTL, 10},
+    {"terminal_operations", "Terminal I/O Operations", demo_terminal_operations, DEMO_CACHE_FOREVER, 0},
+    {"message_queue_operations", "Message Queue Operations", demo_message_queue_operations, DEMO_CACHE_FOREVER, 0},
+    {"event_monitoring", "Event Monitoring", demo_event_monitoring, DEMO_CACHE_FOREVER, 0},
+    {"file_monitoring", "File Monitoring", demo_file_monitoring, DEMO_CACHE_FOREVER, 0},
+    {"process_scheduling", "Process Scheduling", demo_process_scheduling, DEMO_CACHE_FOREVER, 0},
+    {"advanced_file_operations", "Advanced File Operations", demo_advanced_file_operations, DEMO_CACHE_NEVER, 0},
+    {"extended_attributes", "Extended Attributes", demo_extended_attributes, DEMO_CACHE_TTL, 60},
+    {"advanced_memory_management", "Advanced Memory Management", demo_advanced_memory_management, DEMO_CACHE_NEVER, 0},
+    {"advanced_networking", "Advanced Networking", demo_advanced_networking, DEMO_CACHE_FOREVER, 0},
+    {"system_timers", "System Timers", demo_system_timers, DEMO_CACHE_FOREVER, 0},
+    {"process_priority", "Process Priority & Resource Usage", demo_process_priority, DEMO_CACHE_FOREVER, 0},
+    {"user_group_ids", "User and Group IDs", demo_user_group_ids, DEMO_CACHE_FOREVER, 0},
+    {"file_locking", "File Locking", demo_file_locking, DEMO_CACHE_FOREVER, 0},
+    {NULL, NULL, NULL, DEMO_CACHE_NEVER, 0} // Terminator
 };
 
-// Initialize the web server
+// Cached results of demos whose cache policy allows it, indexed like demos[].
+// Filled by whichever of /run and /stream runs the demo, and answers both.
+static struct {
+    struct MHD_Response* response;          // JSON for /run
+    struct MHD_Response* stream_response;   // Plain text for /stream
+    time_t expires;     // Monotonic time after which a DEMO_CACHE_TTL result is stale
+} demo_results[sizeof(demos) / sizeof(demos[0])];
+static unsigned long demo_cache_hits = 0;
+static unsigned long demo_cache_misses = 0;
+static pthread_mutex_t demo_results_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Fill a configuration with the default options
+void web_server_default_config(web_server_config_t* config) {
+    config->port = SERVER_PORT;
+    config->use_epoll = 1;
+    config->thread_pool_size = DEFAULT_THREAD_POOL_SIZE;
+    config->static_cache_bytes = DEFAULT_STATIC_CACHE_BYTES;
+    config->sendfile_threshold = DEFAULT_SENDFILE_THRESHOLD;
+    config->max_concurrent_demos = 0;
+    config->demo_output_limit = DEFAULT_DEMO_OUTPUT_LIMIT;
+    config->use_zygote = 1;
+    config->request_memory_limit = DEFAULT_REQUEST_MEMORY_LIMIT;
+    config->log_level = LOG_LEVEL_INFO;
+    config->ai_workers = DEFAULT_AI_WORKERS;
+    config->context_tokens = DEFAULT_CONTEXT_TOKENS;
+    config->ai_cache_bytes = DEFAULT_AI_CACHE_BYTES;
+    config->ai_cache_file = NULL;
+}
+
+// Initialize the web server with the default configuration
 struct MHD_Daemon* init_web_server(void) {
+    web_server_config_t config;
+    web_server_default_config(&config);
+    return init_web_server_with_config(&config);
+}
+
+// Initialize the web server
+struct MHD_Daemon* init_web_server_with_config(const web_server_config_t* config) {
+    // Start the demo zygote while the process is still small and single-threaded
+    if (config->use_zygote) {
+        if (demo_zygote_start(&run_demo_at) != 0) {
+            fprintf(stderr, "Failed to start demo zygote, demos will be forked from the server\n");
+        }
+    }
+    
+    // Start the log writer once the zygote has forked, from here on request
+    // threads never wait for the terminal
+    if (logger_start(stdout, config->log_level) != 0) {
+        fprintf(stderr, "Failed to start the log writer, messages will be written directly\n");
+    }
+
     // Initialize the AI system first
     // Using the from_env_file version which doesn't need an explicit API key
     // It will read from .env file or environment variables
     if (!ai_init_from_env_file(NULL)) {
-        fprintf(stderr, "Failed to initialize AI system\n");
+        log_message(LOG_LEVEL_ERROR, "Failed to initialize AI system");
         // Continue anyway, other functionality will still work
     } else {
-        printf("AI system initialized successfully\n");
+        log_message(LOG_LEVEL_INFO, "AI system initialized successfully");
+    }
+    if (ai_cache_init(config->ai_cache_bytes, config->ai_cache_file) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to open the AI cache file, AI responses are cached in memory only");
+    }
+
+    // Load static files into memory before accepting connections
+    static_cache_set_listener(&on_static_file_changed, NULL);
+    if (static_cache_init(STATIC_DIR, config->static_cache_bytes, config->sendfile_threshold) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to start static file cache watcher");
+        // Continue anyway, cached files are still served
+    }
+    load_templates();
+    rebuild_pages();
+    register_metrics();
+    
+    // Build the project overview for the AI prompt in the background
+    if (project_index_start(".") != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to start the project index, chat prompts will have no project context");
+    }
+
+    routes = build_routes();
+    if (routes == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Failed to build the route table");
+        logger_stop();
+        return NULL;
     }
 
-    struct MHD_Daemon* daemon = MHD_start_daemon(
-        MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
-        SERVER_PORT,
-        NULL, NULL,
-        &handle_request, NULL,
-        MHD_OPTION_END);
+    // Let as many demos run at once as there are CPUs unless configured otherwise
+    unsigned int max_demos = config->max_concurrent_demos;
+    if (max_demos == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max_demos = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    sem_init(&demo_slots, 0, max_demos);
+    demo_output_limit = config->demo_output_limit > 0 ? config->demo_output_limit : DEFAULT_DEMO_OUTPUT_LIMIT;
+    context_token_budget = config->context_tokens > 0 ? config->context_tokens : DEFAULT_CONTEXT_TOKENS;
+    
+    // A request needs at least one block for its context
+    request_memory_limit = config->request_memory_limit > 0 ? config->request_memory_limit : DEFAULT_REQUEST_MEMORY_LIMIT;
+    if (request_memory_limit < REQUEST_ARENA_BLOCK_SIZE) {
+        request_memory_limit = REQUEST_ARENA_BLOCK_SIZE;
+    }
+    request_arenas = arena_pool_create(REQUEST_ARENA_BLOCK_SIZE, REQUEST_ARENA_FREE_BLOCKS);
+    if (request_arenas == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Failed to create the request arena pool");
+        router_free(routes);
+        routes = NULL;
+        logger_stop();
+        return NULL;
+    }
     
+    // Chat requests wait for these threads with their connection suspended,
+    // so a slow DeepSeek call never holds a server thread
+    ai_workers = work_queue_create(config->ai_workers > 0 ? config->ai_workers : DEFAULT_AI_WORKERS,
+                                   CHAT_QUEUE_LIMIT);
+    // Demos run on their own threads, so a running demo never holds a
+    // server thread and as many demos run at once as there are slots
+    demo_workers = work_queue_create(max_demos, DEMO_QUEUE_LIMIT);
+    if (ai_workers == NULL || demo_workers == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Failed to start the AI and demo worker threads");
+        work_queue_free(ai_workers);
+        ai_workers = NULL;
+        work_queue_free(demo_workers);
+        demo_workers = NULL;
+        arena_pool_free(request_arenas);
+        request_arenas = NULL;
+        router_free(routes);
+        routes = NULL;
+        logger_stop();
+        return NULL;
+    }
+
+    // Fall back to the single select() thread if epoll is unavailable
+    int use_epoll = config->use_epoll;
+    if (use_epoll && MHD_is_feature_supported(MHD_FEATURE_EPOLL) != MHD_YES) {
+        log_message(LOG_LEVEL_WARN, "epoll is not supported by libmicrohttpd, using select()");
+        use_epoll = 0;
+    }
+
+    unsigned int threads = config->thread_pool_size > 0 ? config->thread_pool_size : 1;
+    struct MHD_Daemon* daemon;
+
+    if (use_epoll) {
+        // One epoll loop per worker thread, connections are spread across the pool
+        daemon = MHD_start_daemon(
+            MHD_USE_EPOLL_INTERNALLY | MHD_USE_DEBUG | MHD_ALLOW_SUSPEND_RESUME,
+            config->port,
+            NULL, NULL,
+            &handle_request, NULL,
+            MHD_OPTION_THREAD_POOL_SIZE, threads,
+            MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+            MHD_OPTION_NOTIFY_CONNECTION, &connection_changed, NULL,
+            MHD_OPTION_END);
+    } else {
+        daemon = MHD_start_daemon(
+            MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG | MHD_ALLOW_SUSPEND_RESUME,
+            config->port,
+            NULL, NULL,
+            &handle_request, NULL,
+            MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+            MHD_OPTION_NOTIFY_CONNECTION, &connection_changed, NULL,
+            MHD_OPTION_END);
+    }
+
     if (daemon == NULL) {
-        fprintf(stderr, "Failed to start web server\n");
+        log_message(LOG_LEVEL_ERROR, "Failed to start web server");
+        logger_stop();  // The caller exits, write the messages out first
+    } else if (use_epoll) {
+        log_message(LOG_LEVEL_INFO, "Web server started at http://localhost:%u (epoll, %u threads)",
+                    config->port, threads);
     } else {
-        printf("Web server started at http://localhost:%d\n", SERVER_PORT);
+        log_message(LOG_LEVEL_INFO, "Web server started at http://localhost:%u (select)", config->port);
     }
     
     return daemon;
@@ -122,9 +518,71 @@ struct MHD_Daemon* init_web_server(void) {
 // Stop the web server
 void stop_web_server(struct MHD_Daemon* daemon) {
     if (daemon != NULL) {
+        // Resume every suspended chat and demo request first: MHD cannot
+        // stop with suspended connections. Requests arriving meanwhile get a 503.
+        work_queue_stop(ai_workers);
+        work_queue_stop(demo_workers);
         MHD_stop_daemon(daemon);
-        printf("Web server stopped\n");
+        work_queue_free(ai_workers);
+        ai_workers = NULL;
+        work_queue_free(demo_workers);
+        demo_workers = NULL;
+        ai_cache_shutdown();
+        static_cache_shutdown();
+        project_index_stop();
+        
+        pthread_mutex_lock(&pages_lock);
+        for (int i = 0; i < PAGE_COUNT; i++) {
+            if (cached_pages[i].response != NULL) {
+                MHD_destroy_response(cached_pages[i].response);
+                cached_pages[i].response = NULL;
+            }
+        }
+        pthread_mutex_unlock(&pages_lock);
+        
+        pthread_mutex_lock(&templates_lock);
+        template_set_free(templates);
+        templates = NULL;
+        pthread_mutex_unlock(&templates_lock);
+        
+        router_free(routes);
+        routes = NULL;
+        sem_destroy(&demo_slots);
+        
+        // The daemon is stopped, so every request has completed and released its arena
+        arena_pool_free(request_arenas);
+        request_arenas = NULL;
+        
+        pthread_mutex_lock(&demo_results_lock);
+        for (size_t i = 0; demos[i].name != NULL; i++) {
+            if (demo_results[i].response != NULL) {
+                MHD_destroy_response(demo_results[i].response);
+                MHD_destroy_response(demo_results[i].stream_response);
+                demo_results[i].response = NULL;
+                demo_results[i].stream_response = NULL;
+            }
+        }
+        pthread_mutex_unlock(&demo_results_lock);
+        demo_zygote_stop();
+        log_message(LOG_LEVEL_INFO, "Web server stopped");
+        logger_stop();
+    }
+}
+
+// State of a request kept across calls, in an arena from the pool
+static struct PostConnectionData* create_request_state(void) {
+    arena_t *arena = arena_acquire(request_arenas, request_memory_limit);
+    if (arena == NULL) {
+        return NULL;
+    }
+    struct PostConnectionData *post_data = arena_calloc(arena, sizeof(struct PostConnectionData));
+    if (post_data == NULL) {
+        arena_release(arena);
+        return NULL;
     }
+    post_data->arena = arena;
+    post_data->started = metrics_now_us();
+    return post_data;
 }
 
 // Handle HTTP requests
@@ -132,686 +590,1455 @@ int handle_request(void* cls, struct MHD_Connection* connection,
                  const char* url, const char* method, const char* version,
                  const char* upload_data, size_t* upload_data_size, void** con_cls) {
     
-    struct MHD_Response* response;
-    int ret;
-    
     // First call setup
     if (*con_cls == NULL) {
-        // For POST requests, allocate a structure to store data
+        // For POST requests, take an arena from the pool and keep the state in it
         if (strcmp(method, "POST") == 0) {
-            struct PostConnectionData *post_data = malloc(sizeof(struct PostConnectionData));
-            if (post_data == NULL) {
+            *con_cls = create_request_state();
+            if (*con_cls == NULL) {
                 return MHD_NO;
             }
-            post_data->data = NULL;
-            post_data->size = 0;
-            post_data->is_first_call = 1;
-            *con_cls = post_data;
         } else {
-            // For non-POST requests, just use a dummy marker
-            static int dummy;
-            *con_cls = &dummy;
+            // For non-POST requests, just use a marker
+            *con_cls = &request_marker;
         }
         return MHD_YES;
     }
 
-    printf("Received request: %s %s\n", method, url);
+    log_message(LOG_LEVEL_INFO, "%s %s", method, url);
     
-    // Handle POST request for chat API
-    if (strcmp(url, "/api/chat") == 0 && strcmp(method, "POST") == 0) {
-        struct PostConnectionData *post_data = *con_cls;
-        
-        // Process incoming data chunks
-        if (*upload_data_size != 0) {
-            // Append the new chunk to our buffer
-            char *new_data = realloc(post_data->data, post_data->size + *upload_data_size + 1);
-            if (new_data == NULL) {
-                // Memory allocation error
-                if (post_data->data) {
-                    free(post_data->data);
-                }
-                free(post_data);
-                *con_cls = NULL;
-                return MHD_NO;
-            }
-            
-            post_data->data = new_data;
-            memcpy(post_data->data + post_data->size, upload_data, *upload_data_size);
-            post_data->size += *upload_data_size;
-            post_data->data[post_data->size] = '\0';
-            
-            // Mark that we've consumed this chunk
-            *upload_data_size = 0;
-            
-            // Wait for more data
-            return MHD_YES;
-        }
-        
-        // No more data - process the complete POST request
-        if (post_data->data != NULL) {
-            const char *content_type = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Content-Type");
-            
-            printf("Received POST data: %s\n", post_data->data);
-            
-            if (content_type != NULL && strstr(content_type, "application/json") != NULL) {
-                // Process the JSON data
-                char *message = extract_json_value(post_data->data, "message");
-                
-                if (message != NULL) {
-                    printf("Extracted message: %s\n", message);
-                    
-                    // Call DeepSeek API
-                    char *ai_response = process_ai_request(message);
-                    free(message);
-                    
-                    // Create JSON response
-                    char *json_response = create_json_response(ai_response ? ai_response : "Error processing request");
-                    if (ai_response) {
-                        free(ai_response);
-                    }
-                    
-                    // Send response
-                    response = MHD_create_response_from_buffer(
-                        strlen(json_response),
-                        json_response,
-                        MHD_RESPMEM_MUST_FREE
-                    );
-                    MHD_add_response_header(response, "Content-Type", "application/json");
-                    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
-                    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-                    MHD_destroy_response(response);
-                    
-                    // Clean up
-                    if (post_data->data) free(post_data->data);
-                    free(post_data);
-                    *con_cls = NULL;
-                    
-                    return ret;
-                }
-            }
-            
-            // If we get here, something went wrong with processing the data
-            const char *error_json = "{\"error\":\"Could not parse request data\"}";
-            response = MHD_create_response_from_buffer(
-                strlen(error_json),
-                (void*)error_json,
-                MHD_RESPMEM_PERSISTENT
-            );
-            MHD_add_response_header(response, "Content-Type", "application/json");
-            MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
-            ret = MHD_queue_response(connection, MHD_HTTP_BAD_REQUEST, response);
-            MHD_destroy_response(response);
-            
-            // Clean up
-            if (post_data->data) free(post_data->data);
-            free(post_data);
-            *con_cls = NULL;
-            
-            return ret;
-        }
-    }
-    
-    // Handle OPTIONS request for CORS preflight
-    if (strcmp(method, "OPTIONS") == 0) {
-        response = MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
-        MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
-        MHD_add_response_header(response, "Access-Control-Allow-Methods", "GET, POST, OPTIONS");
-        MHD_add_response_header(response, "Access-Control-Allow-Headers", "Content-Type");
-        MHD_add_response_header(response, "Access-Control-Max-Age", "86400");
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        return ret;
+    // A POST request is timed from its headers to the call after its last
+    // chunk, other requests take a single call
+    uint64_t started = metrics_now_us();
+    int last_call = *upload_data_size == 0;
+    if (*con_cls != &request_marker) {
+        started = ((struct PostConnectionData*)*con_cls)->started;
     }
     
-    // Handle GET request for project context
-    if (strcmp(url, "/api/project-context") == 0 && strcmp(method, "GET") == 0) {
-        char *json_response;
-        
-        // Generate project context if we don't have it yet
-        pthread_mutex_lock(&context_mutex);
-        if (project_context == NULL) {
-            project_context = generate_project_context();
-        }
-        
-        if (project_context != NULL) {
-            size_t response_len = strlen(project_context) + 50;
-            json_response = malloc(response_len);
-            if (json_response != NULL) {
-                snprintf(json_response, response_len, "{\"success\":true,\"contextSize\":%zu}", strlen(project_context));
-            } else {
-                json_response = strdup("{\"success\":false,\"error\":\"Memory allocation failed\"}");
-            }
-        } else {
-            json_response = strdup("{\"success\":false,\"error\":\"Failed to generate project context\"}");
-        }
-        pthread_mutex_unlock(&context_mutex);
-        
-        response = MHD_create_response_from_buffer(
-            strlen(json_response),
-            json_response,
-            MHD_RESPMEM_MUST_FREE
-        );
-        MHD_add_response_header(response, "Content-Type", "application/json");
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        return ret;
+    route_match_t match;
+    unsigned int route = ROUTE_ID_COUNT;
+    int ret;
+    switch (router_match(routes, method, url, &match)) {
+        case ROUTE_FOUND:
+            route = match.id;
+            ret = route_handlers[match.id](connection, url, &match,
+                                           upload_data, upload_data_size, con_cls);
+            break;
+        case ROUTE_METHOD_NOT_ALLOWED:
+            ret = queue_method_not_allowed(connection, match.allowed);
+            break;
+        case ROUTE_NOT_FOUND:
+        default:
+            ret = queue_not_found(connection);
+            break;
     }
     
-    // Handle DeepSeek chat page
-    if (strcmp(url, "/deepseek-chat") == 0 || strcmp(url, "/deepseek-chat/") == 0) {
-        char *chat_html = load_template("deepseek_chat.html");
-        
-        response = MHD_create_response_from_buffer(
-            strlen(chat_html),
-            chat_html,
-            MHD_RESPMEM_MUST_FREE
-        );
-        MHD_add_response_header(response, "Content-Type", "text/html");
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        return ret;
+    // A chat request waiting for the AI is answered in a later call
+    int waiting = *con_cls != &request_marker && ((struct PostConnectionData*)*con_cls)->suspended;
+    if (last_call && !waiting) {
+        metrics_observe(route_latency[route], metrics_now_us() - started);
     }
+    return ret;
+}
+
+// Called by MHD once a request is finished, including aborted uploads and
+// closed connections: give the request's arena back to the pool
+static void request_completed(void* cls, struct MHD_Connection* connection,
+                              void** con_cls, enum MHD_RequestTerminationCode toe) {
+    (void)cls; (void)connection; (void)toe;
     
-    // Handle static files (CSS, JS, images)
-    if (strstr(url, ".css") || strstr(url, ".js") || 
-        strstr(url, ".png") || strstr(url, ".jpg") || strstr(url, ".ico")) {
-        
-        char file_path[512];
-        snprintf(file_path, sizeof(file_path), "%s%s", STATIC_DIR, url + 1); // Skip leading /
-        
-        printf("Trying to serve file: %s\n", file_path);
-        
-        FILE* file = fopen(file_path, "rb");
-        if (file == NULL) {
-            printf("File not found: %s\n", file_path);
-            const char* not_found = "<html><body><h1>404 Not Found</h1></body></html>";
-            response = MHD_create_response_from_buffer(strlen(not_found),
-                                                     (void*)not_found,
-                                                     MHD_RESPMEM_PERSISTENT);
-            ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-            MHD_destroy_response(response);
-            return ret;
-        }
-        
-        // Get file size
-        fseek(file, 0, SEEK_END);
-        long file_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        
-        // Read the file
-        char* buffer = malloc(file_size);
-        if (buffer == NULL) {
-            fclose(file);
-            return MHD_NO;
-        }
-        
-        fread(buffer, 1, file_size, file);
-        fclose(file);
-        
-        // Create response
-        printf("Serving file: %s, size: %ld bytes, Content-Type: %s\n", 
-               file_path, file_size, get_content_type(url));
-        response = MHD_create_response_from_buffer(file_size, buffer, MHD_RESPMEM_MUST_FREE);
-        MHD_add_response_header(response, "Content-Type", get_content_type(url));
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        return ret;
+    if (*con_cls != NULL && *con_cls != &request_marker) {
+        struct PostConnectionData *post_data = *con_cls;
+        free(post_data->ai_response);   // Left if the client went away after the AI answered
+        free(post_data->demo_output.data);
+        free_chat_prompt(&post_data->chat);
+        arena_release(post_data->arena);
     }
+    *con_cls = NULL;
+}
+
+// Called by MHD when a connection is opened and closed
+static void connection_changed(void* cls, struct MHD_Connection* connection,
+                               void** socket_context, enum MHD_ConnectionNotificationCode toe) {
+    (void)cls; (void)connection; (void)socket_context;
     
-    // Handle API endpoint for running a demo
-    if (strncmp(url, "/run/", 5) == 0) {
-        const char* demo_name = url + 5; // Skip "/run/"
-        
-        // Find the requested demo
-        for (int i = 0; demos[i].name != NULL; i++) {
-            if (strcmp(demo_name, demos[i].name) == 0) {
-                printf("Running demo: %s\n", demo_name);
-                
-                // Run the demo and capture output
-                char* output = capture_demo_output(demos[i].function);
-                
-                // Log output size
-                size_t output_len = strlen(output);
-                printf("Captured %zu bytes of output\n", output_len);
-                
-                // Create JSON response
-                size_t json_size = output_len + 100; // Add extra space for JSON format
-                char* json = malloc(json_size);
-                
-                if (json == NULL) {
-                    free(output);
-                    return MHD_NO;
-                }
-                
-                snprintf(json, json_size, "{\"status\":\"success\",\"output\":\"%s\"}", output);
-                free(output);
-                
-                response = MHD_create_response_from_buffer(strlen(json), json, MHD_RESPMEM_MUST_FREE);
-                MHD_add_response_header(response, "Content-Type", "application/json");
-                MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
-                ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-                MHD_destroy_response(response);
-                
-                printf("Response sent\n");
-                return ret;
-            }
-        }
-        
-        printf("Demo not found: %s\n", demo_name);
-        
-        // Demo not found
-        const char* error = "{\"status\":\"error\",\"message\":\"Demo not found\"}";
-        response = MHD_create_response_from_buffer(strlen(error),
-                                                 (void*)error,
-                                                 MHD_RESPMEM_PERSISTENT);
-        MHD_add_response_header(response, "Content-Type", "application/json");
-        ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-        MHD_destroy_response(response);
-        return ret;
+    if (toe == MHD_CONNECTION_NOTIFY_STARTED) {
+        metrics_add(connections_in_flight, 1);
+        metrics_add(connections_total, 1);
+    } else if (toe == MHD_CONNECTION_NOTIFY_CLOSED) {
+        metrics_add(connections_in_flight, -1);
     }
-    
-    // Main page - generate HTML
-    if (strcmp(url, "/") == 0 || strcmp(url, "/index.html") == 0) {
-        printf("Generating main page HTML\n");
-        char* page_content = generate_demo_html();
-        
-        response = MHD_create_response_from_buffer(strlen(page_content),
-                                                (void*)page_content,
-                                                MHD_RESPMEM_MUST_FREE);
-        MHD_add_response_header(response, "Content-Type", "text/html");
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        
-        return ret;
+}
+
+// Values owned by other modules, read when /metrics is scraped
+enum {
+    STAT_ARENAS_IN_USE,
+    STAT_ARENA_BLOCKS_IN_USE,
+    STAT_ARENA_BLOCKS_FREE,
+    STAT_ARENA_LIMIT_FAILURES,
+    STAT_LOG_LINES_WRITTEN,
+    STAT_LOG_MESSAGES_DROPPED,
+    STAT_CHAT_REQUESTS_PENDING,
+    STAT_PROJECT_INDEX_EPOCH,
+    STAT_AI_CACHE_MEMORY_HITS,
+    STAT_AI_CACHE_DISK_HITS,
+    STAT_AI_CACHE_MISSES,
+    STAT_AI_CACHE_BYPASSES,
+    STAT_AI_CACHE_ENTRIES,
+    STAT_AI_CACHE_DISK_ENTRIES,
+    STAT_DEEPSEEK_CALLS,
+    STAT_DEEPSEEK_COALESCED,
+    STAT_DEEPSEEK_CONNECTIONS_OPENED,
+    STAT_DEEPSEEK_CONNECTIONS_REUSED,
+};
+
+static double read_demo_cache_counter(void* ctx) {
+    pthread_mutex_lock(&demo_results_lock);
+    unsigned long value = *(unsigned long*)ctx;
+    pthread_mutex_unlock(&demo_results_lock);
+    return value;
+}
+
+static double read_server_stat(void* ctx) {
+    arena_pool_stats_t arenas = {0, 0, 0, 0};
+    logger_stats_t log = {0, 0};
+    ai_cache_stats_t replies;
+    ai_call_stats_t calls;
+    if (request_arenas != NULL) {
+        arena_pool_get_stats(request_arenas, &arenas);
     }
+    logger_get_stats(&log);
+    ai_cache_get_stats(&replies);
+    ai_get_call_stats(&calls);
     
-    // Not found
-    const char* not_found = "<html><body><h1>404 Not Found</h1></body></html>";
-    response = MHD_create_response_from_buffer(strlen(not_found),
-                                            (void*)not_found,
-                                            MHD_RESPMEM_PERSISTENT);
-    ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-    MHD_destroy_response(response);
-    return ret;
+    switch ((intptr_t)ctx) {
+        case STAT_ARENAS_IN_USE: return arenas.arenas_in_use;
+        case STAT_ARENA_BLOCKS_IN_USE: return arenas.blocks_in_use;
+        case STAT_ARENA_BLOCKS_FREE: return arenas.blocks_free;
+        case STAT_ARENA_LIMIT_FAILURES: return arenas.limit_failures;
+        case STAT_LOG_LINES_WRITTEN: return log.written;
+        case STAT_LOG_MESSAGES_DROPPED: return log.dropped;
+        case STAT_CHAT_REQUESTS_PENDING: return ai_workers != NULL ? work_queue_pending(ai_workers) : 0;
+        case STAT_PROJECT_INDEX_EPOCH: return project_index_epoch();
+        case STAT_AI_CACHE_MEMORY_HITS: return replies.memory_hits;
+        case STAT_AI_CACHE_DISK_HITS: return replies.disk_hits;
+        case STAT_AI_CACHE_MISSES: return replies.misses;
+        case STAT_AI_CACHE_BYPASSES: return replies.bypasses;
+        case STAT_AI_CACHE_ENTRIES: return replies.entries;
+        case STAT_AI_CACHE_DISK_ENTRIES: return replies.disk_entries;
+        case STAT_DEEPSEEK_CALLS: return calls.calls;
+        case STAT_DEEPSEEK_COALESCED: return calls.coalesced;
+        case STAT_DEEPSEEK_CONNECTIONS_OPENED: return calls.connections_opened;
+        case STAT_DEEPSEEK_CONNECTIONS_REUSED: return calls.connections_reused;
+    }
+    return 0;
 }
 
-// Extract JSON value from a key
-char* extract_json_value(const char* json, const char* key) {
-    // Simple JSON parser (for production, use a proper JSON library)
-    char search_key[256];
-    snprintf(search_key, sizeof(search_key), "\"%s\":\"", key);
+// Register every series served on /metrics; series cannot be removed, so
+// this only runs for the first server started
+static void register_metrics(void) {
+    static int registered = 0;
+    if (registered) {
+        return;
+    }
+    registered = 1;
     
-    char* start = strstr(json, search_key);
-    if (start == NULL) {
+    for (int i = 0; i <= ROUTE_ID_COUNT; i++) {
+        route_latency[i] = metrics_register(METRIC_HISTOGRAM, "http_request_duration_seconds", route_labels[i],
+                                            "Time from the request headers to the response being queued");
+    }
+    connections_in_flight = metrics_register(METRIC_GAUGE, "http_connections_in_flight", NULL,
+                                             "Connections currently open");
+    connections_total = metrics_register(METRIC_COUNTER, "http_connections_total", NULL,
+                                         "Connections accepted");
+    demo_spawn_zygote = metrics_register(METRIC_HISTOGRAM, "demo_spawn_duration_seconds", "method=\"zygote\"",
+                                         "Time to start a demo process, after a demo slot was free");
+    demo_spawn_fork = metrics_register(METRIC_HISTOGRAM, "demo_spawn_duration_seconds", "method=\"fork\"",
+                                       "Time to start a demo process, after a demo slot was free");
+    demo_bytes_run = metrics_register(METRIC_COUNTER, "demo_output_bytes_total", "endpoint=\"run\"",
+                                      "Demo output read from demo processes");
+    demo_bytes_stream = metrics_register(METRIC_COUNTER, "demo_output_bytes_total", "endpoint=\"stream\"",
+                                         "Demo output read from demo processes");
+    metrics_register_read(METRIC_COUNTER, "demo_cache_hits_total", NULL, "Demo runs answered from the result cache",
+                          read_demo_cache_counter, &demo_cache_hits);
+    metrics_register_read(METRIC_COUNTER, "demo_cache_misses_total", NULL, "Cacheable demo runs that had to run",
+                          read_demo_cache_counter, &demo_cache_misses);
+    deepseek_latency = metrics_register(METRIC_HISTOGRAM, "deepseek_request_duration_seconds", NULL,
+                                        "Duration of DeepSeek API calls");
+    deepseek_first_token = metrics_register(METRIC_HISTOGRAM, "deepseek_first_token_seconds", NULL,
+                                            "Time from a streamed chat request being queued to its first token");
+    deepseek_cache_hit_tokens = metrics_register(METRIC_COUNTER, "deepseek_prompt_tokens_total", "cache=\"hit\"",
+                                                 "Prompt tokens billed by DeepSeek, by context cache outcome");
+    deepseek_cache_miss_tokens = metrics_register(METRIC_COUNTER, "deepseek_prompt_tokens_total", "cache=\"miss\"",
+                                                  "Prompt tokens billed by DeepSeek, by context cache outcome");
+    deepseek_completion_tokens = metrics_register(METRIC_COUNTER, "deepseek_completion_tokens_total", NULL,
+                                                  "Completion tokens billed by DeepSeek");
+    metrics_register_read(METRIC_GAUGE, "chat_requests_pending", NULL,
+                          "Chat requests waiting for or running on an AI worker",
+                          read_server_stat, (void*)(intptr_t)STAT_CHAT_REQUESTS_PENDING);
+    metrics_register_read(METRIC_COUNTER, "deepseek_calls_total", NULL, "Calls sent to the DeepSeek API",
+                          read_server_stat, (void*)(intptr_t)STAT_DEEPSEEK_CALLS);
+    metrics_register_read(METRIC_COUNTER, "deepseek_coalesced_requests_total", NULL,
+                          "Chat requests that shared an identical DeepSeek call already in progress",
+                          read_server_stat, (void*)(intptr_t)STAT_DEEPSEEK_COALESCED);
+    metrics_register_read(METRIC_COUNTER, "deepseek_connections_total", "connection=\"new\"",
+                          "DeepSeek calls by whether they opened a connection or reused an idle one",
+                          read_server_stat, (void*)(intptr_t)STAT_DEEPSEEK_CONNECTIONS_OPENED);
+    metrics_register_read(METRIC_COUNTER, "deepseek_connections_total", "connection=\"reused\"",
+                          "DeepSeek calls by whether they opened a connection or reused an idle one",
+                          read_server_stat, (void*)(intptr_t)STAT_DEEPSEEK_CONNECTIONS_REUSED);
+    metrics_register_read(METRIC_COUNTER, "ai_cache_lookups_total", "result=\"memory_hit\"",
+                          "Chat requests checked against the AI response cache",
+                          read_server_stat, (void*)(intptr_t)STAT_AI_CACHE_MEMORY_HITS);
+    metrics_register_read(METRIC_COUNTER, "ai_cache_lookups_total", "result=\"disk_hit\"",
+                          "Chat requests checked against the AI response cache",
+                          read_server_stat, (void*)(intptr_t)STAT_AI_CACHE_DISK_HITS);
+    metrics_register_read(METRIC_COUNTER, "ai_cache_lookups_total", "result=\"miss\"",
+                          "Chat requests checked against the AI response cache",
+                          read_server_stat, (void*)(intptr_t)STAT_AI_CACHE_MISSES);
+    metrics_register_read(METRIC_COUNTER, "ai_cache_lookups_total", "result=\"bypass\"",
+                          "Chat requests checked against the AI response cache",
+                          read_server_stat, (void*)(intptr_t)STAT_AI_CACHE_BYPASSES);
+    metrics_register_read(METRIC_GAUGE, "ai_cache_entries", "tier=\"memory\"", "Responses in the AI response cache",
+                          read_server_stat, (void*)(intptr_t)STAT_AI_CACHE_ENTRIES);
+    metrics_register_read(METRIC_GAUGE, "ai_cache_entries", "tier=\"disk\"", "Responses in the AI response cache",
+                          read_server_stat, (void*)(intptr_t)STAT_AI_CACHE_DISK_ENTRIES);
+    metrics_register_read(METRIC_GAUGE, "project_index_epoch", NULL, "Snapshots of the project index published",
+                          read_server_stat, (void*)(intptr_t)STAT_PROJECT_INDEX_EPOCH);
+    metrics_register_read(METRIC_GAUGE, "request_arenas_in_use", NULL, "Request arenas currently acquired",
+                          read_server_stat, (void*)(intptr_t)STAT_ARENAS_IN_USE);
+    metrics_register_read(METRIC_GAUGE, "request_arena_blocks", "state=\"in_use\"", "Pooled request arena blocks",
+                          read_server_stat, (void*)(intptr_t)STAT_ARENA_BLOCKS_IN_USE);
+    metrics_register_read(METRIC_GAUGE, "request_arena_blocks", "state=\"free\"", "Pooled request arena blocks",
+                          read_server_stat, (void*)(intptr_t)STAT_ARENA_BLOCKS_FREE);
+    metrics_register_read(METRIC_COUNTER, "request_arena_limit_failures_total", NULL,
+                          "Allocations refused by the per-request memory limit",
+                          read_server_stat, (void*)(intptr_t)STAT_ARENA_LIMIT_FAILURES);
+    metrics_register_read(METRIC_COUNTER, "log_lines_written_total", NULL, "Log lines written",
+                          read_server_stat, (void*)(intptr_t)STAT_LOG_LINES_WRITTEN);
+    metrics_register_read(METRIC_COUNTER, "log_messages_dropped_total", NULL, "Log messages lost to full rings",
+                          read_server_stat, (void*)(intptr_t)STAT_LOG_MESSAGES_DROPPED);
+}
+
+// Build the route table: static pages and APIs, one literal route per demo,
+// and the static file fallback
+static router_t* build_routes(void) {
+    router_t* router = router_create();
+    if (router == NULL) {
         return NULL;
     }
     
-    start += strlen(search_key);
-    char* end = strchr(start, '"');
-    if (end == NULL) {
-        return NULL;
+    int failed = 0;
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/", ROUTE_ID_INDEX, NULL);
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/index.html", ROUTE_ID_INDEX, NULL);
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/deepseek-chat", ROUTE_ID_CHAT_PAGE, NULL);
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/deepseek-chat/", ROUTE_ID_CHAT_PAGE, NULL);
+    failed |= router_add(router, ROUTE_POST, "/api/chat", ROUTE_ID_CHAT_API, NULL);
+    failed |= router_add(router, ROUTE_OPTIONS, "/api/chat", ROUTE_ID_PREFLIGHT, NULL);
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/api/project-context", ROUTE_ID_PROJECT_CONTEXT, NULL);
+    failed |= router_add(router, ROUTE_OPTIONS, "/api/project-context", ROUTE_ID_PREFLIGHT, NULL);
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/api/demo-cache", ROUTE_ID_DEMO_CACHE_STATS, NULL);
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/metrics", ROUTE_ID_METRICS, NULL);
+    
+    char pattern[256];
+    for (int i = 0; demos[i].name != NULL; i++) {
+        snprintf(pattern, sizeof(pattern), "/run/%s", demos[i].name);
+        failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, pattern, ROUTE_ID_RUN_DEMO, &demos[i]);
+        failed |= router_add(router, ROUTE_OPTIONS, pattern, ROUTE_ID_PREFLIGHT, NULL);
+        snprintf(pattern, sizeof(pattern), "/stream/%s", demos[i].name);
+        failed |= router_add(router, ROUTE_GET, pattern, ROUTE_ID_STREAM_DEMO, &demos[i]);
     }
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/run/:demo", ROUTE_ID_UNKNOWN_DEMO, NULL);
+    failed |= router_add(router, ROUTE_GET, "/stream/:demo", ROUTE_ID_UNKNOWN_DEMO, NULL);
+    failed |= router_add(router, ROUTE_GET | ROUTE_HEAD, "/*path", ROUTE_ID_STATIC, NULL);
     
-    size_t len = end - start;
-    char* value = malloc(len + 1);
-    if (value == NULL) {
+    if (failed) {
+        router_free(router);
         return NULL;
     }
-    
-    strncpy(value, start, len);
-    value[len] = '\0';
-    return value;
+    return router;
 }
 
-// Create a JSON response
-char* create_json_response(const char* message) {
-    // Escape special characters in message
-    size_t message_len = strlen(message);
-    size_t json_size = message_len * 2 + 100; // Allow extra space for escaping and JSON format
+// Main page
+static int handle_index_page(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                             const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)match; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    return queue_cached_page(connection, PAGE_INDEX);
+}
+
+// DeepSeek chat page
+static int handle_chat_page(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                            const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)match; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    return queue_cached_page(connection, PAGE_CHAT);
+}
+
+// Answer a chat request with {"error": message}; the rest of the body is ignored
+static int queue_chat_error(struct MHD_Connection* connection, void** con_cls,
+                            unsigned int status_code, const char* message) {
+    struct PostConnectionData *post_data = *con_cls;
+    post_data->answered = 1;
     
-    char* json = malloc(json_size);
+    size_t json_len;
+    char* json = json_wrap_string("{\"error\":\"", message, strlen(message), "\"}", &json_len);
     if (json == NULL) {
-        return NULL;
-    }
-    
-    // Start with JSON opening
-    strcpy(json, "{\"response\":\"");
-    
-    // Copy and escape message
-    size_t pos = strlen(json);
-    for (size_t i = 0; i < message_len; i++) {
-        char c = message[i];
-        if (c == '"' || c == '\\' || c == '\n' || c == '\r') {
-            json[pos++] = '\\';
-            if (c == '\n') {
-                json[pos++] = 'n';
-            } else if (c == '\r') {
-                json[pos++] = 'r';
-            } else {
-                json[pos++] = c;
-            }
-        } else {
-            json[pos++] = c;
-        }
-        
-        // Check if we're about to overflow
-        if (pos >= json_size - 10) {
-            json_size *= 2;
-            char* new_json = realloc(json, json_size);
-            if (new_json == NULL) {
-                free(json);
-                return NULL;
-            }
-            json = new_json;
-        }
+        return MHD_NO;
     }
     
-    // Add JSON closing
-    strcpy(json + pos, "\"}");
-    
-    return json;
+    struct MHD_Response* response = MHD_create_response_from_buffer(json_len, json, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    int ret = MHD_queue_response(connection, status_code, response);
+    MHD_destroy_response(response);
+    return ret;
 }
 
-// Process an AI request using DeepSeek
-char* process_ai_request(const char* message) {
-    // Check if we have project context
-    pthread_mutex_lock(&context_mutex);
-    char *prompt;
+// POST /api/chat - parse the body as it arrives, then ask the AI
+static int handle_chat_api(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                           const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)match;
+    struct PostConnectionData *post_data = *con_cls;
     
-    if (project_context != NULL) {
-        // Combine project context with user message
-        size_t prompt_size = strlen(message) + strlen(project_context) + 200;
-        prompt = malloc(prompt_size);
-        if (prompt != NULL) {
-            snprintf(prompt, prompt_size, 
-                "You are an AI assistant helping with a C programming project. "
-                "Here's the context about the project structure:\n\n%s\n\n"
-                "User question: %s", 
-                project_context, message);
-        } else {
-            prompt = strdup(message);
-        }
-    } else {
-        prompt = strdup(message);
+    // An error was already queued: drop whatever is still being uploaded
+    if (post_data->answered) {
+        *upload_data_size = 0;
+        return MHD_YES;
     }
-    pthread_mutex_unlock(&context_mutex);
     
-    if (prompt == NULL) {
-        return strdup("Error creating prompt");
+    // Resumed by the AI worker: send its reply
+    if (post_data->suspended) {
+        post_data->suspended = 0;
+        return queue_chat_reply(connection, con_cls);
     }
     
-    // Call DeepSeek API
-    char *response = ai_generate_text(prompt, NULL);
-    
-    // Check if the AI failed and try to reinitialize
-    if (response == NULL || strstr(response, "AI not initialized") != NULL) {
-        // Attempt to reinitialize the AI
-        printf("AI appears to be uninitialized. Attempting to reinitialize...\n");
+    // Check the headers before reading any of the body
+    if (post_data->json == NULL) {
+        const char *content_type = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Content-Type");
+        const char *content_length = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Content-Length");
         
-        // Free existing error response if any
-        if (response) {
-            free(response);
-            response = NULL;
+        if (content_type == NULL || strstr(content_type, "application/json") == NULL) {
+            return queue_chat_error(connection, con_cls, MHD_HTTP_UNSUPPORTED_MEDIA_TYPE,
+                                    "Expected an application/json body");
+        }
+        if (content_length != NULL && strtoull(content_length, NULL, 10) > CHAT_BODY_LIMIT) {
+            return queue_chat_error(connection, con_cls, MHD_HTTP_PAYLOAD_TOO_LARGE,
+                                    json_stream_strerror(JSON_STREAM_ERROR_SIZE));
         }
         
-        // Try to initialize the AI
-        if (ai_init_from_env_file(NULL)) {
-            printf("AI successfully reinitialized. Retrying request...\n");
-            // Retry the request
-            response = ai_generate_text(prompt, NULL);
-        } else {
-            printf("AI reinitialization failed\n");
-            response = strdup("The AI system could not be initialized. Please check your API key configuration.");
+        // The tokenizer and the captured fields live in the request's arena
+        post_data->json = json_stream_create(post_data->arena, chat_fields, CHAT_BODY_LIMIT, CHAT_JSON_MAX_DEPTH);
+        if (post_data->json == NULL) {
+            return queue_chat_error(connection, con_cls, MHD_HTTP_PAYLOAD_TOO_LARGE,
+                                    json_stream_strerror(JSON_STREAM_ERROR_MEMORY));
         }
     }
     
-    free(prompt);
-    
-    // If still null, provide a fallback response
-    if (response == NULL) {
-        return strdup("Error processing request. The AI service might be unavailable.");
+    // Tokenize each chunk as it arrives; only the fields we need are kept
+    if (*upload_data_size != 0) {
+        json_stream_status_t status = json_stream_feed(post_data->json, upload_data, *upload_data_size);
+        *upload_data_size = 0;
+        
+        // Answer as soon as the body is known to be bad, without reading the rest
+        if (status != JSON_STREAM_OK) {
+            int too_large = status == JSON_STREAM_ERROR_SIZE || status == JSON_STREAM_ERROR_MEMORY;
+            return queue_chat_error(connection, con_cls,
+                                    too_large ? MHD_HTTP_PAYLOAD_TOO_LARGE : MHD_HTTP_BAD_REQUEST,
+                                    json_stream_strerror(status));
+        }
+        return MHD_YES;
     }
     
-    return response;
-}
-
-// Scan project directory and generate context
-char* generate_project_context() {
-    // Buffer to store project structure
-    size_t buffer_size = 65536;  // Start with 64KB
-    char *buffer = malloc(buffer_size);
-    if (buffer == NULL) {
-        return NULL;
+    // No more data - the document must be complete
+    json_stream_status_t status = json_stream_finish(post_data->json);
+    if (status != JSON_STREAM_OK) {
+        return queue_chat_error(connection, con_cls, MHD_HTTP_BAD_REQUEST, json_stream_strerror(status));
     }
     
-    size_t pos = 0;
-    pos += snprintf(buffer + pos, buffer_size - pos, 
-        "Project Structure Overview:\n\n");
+    json_type_t message_type;
+    size_t message_len;
+    const char *message = json_stream_field(post_data->json, "message", &message_type, &message_len);
+    if (message_type != JSON_TYPE_STRING) {
+        return queue_chat_error(connection, con_cls, MHD_HTTP_BAD_REQUEST, "Expected a \"message\" string");
+    }
     
-    // Start scanning from the project root
-    scan_directory(".", buffer, &pos, &buffer_size, 0, 5);  // Max depth of 5
+    log_message(LOG_LEVEL_DEBUG, "Chat message: %zu bytes", message_len);
     
-    // Add some key file contents
-    pos += snprintf(buffer + pos, buffer_size - pos, 
-        "\n\nKey Files Summary:\n\n");
+    // With "stream": true the reply is relayed token by token
+    json_type_t stream_type;
+    json_stream_field(post_data->json, "stream", &stream_type, NULL);
+    int stream = stream_type == JSON_TYPE_TRUE;
     
-    // Add main.c
-    add_file_content("src/main.c", buffer, &pos, &buffer_size, 100);  // First 100 lines
+    // The prompt is built here so that a reply already in the response
+    // cache goes out at once, without waiting for an AI worker
+    if (build_chat_prompt(message, &post_data->chat) != 0) {
+        return queue_chat_error(connection, con_cls, MHD_HTTP_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+    const char* cache_request = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, AI_CACHE_HEADER);
+    if (cache_request != NULL && strcasecmp(cache_request, "bypass") == 0) {
+        ai_cache_count_bypass();
+        post_data->chat.fresh = 1;
+        post_data->cache_status = "bypass";
+    } else {
+        size_t cached_len;
+        char* cached = ai_cache_lookup(&post_data->chat.key, &cached_len, NULL);
+        if (cached != NULL) {
+            return queue_cached_chat_reply(connection, cached, cached_len, stream);
+        }
+        post_data->cache_status = "miss";
+    }
     
-    // Add syscalls.h
-    add_file_content("include/syscalls.h", buffer, &pos, &buffer_size, 50);  // First 50 lines
+    if (stream) {
+        return queue_chat_stream(connection, con_cls);
+    }
     
-    // Add ai_integration.h
-    add_file_content("include/ai_integration.h", buffer, &pos, &buffer_size, 100);  // All lines
+    // Hand the DeepSeek call to a worker and park the connection until it
+    // resumes it; this thread goes back to serving other requests. Suspend
+    // first so the worker cannot resume a connection that is not suspended.
+    post_data->connection = connection;
+    post_data->suspended = 1;
+    MHD_suspend_connection(connection);
+    if (work_queue_submit(ai_workers, run_chat_job, post_data) != 0) {
+        post_data->ai_status = MHD_HTTP_SERVICE_UNAVAILABLE;
+        MHD_resume_connection(connection);
+    }
+    return MHD_YES;
+}
+
+// AI worker job: ask DeepSeek, then wake the connection up to send the reply
+static void run_chat_job(void* arg, int cancelled) {
+    struct PostConnectionData *post_data = arg;
     
-    // Ensure buffer is null-terminated
-    if (pos < buffer_size) {
-        buffer[pos] = '\0';
+    if (cancelled) {
+        post_data->ai_status = MHD_HTTP_SERVICE_UNAVAILABLE;
+        post_data->cancelled = 1;
     } else {
-        buffer[buffer_size - 1] = '\0';
+        post_data->ai_response = process_ai_request(&post_data->chat, NULL, NULL);
+        post_data->ai_status = MHD_HTTP_OK;
     }
-    
-    return buffer;
+    MHD_resume_connection(post_data->connection);
 }
 
-// Recursively scan directory and add to context
-void scan_directory(const char *path, char *buffer, size_t *pos, size_t *buffer_size, int depth, int max_depth) {
-    if (depth > max_depth) {
-        return;
-    }
+// Answer a chat request once its AI worker has finished
+static int queue_chat_reply(struct MHD_Connection* connection, void** con_cls) {
+    struct PostConnectionData *post_data = *con_cls;
     
-    DIR *dir = opendir(path);
-    if (dir == NULL) {
-        return;
+    if (post_data->ai_status != MHD_HTTP_OK) {
+        return queue_chat_error(connection, con_cls, post_data->ai_status,
+                                post_data->cancelled ? "The server is shutting down"
+                                                     : "Too many chat requests, try again later");
     }
     
-    // Add indentation based on depth
-    char indent[32] = {0};
-    for (int i = 0; i < depth; i++) {
-        strcat(indent, "  ");
+    // Create JSON response
+    char *json_response = create_json_response(post_data->ai_response ? post_data->ai_response
+                                                                       : "Error processing request");
+    free(post_data->ai_response);
+    post_data->ai_response = NULL;
+    if (json_response == NULL) {
+        return MHD_NO;
     }
     
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip hidden files and special directories
-        if (entry->d_name[0] == '.') {
-            continue;
-        }
-        
-        // Check if we need to resize buffer
-        if (*pos + 256 > *buffer_size) {
-            *buffer_size *= 2;
-            char *new_buffer = realloc(buffer, *buffer_size);
-            if (new_buffer == NULL) {
-                closedir(dir);
-                return;
-            }
-            buffer = new_buffer;
-        }
-        
-        char full_path[1024];
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
-        
-        struct stat st;
-        if (stat(full_path, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                // Directory
-                *pos += snprintf(buffer + *pos, *buffer_size - *pos, 
-                    "%s- %s/\n", indent, entry->d_name);
-                
-                // Recursively scan subdirectory
-                scan_directory(full_path, buffer, pos, buffer_size, depth + 1, max_depth);
-            } else {
-                // File
-                *pos += snprintf(buffer + *pos, *buffer_size - *pos, 
-                    "%s- %s\n", indent, entry->d_name);
-            }
-        }
+    // Send response
+    struct MHD_Response* response = MHD_create_response_from_buffer(
+        strlen(json_response),
+        json_response,
+        MHD_RESPMEM_MUST_FREE
+    );
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    MHD_add_response_header(response, AI_CACHE_HEADER, post_data->cache_status);
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    
+    return ret;
+}
+
+// Answer a chat request from the response cache: as JSON, or as an event
+// stream that is complete from the start
+static int queue_cached_chat_reply(struct MHD_Connection* connection, char* cached, size_t len, int stream) {
+    size_t body_len;
+    char* body = stream ? json_wrap_string("data: {\"token\":\"", cached, len,
+                                           "\"}\n\ndata: {\"done\":true}\n\n", &body_len)
+                        : json_wrap_string("{\"response\":\"", cached, len, "\"}", &body_len);
+    free(cached);
+    if (body == NULL) {
+        return MHD_NO;
     }
     
-    closedir(dir);
+    struct MHD_Response* response = MHD_create_response_from_buffer(body_len, body, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(response, "Content-Type", stream ? "text/event-stream" : "application/json");
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    MHD_add_response_header(response, AI_CACHE_HEADER, "hit");
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
 }
 
-// Add file content to context buffer
-void add_file_content(const char *file_path, char *buffer, size_t *pos, size_t *buffer_size, int max_lines) {
-    FILE *file = fopen(file_path, "r");
-    if (file == NULL) {
-        *pos += snprintf(buffer + *pos, *buffer_size - *pos, 
-            "Cannot open file: %s\n", file_path);
+// A chat reply relayed to the client as server-sent events while DeepSeek
+// generates it. The AI worker appends events, the connection's content
+// reader sends them; each side drops its reference when done with it.
+typedef struct {
+    pthread_mutex_t lock;
+    struct MHD_Connection* connection;
+    chat_prompt_t chat;         // Taken over from the request, whose arena goes away with the body
+    char* data;                 // Events not yet sent
+    size_t len;
+    size_t cap;
+    size_t sent;
+    int done;                   // The worker added its last event
+    int reader_waiting;         // The reader suspended the connection until more data arrives
+    int closed;                 // The client went away
+    int streamed;               // At least one token was relayed
+    int refs;
+    uint64_t queued;            // When the job was submitted, for the first-token latency
+} chat_stream_t;
+
+static void release_chat_stream(chat_stream_t* stream) {
+    pthread_mutex_lock(&stream->lock);
+    int refs = --stream->refs;
+    pthread_mutex_unlock(&stream->lock);
+    if (refs > 0) {
         return;
     }
+    pthread_mutex_destroy(&stream->lock);
+    free_chat_prompt(&stream->chat);
+    free(stream->data);
+    free(stream);
+}
+
+// Append the event prefix + escaped text + suffix and wake the reader up if
+// it is waiting for data; returns false once the client has gone away
+static bool push_chat_event(chat_stream_t* stream, const char* prefix, const char* text, size_t text_len,
+                            const char* suffix, int last) {
+    size_t prefix_len = strlen(prefix);
+    size_t suffix_len = strlen(suffix);
+    size_t event_len = prefix_len + json_escaped_length(text, text_len) + suffix_len;
     
-    // Add file header
-    *pos += snprintf(buffer + *pos, *buffer_size - *pos, 
-        "File: %s\n```c\n", file_path);
-    
-    char line[1024];
-    int line_count = 0;
+    pthread_mutex_lock(&stream->lock);
+    if (stream->closed) {
+        pthread_mutex_unlock(&stream->lock);
+        return false;
+    }
     
-    while (fgets(line, sizeof(line), file) && line_count < max_lines) {
-        size_t line_len = strlen(line);
-        
-        // Check if we need to resize buffer
-        if (*pos + line_len + 10 > *buffer_size) {
-            *buffer_size *= 2;
-            char *new_buffer = realloc(buffer, *buffer_size);
-            if (new_buffer == NULL) {
-                fclose(file);
-                return;
-            }
-            buffer = new_buffer;
+    if (stream->len + event_len > stream->cap) {
+        size_t cap = stream->cap ? stream->cap * 2 : 1024;
+        while (cap < stream->len + event_len) {
+            cap *= 2;
+        }
+        char* data = realloc(stream->data, cap);
+        if (data == NULL) {
+            // Drop this event; the reader still sees the end of the stream
+            last = 1;
+            event_len = 0;
+        } else {
+            stream->data = data;
+            stream->cap = cap;
         }
-        
-        // Add line to buffer
-        memcpy(buffer + *pos, line, line_len);
-        *pos += line_len;
-        line_count++;
     }
-    
-    if (!feof(file)) {
-        *pos += snprintf(buffer + *pos, *buffer_size - *pos, 
-            "... (truncated, %d lines shown)\n", max_lines);
+    if (event_len > 0) {
+        char* out = stream->data + stream->len;
+        memcpy(out, prefix, prefix_len);
+        out += prefix_len;
+        out += json_escape(out, text, text_len);
+        memcpy(out, suffix, suffix_len);
+        stream->len += event_len;
+    }
+    if (last) {
+        stream->done = 1;
     }
     
-    // Add file footer
-    *pos += snprintf(buffer + *pos, *buffer_size - *pos, "```\n\n");
+    int wake = stream->reader_waiting;
+    stream->reader_waiting = 0;
+    pthread_mutex_unlock(&stream->lock);
     
-    fclose(file);
+    // The reader suspended the connection while holding the lock, so it is
+    // suspended by now
+    if (wake) {
+        MHD_resume_connection(stream->connection);
+    }
+    return true;
 }
 
-// Load a template file
-char* load_template(const char* filename) {
-    char path[512];
-    snprintf(path, sizeof(path), "%s%s", TEMPLATE_DIR, filename);
+// Token callback of the AI worker: relay each piece as its own event
+static bool on_chat_token(const char* text, size_t len, void* ctx) {
+    chat_stream_t* stream = ctx;
+    if (!stream->streamed) {
+        stream->streamed = 1;
+        metrics_observe(deepseek_first_token, metrics_now_us() - stream->queued);
+    }
+    return push_chat_event(stream, "data: {\"token\":\"", text, len, "\"}\n\n", 0);
+}
+
+// AI worker job for a streamed chat reply
+static void run_chat_stream_job(void* arg, int cancelled) {
+    chat_stream_t* stream = arg;
     
-    FILE* file = fopen(path, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open template file: %s\n", path);
-        return strdup("<!-- Template not found -->");
+    if (cancelled) {
+        const char* error = "The server is shutting down";
+        push_chat_event(stream, "data: {\"error\":\"", error, strlen(error), "\"}\n\n", 1);
+        release_chat_stream(stream);
+        return;
     }
     
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    char* response = process_ai_request(&stream->chat, on_chat_token, stream);
+    if (!stream->streamed && response != NULL) {
+        // Nothing was streamed (AI not configured, request failed): send the
+        // fallback text as a single token so the page shows it
+        on_chat_token(response, strlen(response), stream);
+    }
+    free(response);
+    
+    push_chat_event(stream, "data: {\"done\":true}\n\n", "", 0, "", 1);
+    release_chat_stream(stream);
+}
+
+// Content reader for a streamed chat reply: send the events received so far,
+// or suspend the connection until the worker adds more
+static ssize_t read_chat_stream(void* cls, uint64_t pos, char* buf, size_t max) {
+    (void)pos;
+    chat_stream_t* stream = cls;
+    
+    pthread_mutex_lock(&stream->lock);
+    size_t available = stream->len - stream->sent;
+    if (available > 0) {
+        size_t n = available < max ? available : max;
+        memcpy(buf, stream->data + stream->sent, n);
+        stream->sent += n;
+        if (stream->sent == stream->len) {
+            stream->sent = stream->len = 0;
+        }
+        pthread_mutex_unlock(&stream->lock);
+        return n;
+    }
+    if (stream->done) {
+        pthread_mutex_unlock(&stream->lock);
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+    
+    stream->reader_waiting = 1;
+    MHD_suspend_connection(stream->connection);
+    pthread_mutex_unlock(&stream->lock);
+    return 0;
+}
+
+// Free callback for a streamed chat reply; tells the worker to stop relaying
+static void free_chat_stream(void* cls) {
+    chat_stream_t* stream = cls;
+    pthread_mutex_lock(&stream->lock);
+    stream->closed = 1;
+    pthread_mutex_unlock(&stream->lock);
+    release_chat_stream(stream);
+}
+
+// Answer a chat request with an event stream fed by an AI worker; the
+// connection is only suspended while no event is waiting to be sent
+static int queue_chat_stream(struct MHD_Connection* connection, void** con_cls) {
+    struct PostConnectionData *post_data = *con_cls;
+    chat_stream_t* stream = calloc(1, sizeof(chat_stream_t));
+    if (stream == NULL) {
+        return MHD_NO;
+    }
+    stream->chat = post_data->chat;
+    memset(&post_data->chat, 0, sizeof(post_data->chat));
+    pthread_mutex_init(&stream->lock, NULL);
+    stream->connection = connection;
+    stream->refs = 1;           // Held by the response
+    
+    struct MHD_Response* response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4096,
+                                                                      &read_chat_stream, stream,
+                                                                      &free_chat_stream);
+    if (response == NULL) {
+        release_chat_stream(stream);
+        return MHD_NO;
+    }
+    
+    stream->refs++;             // Held by the job
+    stream->queued = metrics_now_us();
+    if (work_queue_submit(ai_workers, run_chat_stream_job, stream) != 0) {
+        stream->refs--;
+        MHD_destroy_response(response);
+        return queue_chat_error(connection, con_cls, MHD_HTTP_SERVICE_UNAVAILABLE,
+                                "Too many chat requests, try again later");
+    }
+    
+    MHD_add_response_header(response, "Content-Type", "text/event-stream");
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    MHD_add_response_header(response, "X-Accel-Buffering", "no");
+    MHD_add_response_header(response, AI_CACHE_HEADER, post_data->cache_status);
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// OPTIONS request for CORS preflight
+static int handle_preflight(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                            const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    char allow[64];
+    router_format_allow(match->allowed, allow, sizeof(allow));
+    
+    struct MHD_Response* response = MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    MHD_add_response_header(response, "Access-Control-Allow-Methods", allow);
+    MHD_add_response_header(response, "Access-Control-Allow-Headers", "Content-Type, " AI_CACHE_HEADER);
+    MHD_add_response_header(response, "Access-Control-Max-Age", "86400");
+    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// GET /api/project-context - include the project index in later prompts
+static int handle_project_context(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                                  const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)match; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    struct MHD_Response* response;
+    int ret;
+    char json_response[256];
+    
+    // The index is kept up to date in the background, nothing is scanned here
+    atomic_store(&project_context_enabled, 1);
+    const project_snapshot_t *snapshot = project_index_acquire();
+    if (snapshot != NULL) {
+        snprintf(json_response, sizeof(json_response),
+                 "{\"success\":true,\"files\":%zu,\"snippets\":%zu,\"tokenBudget\":%zu,\"epoch\":%llu,"
+                 "\"version\":\"%016llx\"}",
+                 snapshot->files, snapshot->snippets, context_token_budget, (unsigned long long)snapshot->epoch,
+                 (unsigned long long)snapshot->version);
+    } else {
+        snprintf(json_response, sizeof(json_response),
+                 "{\"success\":false,\"error\":\"The project index is still being built\"}");
+    }
+    project_index_release(snapshot);
+    
+    response = MHD_create_response_from_buffer(strlen(json_response), json_response, MHD_RESPMEM_MUST_COPY);
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Static files (CSS, JS, images), served straight from the in-memory cache
+static int handle_static_file(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                              const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)match; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    struct MHD_Response* response;
+    int ret;
+    
+    if (!is_static_file(url)) {
+        return queue_not_found(connection);
+    }
+    
+    const char* content_type = get_content_type(url);
+    const char* encoding = NULL;
+    const static_asset_t* asset = static_cache_acquire(url);
+    if (asset == NULL) {
+        log_message(LOG_LEVEL_INFO, "File not found: %s", url);
+        return queue_not_found(connection);
+    }
+    
+    // Prefer a precompressed variant the client accepts
+    int compressible = is_compressible(content_type);
+    if (compressible) {
+        const char* accept = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Accept-Encoding");
+        const static_asset_t* variant = acquire_precompressed(url, asset, accept, &encoding);
+        if (variant != NULL) {
+            static_cache_release(asset);
+            asset = variant;
+        }
+    }
+    
+    // The browser's copy is still current - answer from cached metadata only
+    const char* cache_control = get_cache_control(content_type);
+    if (is_not_modified(connection, asset->etag, asset->mtime)) {
+        log_message(LOG_LEVEL_DEBUG, "Not modified: %s", url);
+        response = MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
+        add_validator_headers(response, asset->etag, asset->last_modified, cache_control);
+        if (compressible) {
+            MHD_add_response_header(response, "Vary", "Accept-Encoding");
+        }
+        static_cache_release(asset);
+        ret = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+        MHD_destroy_response(response);
+        return ret;
+    }
+    
+    log_message(LOG_LEVEL_DEBUG, "Serving file: %s, size: %zu bytes, Content-Type: %s, Content-Encoding: %s",
+                url, asset->size, content_type, encoding ? encoding : "identity");
+    char etag[ETAG_SIZE];
+    char last_modified[HTTP_DATE_SIZE];
+    memcpy(etag, asset->etag, sizeof(etag));
+    memcpy(last_modified, asset->last_modified, sizeof(last_modified));
+    response = create_asset_response(asset);
+    if (response == NULL) {
+        return MHD_NO;
+    }
+    MHD_add_response_header(response, "Content-Type", content_type);
+    add_validator_headers(response, etag, last_modified, cache_control);
+    if (encoding != NULL) {
+        MHD_add_response_header(response, "Content-Encoding", encoding);
+    }
+    if (compressible) {
+        MHD_add_response_header(response, "Vary", "Accept-Encoding");
+    }
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// GET /run/<demo> - the route context is the demo to run. The demo runs on
+// a demo worker while the connection is suspended; the worker resumes it
+// once the output is captured.
+static int handle_run_demo(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                           const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)upload_data; (void)upload_data_size;
+    const demo_info_t* demo = match->ctx;
+    int ret;
+    
+    // Resumed by the demo worker: send the output
+    if (*con_cls != &request_marker) {
+        struct PostConnectionData* state = *con_cls;
+        state->suspended = 0;
+        return queue_demo_result(connection, state);
+    }
+    
+    // Deterministic demos are answered from their last run while it is fresh
+    if (queue_cached_demo_result(connection, demo, 0, &ret)) {
+        log_message(LOG_LEVEL_DEBUG, "Cached result: %s", demo->name);
+        return ret;
+    }
+    
+    struct PostConnectionData* state = create_request_state();
+    if (state == NULL) {
+        return MHD_NO;
+    }
+    state->connection = connection;
+    state->demo = demo;
+    *con_cls = state;
+    
+    log_message(LOG_LEVEL_DEBUG, "Running demo: %s", demo->name);
+    
+    // Suspend first so the worker cannot resume a connection that is not suspended
+    state->suspended = 1;
+    MHD_suspend_connection(connection);
+    if (work_queue_submit(demo_workers, run_demo_job, state) != 0) {
+        state->demo_status = MHD_HTTP_SERVICE_UNAVAILABLE;
+        MHD_resume_connection(connection);
+    }
+    return MHD_YES;
+}
+
+// Demo worker job: run the demo and capture its output, then wake the
+// connection up to send it
+static void run_demo_job(void* arg, int cancelled) {
+    struct PostConnectionData* state = arg;
+    
+    if (cancelled) {
+        state->demo_status = MHD_HTTP_SERVICE_UNAVAILABLE;
+        state->cancelled = 1;
+    } else if (capture_demo_output(state->demo, &state->demo_output) != 0) {
+        state->demo_status = MHD_HTTP_INTERNAL_SERVER_ERROR;
+    } else {
+        state->demo_status = MHD_HTTP_OK;
+    }
+    MHD_resume_connection(state->connection);
+}
+
+// Answer a /run request once its demo worker has finished
+static int queue_demo_result(struct MHD_Connection* connection, struct PostConnectionData* state) {
+    const demo_info_t* demo = state->demo;
+    struct MHD_Response* response;
+    int ret;
+    
+    if (state->demo_status != MHD_HTTP_OK) {
+        const char* error = "{\"status\":\"error\",\"message\":\"Could not run demo\"}";
+        if (state->cancelled) {
+            error = "{\"status\":\"error\",\"message\":\"The server is shutting down\"}";
+        } else if (state->demo_status == MHD_HTTP_SERVICE_UNAVAILABLE) {
+            error = "{\"status\":\"error\",\"message\":\"Too many demo runs, try again later\"}";
+        }
+        response = MHD_create_response_from_buffer(strlen(error), (void*)error, MHD_RESPMEM_PERSISTENT);
+        MHD_add_response_header(response, "Content-Type", "application/json");
+        ret = MHD_queue_response(connection, state->demo_status, response);
+        MHD_destroy_response(response);
+        return ret;
+    }
+    
+    // Log output size
+    demo_output_t* output = &state->demo_output;
+    log_message(LOG_LEVEL_DEBUG, "Captured %zu bytes of output%s", output->size, output->truncated ? " (truncated)" : "");
+    
+    response = create_demo_json_response(output->data, output->size, output->truncated);
+    if (response == NULL) {
+        return MHD_NO;
+    }
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    if (demo->cache_policy != DEMO_CACHE_NEVER) {
+        // Keeps our reference
+        store_demo_result(demo, response, output->data, output->size, output->truncated);
+    } else {
+        MHD_destroy_response(response);
+    }
+    free(output->data);
+    output->data = NULL;
+    
+    return ret;
+}
+
+// GET /api/demo-cache - hit and miss counters of the demo result cache
+static int handle_demo_cache_stats(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                                   const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)match; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    char json[128];
+    size_t entries = 0;
+    
+    pthread_mutex_lock(&demo_results_lock);
+    for (size_t i = 0; demos[i].name != NULL; i++) {
+        if (demo_results[i].response != NULL) {
+            entries++;
+        }
+    }
+    snprintf(json, sizeof(json), "{\"hits\":%lu,\"misses\":%lu,\"entries\":%zu}",
+             demo_cache_hits, demo_cache_misses, entries);
+    pthread_mutex_unlock(&demo_results_lock);
+    
+    struct MHD_Response* response = MHD_create_response_from_buffer(strlen(json), json, MHD_RESPMEM_MUST_COPY);
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// GET /metrics - counters and latency histograms in the Prometheus text format
+static int handle_metrics(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                          const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)match; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    size_t len;
+    char* text = metrics_render(&len);
+    if (text == NULL) {
+        return MHD_NO;
+    }
+    
+    struct MHD_Response* response = MHD_create_response_from_buffer(len, text, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(response, "Content-Type", "text/plain; version=0.0.4");
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// GET /stream/<demo> - forward the demo's output with chunked encoding as it
+// is produced; the response ends when the demo exits. Deterministic demos
+// are answered from the result cache in one piece while it is fresh.
+static int handle_stream_demo(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                              const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    const demo_info_t* demo = match->ctx;
+    int ret;
+    
+    if (queue_cached_demo_result(connection, demo, 1, &ret)) {
+        log_message(LOG_LEVEL_DEBUG, "Cached result: %s", demo->name);
+        return ret;
+    }
+    
+    demo_stream_t* stream = calloc(1, sizeof(demo_stream_t));
+    if (stream == NULL) {
+        return MHD_NO;
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    stream->connection = connection;
+    stream->demo = demo;
+    stream->refs = 1;           // Held by the response
+    
+    struct MHD_Response* response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4096,
+                                                                      &read_demo_stream, stream,
+                                                                      &free_demo_stream);
+    if (response == NULL) {
+        release_demo_stream(stream);
+        return MHD_NO;
+    }
+    
+    // The demo runs on a demo worker, which waits for a free slot there
+    stream->refs++;             // Held by the job
+    if (work_queue_submit(demo_workers, run_demo_stream_job, stream) != 0) {
+        stream->refs--;
+        MHD_destroy_response(response);
+        const char* error = "Too many demo runs, try again later\n";
+        response = MHD_create_response_from_buffer(strlen(error), (void*)error, MHD_RESPMEM_PERSISTENT);
+        MHD_add_response_header(response, "Content-Type", "text/plain; charset=utf-8");
+        ret = MHD_queue_response(connection, MHD_HTTP_SERVICE_UNAVAILABLE, response);
+        MHD_destroy_response(response);
+        return ret;
+    }
+    
+    log_message(LOG_LEVEL_DEBUG, "Streaming demo: %s", demo->name);
+    
+    add_demo_stream_headers(response);
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// GET /run/<name> or /stream/<name> for a name that is not in demos[]
+static int handle_unknown_demo(struct MHD_Connection* connection, const char* url, const route_match_t* match,
+                               const char* upload_data, size_t* upload_data_size, void** con_cls) {
+    (void)url; (void)upload_data; (void)upload_data_size; (void)con_cls;
+    size_t name_len = 0;
+    const char* name = route_param(match, "demo", &name_len);
+    log_message(LOG_LEVEL_INFO, "Demo not found: %.*s", (int)name_len, name ? name : "");
+    
+    const char* error = "{\"status\":\"error\",\"message\":\"Demo not found\"}";
+    struct MHD_Response* response = MHD_create_response_from_buffer(strlen(error),
+                                                                   (void*)error,
+                                                                   MHD_RESPMEM_PERSISTENT);
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    int ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// 404 Not Found
+static int queue_not_found(struct MHD_Connection* connection) {
+    const char* not_found = "<html><body><h1>404 Not Found</h1></body></html>";
+    struct MHD_Response* response = MHD_create_response_from_buffer(strlen(not_found),
+                                                                   (void*)not_found,
+                                                                   MHD_RESPMEM_PERSISTENT);
+    int ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// 405 Method Not Allowed, listing the methods the path does accept
+static int queue_method_not_allowed(struct MHD_Connection* connection, unsigned allowed) {
+    const char* message = "<html><body><h1>405 Method Not Allowed</h1></body></html>";
+    char allow[64];
+    router_format_allow(allowed, allow, sizeof(allow));
+    
+    struct MHD_Response* response = MHD_create_response_from_buffer(strlen(message),
+                                                                   (void*)message,
+                                                                   MHD_RESPMEM_PERSISTENT);
+    MHD_add_response_header(response, "Allow", allow);
+    int ret = MHD_queue_response(connection, MHD_HTTP_METHOD_NOT_ALLOWED, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Check whether the last path segment has one of the static file extensions
+static int is_static_file(const char* url) {
+    static const char* const extensions[] = {".css", ".js", ".png", ".jpg", ".jpeg", ".gif", ".ico"};
+    const char* ext = strrchr(url, '.');
+    if (ext == NULL || strchr(ext, '/') != NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strcmp(ext, extensions[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Create a JSON response
+char* create_json_response(const char* message) {
+    return json_wrap_string("{\"response\":\"", message, strlen(message), "\"}", NULL);
+}
+
+// Count the tokens DeepSeek reported for a call
+static void record_usage(const ai_usage_t* usage) {
+    if (!usage->reported) {
+        return;
+    }
+    metrics_add(deepseek_cache_hit_tokens, (int64_t)usage->cache_hit_tokens);
+    metrics_add(deepseek_cache_miss_tokens, (int64_t)usage->cache_miss_tokens);
+    metrics_add(deepseek_completion_tokens, (int64_t)usage->completion_tokens);
+    log_message(LOG_LEVEL_DEBUG, "DeepSeek usage: %llu prompt tokens (%llu cached, %llu not), %llu completion tokens",
+                (unsigned long long)usage->prompt_tokens, (unsigned long long)usage->cache_hit_tokens,
+                (unsigned long long)usage->cache_miss_tokens, (unsigned long long)usage->completion_tokens);
+}
+
+// First message of every chat prompt; it must stay byte for byte the same
+// for DeepSeek's prefix cache to cover it
+static const char ai_system_prompt[] =
+    "You are an AI assistant helping with a C programming project. "
+    "When project context is given, base your answer on it and name the files you refer to.";
+
+// Build the prompt for a message, and its key in the response cache. The
+// prompt goes out as the fixed system message, then the directory overview
+// labelled with its version, then the question with the snippets relevant
+// to it. The first two repeat across questions, so the provider only
+// processes the last part anew. Reading the snapshot takes no lock.
+static int build_chat_prompt(const char* message, chat_prompt_t* chat) {
+    memset(chat, 0, sizeof(*chat));
+    if (atomic_load(&project_context_enabled)) {
+        const project_snapshot_t *snapshot = project_index_acquire();
+        if (snapshot != NULL) {
+            project_context_t context;
+            project_index_context(snapshot, message, context_token_budget, &context);
+
+            size_t block_size = context.overview_len + 64;
+            chat->context_block = malloc(block_size);
+            if (chat->context_block != NULL) {
+                snprintf(chat->context_block, block_size, "Project context, version %016llx:\n\n%.*s",
+                         (unsigned long long)snapshot->version, (int)context.overview_len, context.overview);
+            }
+            if (context.snippets != NULL) {
+                size_t question_size = context.snippets_len + strlen(message) + 100;
+                chat->question = malloc(question_size);
+                if (chat->question != NULL) {
+                    snprintf(chat->question, question_size,
+                             "Parts of the project relevant to the question:\n\n%s\n"
+                             "User question: %s",
+                             context.snippets, message);
+                }
+                free(context.snippets);
+            }
+        }
+        project_index_release(snapshot);
+    }
+    if (chat->question == NULL) {
+        chat->question = strdup(message);
+    }
+    if (chat->question == NULL) {
+        free_chat_prompt(chat);
+        return -1;
+    }
+    chat->prompt = (ai_prompt_t){ai_system_prompt, chat->context_block, chat->question};
+    ai_cache_key(&chat->key, AI_DEFAULT_MODEL, ai_get_temperature(), &chat->prompt);
+    return 0;
+}
+
+static void free_chat_prompt(chat_prompt_t* chat) {
+    free(chat->context_block);
+    free(chat->question);
+    chat->context_block = NULL;
+    chat->question = NULL;
+}
+
+// Token callback in front of the caller's, noting whether any text reached it
+typedef struct {
+    ai_token_callback_t on_token;
+    void* ctx;
+    int streamed;           // At least one piece was passed on; the caller may have stopped
+} token_relay_t;
+
+static bool relay_token(const char* text, size_t len, void* ctx) {
+    token_relay_t* relay = ctx;
+    relay->streamed = 1;
+    return relay->on_token(text, len, relay->ctx);
+}
+
+// Ask the AI; with a callback, the reply is also passed on piece by piece
+// as it is generated
+char* process_ai_request(const chat_prompt_t* chat, ai_token_callback_t on_token, void* ctx) {
+    const ai_prompt_t *prompt = &chat->prompt;
+    ai_usage_t usage = {0};
+    
+    // While this request waited for a worker, an identical one may have been
+    // answered. Identical requests running at the same time share one call.
+    if (!chat->fresh) {
+        size_t cached_len;
+        char *cached = ai_cache_peek(&chat->key, &cached_len);
+        if (cached != NULL) {
+            if (on_token != NULL) {
+                on_token(cached, cached_len, ctx);
+            }
+            return cached;
+        }
+    }
+    
+    // Call DeepSeek API
+    token_relay_t relay = {on_token, ctx, 0};
+    uint64_t started = metrics_now_us();
+    char *response = on_token ? ai_generate_text_stream(prompt, NULL, relay_token, &relay, &usage)
+                              : ai_generate_chat(prompt, NULL, &usage);
+    metrics_observe(deepseek_latency, metrics_now_us() - started);
+    
+    // Without a key, try to load it and ask again. A network or API error
+    // is not retried: the key is only reloaded when none is loaded. Nor is
+    // a stream that already sent text or that its caller stopped: the retry
+    // would send the reply again from its start.
+    if (response == NULL && !ai_is_initialized() && !relay.streamed) {
+        log_message(LOG_LEVEL_WARN, "AI appears to be uninitialized. Attempting to reinitialize...");
+        
+        // Try to initialize the AI
+        if (ai_init_from_env_file(NULL)) {
+            log_message(LOG_LEVEL_INFO, "AI successfully reinitialized. Retrying request...");
+            // Retry the request
+            started = metrics_now_us();
+            response = on_token ? ai_generate_text_stream(prompt, NULL, relay_token, &relay, &usage)
+                                : ai_generate_chat(prompt, NULL, &usage);
+            metrics_observe(deepseek_latency, metrics_now_us() - started);
+        } else {
+            log_message(LOG_LEVEL_ERROR, "AI reinitialization failed");
+            response = strdup("The AI system could not be initialized. Please check your API key configuration.");
+        }
+    }
+    
+    record_usage(&usage);
+    
+    // Only a reply that ran to its end carries the token counts; keep it
+    // for the next time the same prompt comes in
+    if (response != NULL && usage.reported) {
+        ai_cache_store(&chat->key, response, strlen(response));
+    }
     
-    // Read the file
-    char* buffer = malloc(file_size + 1);
-    fread(buffer, 1, file_size, file);
-    buffer[file_size] = '\0';
+    // If still null, provide a fallback response
+    if (response == NULL) {
+        return strdup("Error processing request. The AI service might be unavailable.");
+    }
+    
+    return response;
+}
+
+// Load a template file
+char* load_template(const char* filename) {
+    // Templates live under STATIC_DIR, so they are already in the static cache
+    char url[512];
+    snprintf(url, sizeof(url), "/%s%s", TEMPLATE_DIR + strlen(STATIC_DIR), filename);
     
-    fclose(file);
+    const static_asset_t* asset = static_cache_acquire(url);
+    if (asset == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Could not open template file: %s%s", TEMPLATE_DIR, filename);
+        return strdup("<!-- Template not found -->");
+    }
+    
+    char* buffer = malloc(asset->size + 1);
+    if (buffer != NULL && asset->data != NULL) {
+        memcpy(buffer, asset->data, asset->size);
+        buffer[asset->size] = '\0';
+    } else if (buffer != NULL) {
+        // Templates at or above the sendfile threshold are only cached as a
+        // descriptor; read them through it
+        size_t total = 0;
+        while (total < asset->size) {
+            ssize_t n = pread(asset->fd, buffer + total, asset->size - total, (off_t)total);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            total += (size_t)n;
+        }
+        buffer[total] = '\0';
+        if (total < asset->size) {
+            log_message(LOG_LEVEL_ERROR, "Could not read template file: %s%s", TEMPLATE_DIR, filename);
+            free(buffer);
+            buffer = strdup("<!-- Template not found -->");
+        }
+    }
+    static_cache_release(asset);
     return buffer;
 }
 
+// Template values for the demo list: {{#demos}} iterates demos[], and
+// {{name}} / {{description}} refer to the current demo
+static const char* demo_template_var(const char* name, const void* item, void* ctx) {
+    (void)ctx;
+    const demo_info_t* demo = item;
+    if (demo == NULL) {
+        return NULL;
+    }
+    if (strcmp(name, "name") == 0) {
+        return demo->name;
+    }
+    if (strcmp(name, "description") == 0) {
+        return demo->description;
+    }
+    return NULL;
+}
+
+static size_t demo_section_count(const char* name, void* ctx) {
+    (void)ctx;
+    if (strcmp(name, "demos") != 0) {
+        return 0;
+    }
+    size_t count = 0;
+    while (demos[count].name != NULL) {
+        count++;
+    }
+    return count;
+}
+
+static const void* demo_section_item(const char* name, size_t index, void* ctx) {
+    (void)name;
+    (void)ctx;
+    return &demos[index];
+}
+
+static const template_data_t demo_template_data = {
+    demo_template_var,
+    demo_section_count,
+    demo_section_item,
+    NULL
+};
+
+// Render one of the compiled templates
+static char* render_page(const char* template_name) {
+    char* html = NULL;
+    
+    pthread_mutex_lock(&templates_lock);
+    if (templates != NULL) {
+        html = template_render(templates, template_name, &demo_template_data, NULL);
+    }
+    pthread_mutex_unlock(&templates_lock);
+    
+    if (html == NULL) {
+        return strdup("<html><body><h1>Template error</h1></body></html>");
+    }
+    return html;
+}
+
 // Generate HTML for the demo list
 char* generate_demo_html() {
-    char* header = load_template("header.html");
-    char* footer = load_template("footer.html");
-    
-    // Estimate size for the HTML
-    size_t html_size = strlen(header) + strlen(footer) + 10000; // Allow extra space for the demos
-    char* html = malloc(html_size);
-    if (!html) {
-        free(header);
-        free(footer);
-        return strdup("<html><body><h1>Memory allocation error</h1></body></html>");
+    return render_page("index.html");
+}
+
+// Parse every template file; a template that fails to compile keeps its
+// previous version
+static void load_templates(void) {
+    pthread_mutex_lock(&templates_lock);
+    if (templates == NULL) {
+        templates = template_set_create();
+    }
+    if (templates != NULL) {
+        for (size_t i = 0; i < sizeof(template_files) / sizeof(template_files[0]); i++) {
+            char* text = load_template(template_files[i]);
+            if (text == NULL) {
+                continue;
+            }
+            if (template_set_compile(templates, template_files[i], text, strlen(text)) != 0) {
+                log_message(LOG_LEVEL_ERROR, "Failed to compile template %s", template_files[i]);
+            }
+            free(text);
+        }
+    }
+    pthread_mutex_unlock(&templates_lock);
+}
+
+// Render the cached pages into reusable responses; called at startup and
+// from the static cache watcher when a template changes
+static void rebuild_pages(void) {
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        char* html = render_page(cached_pages[i].template_name);
+        size_t len = strlen(html);
+        char etag[ETAG_SIZE];
+        static_cache_etag(html, len, etag);
+        
+        struct MHD_Response* response = MHD_create_response_from_buffer(len, html, MHD_RESPMEM_MUST_FREE);
+        if (response == NULL) {
+            free(html);
+            continue;
+        }
+        MHD_add_response_header(response, "Content-Type", "text/html");
+        add_validator_headers(response, etag, NULL, get_cache_control("text/html"));
+        
+        pthread_mutex_lock(&pages_lock);
+        struct MHD_Response* old = cached_pages[i].response;
+        cached_pages[i].response = response;
+        memcpy(cached_pages[i].etag, etag, sizeof(etag));
+        pthread_mutex_unlock(&pages_lock);
+        
+        // Connections still sending the old page keep their own reference
+        if (old != NULL) {
+            MHD_destroy_response(old);
+        }
+    }
+}
+
+// Recompile the templates and rebuild the cached pages when one of them changes
+static void on_static_file_changed(const char* url_path, void* ctx) {
+    (void)ctx;
+    const char* template_prefix = TEMPLATE_DIR + strlen(STATIC_DIR);
+    if (strcmp(url_path, "/") == 0 || strncmp(url_path + 1, template_prefix, strlen(template_prefix)) == 0) {
+        log_message(LOG_LEVEL_INFO, "Template changed (%s), rebuilding pages", url_path);
+        load_templates();
+        rebuild_pages();
     }
+}
+
+// Queue a cached page, or 304 if the browser already has it
+static int queue_cached_page(struct MHD_Connection* connection, int page) {
+    struct MHD_Response* response;
+    int ret;
     
-    // Start with the header
-    strcpy(html, header);
-    free(header);
+    pthread_mutex_lock(&pages_lock);
+    if (cached_pages[page].response == NULL) {
+        pthread_mutex_unlock(&pages_lock);
+        return queue_html_page(connection, render_page(cached_pages[page].template_name));
+    }
     
-    // Generate demo list
-    strcat(html, "<div class='demo-list'>");
-    for (int i = 0; demos[i].name != NULL; i++) {
-        char demo_html[512];
-        snprintf(demo_html, sizeof(demo_html), 
-                "<div class='demo-item' data-demo='%s'>\n"
-                "  <h3>%s</h3>\n"
-                "  <button class='run-button'>Run Demo</button>\n"
-                "</div>\n",
-                demos[i].name, demos[i].description);
-        strcat(html, demo_html);
-    }
-    strcat(html, "</div>");
-    
-    // Output area
-    strcat(html, "<div class='output-container'>\n"
-                "<h2>Demo Output</h2>\n"
-                "<pre id='output'>Select a demo to run...</pre>\n"
-                "</div>");
-    
-    // Add footer
-    strcat(html, footer);
-    free(footer);
+    if (is_not_modified(connection, cached_pages[page].etag, 0)) {
+        response = MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
+        add_validator_headers(response, cached_pages[page].etag, NULL, get_cache_control("text/html"));
+        pthread_mutex_unlock(&pages_lock);
+        ret = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+        MHD_destroy_response(response);
+        return ret;
+    }
     
-    return html;
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, cached_pages[page].response);
+    pthread_mutex_unlock(&pages_lock);
+    return ret;
+}
+
+// Entry point of zygote workers
+static void run_demo_at(unsigned int index) {
+    demos[index].function();
 }
 
-// Function to run a demo and capture its output
-char* capture_demo_output(void (*demo_func)()) {
+// Start a demo with stdout and stderr on a pipe. Waits for a free demo slot
+// first, so it is only called on demo workers, never on a server thread;
+// fills in the read end of the pipe and the process to finish later.
+static int spawn_demo(const demo_info_t* demo, demo_process_t* process) {
     // Create a pipe
     int pipefd[2];
     if (pipe(pipefd) == -1) {
         perror("pipe");
-        return strdup("Error creating pipe for output capture");
+        return -1;
+    }
+    
+    // Wait for a free demo slot
+    while (sem_wait(&demo_slots) == -1 && errno == EINTR) {
+    }
+    
+    // Prefer the zygote: forking the server itself gets slower as it grows
+    // and copies the state of every worker thread
+    uint64_t started = metrics_now_us();
+    int pidfd;
+    pid_t pid = demo_zygote_spawn((unsigned int)(demo - demos), pipefd[1], &pidfd);
+    if (pid != -1) {
+        metrics_observe(demo_spawn_zygote, metrics_now_us() - started);
+        close(pipefd[1]);
+        process->fd = pipefd[0];
+        process->pid = pid;
+        process->pidfd = pidfd;
+        process->reap = 0;
+        return 0;
     }
     
     // Fork a child process
-    pid_t pid = fork();
+    started = metrics_now_us();
+    pid = fork();
     
     if (pid == -1) {
         perror("fork");
         close(pipefd[0]);
         close(pipefd[1]);
-        return strdup("Error forking process for demo");
+        sem_post(&demo_slots);
+        return -1;
     }
     
     if (pid == 0) {
         // Child process - redirect stdout and stderr to the pipe
         close(pipefd[0]); // Close read end
         
+        // Demos expect no signals blocked; server threads block SIGINT/SIGTERM
+        sigset_t unblocked;
+        sigemptyset(&unblocked);
+        pthread_sigmask(SIG_SETMASK, &unblocked, NULL);
+        
         if (dup2(pipefd[1], STDOUT_FILENO) == -1 ||
             dup2(pipefd[1], STDERR_FILENO) == -1) {
             perror("dup2");
@@ -820,103 +2047,601 @@ char* capture_demo_output(void (*demo_func)()) {
         
         close(pipefd[1]); // Close original write end
         
+        // Flush every line so output reaches the pipe as it is printed
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        
         // Run the demo
-        demo_func();
+        demo->function();
         fflush(stdout); // Make sure all output is flushed
         
         // Exit child
         exit(EXIT_SUCCESS);
+    }
+    
+    // Parent process
+    metrics_observe(demo_spawn_fork, metrics_now_us() - started);
+    close(pipefd[1]); // Close write end
+    process->fd = pipefd[0];
+    process->pid = pid;
+    process->pidfd = -1;
+    process->reap = 1;
+    return 0;
+}
+
+// Finish a demo started by spawn_demo and free its slot. A demo that is
+// stopped early is killed rather than left blocked on a full pipe. Only our
+// own unreaped children are killed by PID; a zygote worker may have been
+// reaped already and its PID reused, so it is signalled through its pidfd.
+// Without one, closing the pipe stops it with SIGPIPE on its next write.
+static void finish_demo(demo_process_t* process, int stop) {
+    if (stop) {
+        if (process->reap) {
+            kill(process->pid, SIGKILL);
+        } else if (process->pidfd != -1) {
+            syscall(SYS_pidfd_send_signal, process->pidfd, SIGKILL, NULL, 0);
+        }
+    }
+    if (process->pidfd != -1) {
+        close(process->pidfd);
+        process->pidfd = -1;
+    }
+    close(process->fd); // Close read end
+    process->fd = -1;
+    
+    // Wait for child to complete
+    if (process->reap) {
+        int status;
+        while (waitpid(process->pid, &status, 0) == -1 && errno == EINTR) {
+        }
+    }
+    sem_post(&demo_slots);
+}
+
+// Read one block of demo output, retrying on signals
+static ssize_t read_demo_output(int fd, char* buf, size_t size) {
+    ssize_t bytesRead;
+    do {
+        bytesRead = read(fd, buf, size);
+    } while (bytesRead == -1 && errno == EINTR);
+    return bytesRead;
+}
+
+// Seconds on a clock that does not jump with the wall clock
+static time_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Queue the cached /run response of a demo, or its /stream response if
+// stream is set, if its policy allows it and it is still fresh; returns 1
+// with the queue result in *ret on a hit
+static int queue_cached_demo_result(struct MHD_Connection* connection, const demo_info_t* demo, int stream, int* ret) {
+    if (demo->cache_policy == DEMO_CACHE_NEVER) {
+        return 0;
+    }
+    
+    size_t index = demo - demos;
+    int hit = 0;
+    
+    pthread_mutex_lock(&demo_results_lock);
+    if (demo_results[index].response != NULL &&
+        (demo->cache_policy == DEMO_CACHE_FOREVER || monotonic_seconds() < demo_results[index].expires)) {
+        *ret = MHD_queue_response(connection, MHD_HTTP_OK,
+                                  stream ? demo_results[index].stream_response : demo_results[index].response);
+        hit = 1;
+        demo_cache_hits++;
     } else {
-        // Parent process - read from the pipe
-        close(pipefd[1]); // Close write end
-        
-        pthread_mutex_lock(&output_mutex);
-        
-        // Initialize output buffer
-        memset(output_buffer, 0, sizeof(output_buffer));
-        
-        // Read the output with a timeout (to ensure we get everything)
-        fd_set readfds;
-        struct timeval tv;
-        int totalBytesRead = 0;
-        
-        while (1) {
-            FD_ZERO(&readfds);
-            FD_SET(pipefd[0], &readfds);
-            
-            // Set timeout to 1 second
-            tv.tv_sec = 1;
-            tv.tv_usec = 0;
-            
-            int ret = select(pipefd[0] + 1, &readfds, NULL, NULL, &tv);
-            if (ret == -1) {
-                break; // Error
-            } else if (ret == 0) {
-                // Timeout - no more data
-                break;
+        demo_cache_misses++;
+    }
+    pthread_mutex_unlock(&demo_results_lock);
+    return hit;
+}
+
+// Ends /stream output cut short by the output limit
+static const char stream_truncated_notice[] = "\n[Output truncated: the demo exceeded the server's output limit]\n";
+
+// The /run response for a demo's output, escaped straight into an exactly
+// sized buffer
+static struct MHD_Response* create_demo_json_response(const char* output, size_t size, int truncated) {
+    size_t json_len;
+    char* json = json_wrap_string("{\"status\":\"success\",\"output\":\"", output, size,
+                                  truncated ? "\",\"truncated\":true}" : "\",\"truncated\":false}",
+                                  &json_len);
+    if (json == NULL) {
+        return NULL;
+    }
+    
+    struct MHD_Response* response = MHD_create_response_from_buffer(json_len, json, MHD_RESPMEM_MUST_FREE);
+    if (response == NULL) {
+        free(json);
+        return NULL;
+    }
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    return response;
+}
+
+// Headers of /stream responses, live or cached
+static void add_demo_stream_headers(struct MHD_Response* response) {
+    MHD_add_response_header(response, "Content-Type", "text/plain; charset=utf-8");
+    MHD_add_response_header(response, "Cache-Control", "no-cache");
+    MHD_add_response_header(response, "X-Content-Type-Options", "nosniff");
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+}
+
+// Keep a demo's result for later requests: takes over the caller's reference
+// to its /run response and builds the matching /stream response from the
+// output. Nothing is kept if that fails.
+static void store_demo_result(const demo_info_t* demo, struct MHD_Response* response,
+                              const char* output, size_t size, int truncated) {
+    size_t index = demo - demos;
+    size_t notice_len = truncated ? sizeof(stream_truncated_notice) - 1 : 0;
+    
+    char* text = malloc(size + notice_len + 1);
+    struct MHD_Response* stream_response = NULL;
+    if (text != NULL) {
+        memcpy(text, output, size);
+        memcpy(text + size, stream_truncated_notice, notice_len);
+        stream_response = MHD_create_response_from_buffer(size + notice_len, text, MHD_RESPMEM_MUST_FREE);
+        if (stream_response == NULL) {
+            free(text);
+        }
+    }
+    if (stream_response == NULL) {
+        MHD_destroy_response(response);
+        return;
+    }
+    add_demo_stream_headers(stream_response);
+    
+    pthread_mutex_lock(&demo_results_lock);
+    struct MHD_Response* old = demo_results[index].response;
+    struct MHD_Response* old_stream = demo_results[index].stream_response;
+    demo_results[index].response = response;
+    demo_results[index].stream_response = stream_response;
+    demo_results[index].expires = monotonic_seconds() + demo->cache_ttl;
+    pthread_mutex_unlock(&demo_results_lock);
+    
+    // Connections still sending the old result keep their own reference
+    if (old != NULL) {
+        MHD_destroy_response(old);
+        MHD_destroy_response(old_stream);
+    }
+}
+
+// Function to run a demo and capture its output.
+// Each run reads into its own buffer until the demo exits, so runs only
+// wait on each other once all demo slots are taken.
+int capture_demo_output(const demo_info_t* demo, demo_output_t* output) {
+    output->data = NULL;
+    output->size = 0;
+    output->truncated = 0;
+    
+    demo_process_t process;
+    if (spawn_demo(demo, &process) != 0) {
+        return -1;
+    }
+    int fd = process.fd;
+    
+    size_t limit = demo_output_limit;
+    size_t capacity = 0;
+    
+    while (1) {
+        // At the limit: any further byte means the output is cut short
+        if (output->size == limit) {
+            char extra;
+            if (read_demo_output(fd, &extra, 1) > 0) {
+                output->truncated = 1;
             }
-            
-            // Read available data
-            ssize_t bytesRead = read(pipefd[0], 
-                                    output_buffer + totalBytesRead, 
-                                    sizeof(output_buffer) - totalBytesRead - 1);
-            if (bytesRead <= 0) {
-                break; // EOF or error
+            break;
+        }
+        
+        // Grow the buffer geometrically up to the limit
+        if (output->size == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 4096;
+            if (new_capacity > limit) {
+                new_capacity = limit;
             }
-            
-            totalBytesRead += bytesRead;
-            
-            // Check if buffer is full
-            if (totalBytesRead >= sizeof(output_buffer) - 1) {
+            char* data = realloc(output->data, new_capacity + 1);
+            if (data == NULL) {
                 break;
             }
+            output->data = data;
+            capacity = new_capacity;
         }
         
-        // Ensure null termination
-        output_buffer[totalBytesRead] = '\0';
-        
-        // Wait for child to complete
-        int status;
-        waitpid(pid, &status, 0);
-        
-        // Process output for JSON
-        char* json_output = malloc(totalBytesRead * 2 + 1); // Allocate twice the size for escaping
-        if (json_output) {
-            int j = 0;
-            for (int i = 0; i < totalBytesRead; i++) {
-                char c = output_buffer[i];
-                if (c == '"') {
-                    json_output[j++] = '\\';
-                    json_output[j++] = '"';
-                } else if (c == '\\') {
-                    json_output[j++] = '\\';
-                    json_output[j++] = '\\';
-                } else if (c == '\n') {
-                    json_output[j++] = '\\';
-                    json_output[j++] = 'n';
-                } else if (c == '\t') {
-                    json_output[j++] = '\\';
-                    json_output[j++] = 't';
-                } else if (c == '\r') {
-                    // Skip carriage returns
-                } else if (c >= 32 && c <= 126) { // Printable ASCII
-                    json_output[j++] = c;
-                } else {
-                    // For non-printable characters, use a space
-                    json_output[j++] = ' ';
+        // Read until the demo exits and closes its end of the pipe
+        ssize_t bytesRead = read_demo_output(fd, output->data + output->size, capacity - output->size);
+        if (bytesRead <= 0) {
+            break; // EOF or error
+        }
+        output->size += bytesRead;
+    }
+    
+    finish_demo(&process, output->truncated);
+    metrics_add(demo_bytes_run, output->size);
+    
+    if (output->data == NULL) {
+        output->data = malloc(1);
+        if (output->data == NULL) {
+            return -1;
+        }
+    }
+    output->data[output->size] = '\0';
+    return 0;
+}
+
+static void release_demo_stream(demo_stream_t* stream) {
+    pthread_mutex_lock(&stream->lock);
+    int refs = --stream->refs;
+    pthread_mutex_unlock(&stream->lock);
+    if (refs > 0) {
+        return;
+    }
+    pthread_mutex_destroy(&stream->lock);
+    free(stream->data);
+    free(stream);
+}
+
+// Append demo output and wake the reader up if it is waiting for some;
+// returns false once the client has gone away
+static bool push_demo_output(demo_stream_t* stream, const char* data, size_t len, int last) {
+    pthread_mutex_lock(&stream->lock);
+    if (stream->closed) {
+        pthread_mutex_unlock(&stream->lock);
+        return false;
+    }
+    
+    if (stream->len + len > stream->cap) {
+        size_t cap = stream->cap ? stream->cap * 2 : 4096;
+        while (cap < stream->len + len) {
+            cap *= 2;
+        }
+        char* buffer = realloc(stream->data, cap);
+        if (buffer == NULL) {
+            // Drop this output; the reader still sees the end of the stream
+            last = 1;
+            len = 0;
+        } else {
+            stream->data = buffer;
+            stream->cap = cap;
+        }
+    }
+    memcpy(stream->data + stream->len, data, len);
+    stream->len += len;
+    if (last) {
+        stream->done = 1;
+    }
+    
+    int wake = stream->reader_waiting;
+    stream->reader_waiting = 0;
+    pthread_mutex_unlock(&stream->lock);
+    
+    // The reader suspended the connection while holding the lock, so it is
+    // suspended by now
+    if (wake) {
+        MHD_resume_connection(stream->connection);
+    }
+    return true;
+}
+
+// Demo worker job for /stream/<demo>: run the demo and pass its output on
+// as it is read, up to the output limit. The output of a cacheable demo is
+// also kept, and stored in the result cache if the run completes.
+static void run_demo_stream_job(void* arg, int cancelled) {
+    demo_stream_t* stream = arg;
+    const demo_info_t* demo = stream->demo;
+    const char* error = NULL;
+    demo_process_t process;
+    
+    if (cancelled) {
+        error = "The server is shutting down\n";
+    } else if (spawn_demo(demo, &process) != 0) {
+        error = "Could not run demo\n";
+    }
+    if (error != NULL) {
+        push_demo_output(stream, error, strlen(error), 1);
+        release_demo_stream(stream);
+        return;
+    }
+    
+    char buf[4096];
+    size_t sent = 0;
+    int stop = 0;
+    int keep = demo->cache_policy != DEMO_CACHE_NEVER;
+    char* kept = NULL;
+    size_t kept_cap = 0;
+    while (1) {
+        if (sent >= demo_output_limit) {
+            stop = 1;
+            break;
+        }
+        size_t want = demo_output_limit - sent;
+        ssize_t bytesRead = read_demo_output(process.fd, buf, want < sizeof(buf) ? want : sizeof(buf));
+        if (bytesRead <= 0) {
+            break;  // The demo exited
+        }
+        if (!push_demo_output(stream, buf, bytesRead, 0)) {
+            stop = 1;   // Nobody is reading any more
+            break;
+        }
+        if (keep && sent + bytesRead > kept_cap) {
+            size_t new_cap = kept_cap ? kept_cap * 2 : sizeof(buf);
+            while (new_cap < sent + bytesRead) {
+                new_cap *= 2;
+            }
+            char* new_kept = realloc(kept, new_cap);
+            if (new_kept == NULL) {
+                keep = 0;   // Still streamed, just not cached
+            } else {
+                kept = new_kept;
+                kept_cap = new_cap;
+            }
+        }
+        if (keep) {
+            memcpy(kept + sent, buf, bytesRead);
+        }
+        sent += bytesRead;
+        metrics_add(demo_bytes_stream, bytesRead);
+    }
+    
+    // A demo that is stopped early is killed rather than left blocked on a full pipe
+    finish_demo(&process, stop);
+    if (sent >= demo_output_limit) {
+        push_demo_output(stream, stream_truncated_notice, sizeof(stream_truncated_notice) - 1, 1);
+    } else {
+        push_demo_output(stream, "", 0, 1);
+    }
+    release_demo_stream(stream);
+    
+    // Only a complete run is worth answering later requests with
+    if (keep && !stop) {
+        struct MHD_Response* response = create_demo_json_response(kept ? kept : "", sent, 0);
+        if (response != NULL) {
+            store_demo_result(demo, response, kept ? kept : "", sent, 0);
+        }
+    }
+    free(kept);
+}
+
+// Content reader for /stream/<demo>: send the output received so far, or
+// suspend the connection until the worker adds more, so that a demo that
+// pauses never holds the server thread
+static ssize_t read_demo_stream(void* cls, uint64_t pos, char* buf, size_t max) {
+    (void)pos;
+    demo_stream_t* stream = cls;
+    
+    pthread_mutex_lock(&stream->lock);
+    size_t available = stream->len - stream->sent;
+    if (available > 0) {
+        size_t n = available < max ? available : max;
+        memcpy(buf, stream->data + stream->sent, n);
+        stream->sent += n;
+        if (stream->sent == stream->len) {
+            stream->sent = stream->len = 0;
+        }
+        pthread_mutex_unlock(&stream->lock);
+        return n;
+    }
+    if (stream->done) {
+        pthread_mutex_unlock(&stream->lock);
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+    
+    stream->reader_waiting = 1;
+    MHD_suspend_connection(stream->connection);
+    pthread_mutex_unlock(&stream->lock);
+    return 0;
+}
+
+// Free callback for /stream/<demo>; the worker stops the demo at its next
+// output if the client went away
+static void free_demo_stream(void* cls) {
+    demo_stream_t* stream = cls;
+    pthread_mutex_lock(&stream->lock);
+    stream->closed = 1;
+    pthread_mutex_unlock(&stream->lock);
+    release_demo_stream(stream);
+}
+
+// Create a response for a cached file, taking over the caller's reference
+static struct MHD_Response* create_asset_response(const static_asset_t* asset) {
+    struct MHD_Response* response;
+
+    if (asset->fd != -1) {
+        // Large file - sent with sendfile() from a copy of the cached
+        // descriptor, libmicrohttpd closes the copy when the response is freed
+        size_t file_size = asset->size;
+        int fd = dup(asset->fd);
+        static_cache_release(asset);
+        if (fd == -1) {
+            return NULL;
+        }
+        response = MHD_create_response_from_fd(file_size, fd);
+        if (response == NULL) {
+            close(fd);
+        }
+        return response;
+    }
+
+    // The cache reference is dropped when libmicrohttpd frees the response
+    response = MHD_create_response_from_buffer_with_free_callback(
+        asset->size, (void*)asset->data, &static_cache_release_buffer);
+    if (response == NULL) {
+        static_cache_release(asset);
+    }
+    return response;
+}
+
+// Cache-Control policy per asset class
+static const char* get_cache_control(const char* content_type) {
+    if (strncmp(content_type, "image/", 6) == 0) {
+        return "public, max-age=86400";
+    }
+    if (strcmp(content_type, "text/css") == 0 || strcmp(content_type, "application/javascript") == 0) {
+        return "public, max-age=3600";
+    }
+    // Pages are rendered from templates - always revalidate
+    return "no-cache";
+}
+
+// Check whether an If-None-Match list contains an ETag (weak comparison)
+static int etag_matches(const char* header, const char* etag) {
+    size_t len = strlen(etag);
+    const char* p = header;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+        if (*p == '*') {
+            return 1;
+        }
+        if (strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        const char* token = p;
+        while (*p != '\0' && *p != ',' && *p != ' ') {
+            p++;
+        }
+        if ((size_t)(p - token) == len && strncmp(token, etag, len) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Evaluate the conditional request headers against a representation's validators
+static int is_not_modified(struct MHD_Connection* connection, const char* etag, time_t mtime) {
+    const char* if_none_match = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-None-Match");
+    if (if_none_match != NULL) {
+        // If-None-Match takes precedence over If-Modified-Since
+        return etag_matches(if_none_match, etag);
+    }
+
+    const char* if_modified_since = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-Modified-Since");
+    if (if_modified_since != NULL && mtime != 0) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm) != NULL) {
+            return mtime <= timegm(&tm);
+        }
+    }
+
+    return 0;
+}
+
+// Add ETag, Last-Modified and Cache-Control headers (last_modified may be NULL)
+static void add_validator_headers(struct MHD_Response* response, const char* etag,
+                                  const char* last_modified, const char* cache_control) {
+    MHD_add_response_header(response, "ETag", etag);
+    if (last_modified != NULL) {
+        MHD_add_response_header(response, "Last-Modified", last_modified);
+    }
+    MHD_add_response_header(response, "Cache-Control", cache_control);
+}
+
+// Send a rendered HTML page (takes ownership of html), or 304 if the browser has it
+static int queue_html_page(struct MHD_Connection* connection, char* html) {
+    struct MHD_Response* response;
+    int ret;
+    size_t len = strlen(html);
+    char etag[ETAG_SIZE];
+
+    static_cache_etag(html, len, etag);
+    if (is_not_modified(connection, etag, 0)) {
+        free(html);
+        response = MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
+        add_validator_headers(response, etag, NULL, get_cache_control("text/html"));
+        ret = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+        MHD_destroy_response(response);
+        return ret;
+    }
+
+    response = MHD_create_response_from_buffer(len, html, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(response, "Content-Type", "text/html");
+    add_validator_headers(response, etag, NULL, get_cache_control("text/html"));
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Check whether an Accept-Encoding header allows an encoding ("gzip;q=0" refuses it)
+static int accepts_encoding(const char* header, const char* encoding) {
+    size_t len = strlen(encoding);
+    const char* p = header;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+        const char* token = p;
+        while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ') {
+            p++;
+        }
+        int match = (size_t)(p - token) == len && strncasecmp(token, encoding, len) == 0;
+
+        // Look at the parameters of this token for a zero quality value
+        double q = 1.0;
+        while (*p != '\0' && *p != ',') {
+            if (*p == ';') {
+                p++;
+                while (*p == ' ') p++;
+                if (tolower((unsigned char)p[0]) == 'q' && p[1] == '=') {
+                    q = atof(p + 2);
                 }
+            } else {
+                p++;
             }
-            json_output[j] = '\0';
-        } else {
-            // Memory allocation failed
-            json_output = strdup("Memory allocation error");
         }
-        
-        close(pipefd[0]); // Close read end
-        pthread_mutex_unlock(&output_mutex);
-        
-        return json_output;
+
+        if (match) {
+            return q > 0.0;
+        }
     }
+
+    return 0;
+}
+
+// Text assets are worth sending compressed, images are already compressed
+static int is_compressible(const char* content_type) {
+    return strncmp(content_type, "text/", 5) == 0 ||
+           strcmp(content_type, "application/javascript") == 0;
+}
+
+// Find a precompressed variant of an asset that the client accepts and that is
+// not older than the asset itself. Returns NULL to send the asset as is.
+static const static_asset_t* acquire_precompressed(const char* url, const static_asset_t* asset,
+                                                   const char* accept_encoding, const char** encoding) {
+    if (accept_encoding == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < sizeof(precompressed_variants) / sizeof(precompressed_variants[0]); i++) {
+        if (!accepts_encoding(accept_encoding, precompressed_variants[i].encoding)) {
+            continue;
+        }
+
+        char variant_url[1024];
+        int n = snprintf(variant_url, sizeof(variant_url), "%s%s", url, precompressed_variants[i].suffix);
+        if (n < 0 || (size_t)n >= sizeof(variant_url)) {
+            continue;
+        }
+
+        const static_asset_t* variant = static_cache_acquire_cached(variant_url);
+        if (variant == NULL) {
+            continue;
+        }
+        if (variant->mtime >= asset->mtime) {
+            *encoding = precompressed_variants[i].encoding;
+            return variant;
+        }
+        // Stale variant left over from an older version of the file
+        static_cache_release(variant);
+    }
+
+    return NULL;
 }
 
 // Determine content type based on file extension
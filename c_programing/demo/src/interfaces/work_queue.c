@@ -0,0 +1,137 @@
+#include "../../include/work_queue.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct {
+    work_fn_t fn;
+    void *arg;
+} job_t;
+
+struct work_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       // Signalled when a job is queued or the queue stops
+    job_t *jobs;                // Ring of waiting jobs
+    size_t capacity;
+    size_t head;                // Next job to run
+    size_t count;               // Jobs waiting
+    size_t running;             // Jobs being run
+    int stopping;
+    unsigned int thread_count;
+    pthread_t threads[];
+};
+
+static void *worker_main(void *arg) {
+    work_queue_t *queue = arg;
+
+    pthread_mutex_lock(&queue->lock);
+    while (1) {
+        while (queue->count == 0 && !queue->stopping) {
+            pthread_cond_wait(&queue->ready, &queue->lock);
+        }
+        if (queue->stopping) {
+            break;
+        }
+
+        job_t job = queue->jobs[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        queue->running++;
+        pthread_mutex_unlock(&queue->lock);
+
+        job.fn(job.arg, 0);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->running--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+work_queue_t *work_queue_create(unsigned int threads, size_t max_queued) {
+    if (threads == 0) {
+        threads = 1;
+    }
+    if (max_queued == 0) {
+        max_queued = 1;
+    }
+
+    work_queue_t *queue = calloc(1, sizeof(work_queue_t) + threads * sizeof(pthread_t));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->jobs = calloc(max_queued, sizeof(job_t));
+    if (queue->jobs == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->capacity = max_queued;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+
+    for (unsigned int i = 0; i < threads; i++) {
+        if (pthread_create(&queue->threads[i], NULL, worker_main, queue) != 0) {
+            break;
+        }
+        queue->thread_count++;
+    }
+    if (queue->thread_count == 0) {
+        work_queue_free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+int work_queue_submit(work_queue_t *queue, work_fn_t fn, void *arg) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->stopping || queue->count == queue->capacity) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+    queue->jobs[(queue->head + queue->count) % queue->capacity] = (job_t){fn, arg};
+    queue->count++;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+size_t work_queue_pending(work_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    size_t pending = queue->count + queue->running;
+    pthread_mutex_unlock(&queue->lock);
+    return pending;
+}
+
+void work_queue_stop(work_queue_t *queue) {
+    // Take the waiting jobs; workers finish the job they are running
+    pthread_mutex_lock(&queue->lock);
+    if (queue->stopping) {
+        pthread_mutex_unlock(&queue->lock);
+        return;
+    }
+    queue->stopping = 1;
+    size_t head = queue->head;
+    size_t count = queue->count;
+    queue->count = 0;
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (size_t i = 0; i < count; i++) {
+        job_t job = queue->jobs[(head + i) % queue->capacity];
+        job.fn(job.arg, 1);
+    }
+
+    for (unsigned int i = 0; i < queue->thread_count; i++) {
+        pthread_join(queue->threads[i], NULL);
+    }
+}
+
+void work_queue_free(work_queue_t *queue) {
+    if (queue == NULL) {
+        return;
+    }
+    work_queue_stop(queue);
+    pthread_cond_destroy(&queue->ready);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->jobs);
+    free(queue);
+}
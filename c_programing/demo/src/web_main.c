@@ -1,51 +1,213 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
 #include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
 #include "../include/web_server.h"
 
-static struct MHD_Daemon *web_daemon = NULL;
+// Largest thread and demo counts accepted on the command line
+#define MAX_THREADS 1024
+// Largest project context, in tokens
+#define MAX_CONTEXT_TOKENS 1000000
 
-// Signal handler to handle Ctrl+C and graceful shutdown
-void signal_handler(int signum) {
-    if (signum == SIGINT) {
-        printf("\nShutting down web server...\n");
-        if (web_daemon != NULL) {
-            stop_web_server(web_daemon);
-            web_daemon = NULL;
-        }
-        exit(0);
+// Parse an option value that must be a whole decimal number in [min, max];
+// signs, spaces, trailing text and overflow are rejected
+static int parse_number(const char *text, unsigned long min, unsigned long max, unsigned long *value) {
+    if (!isdigit((unsigned char)text[0])) {
+        return -1;
+    }
+    char *end;
+    errno = 0;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (errno != 0 || *end != '\0' || parsed < min || parsed > max) {
+        return -1;
     }
+    *value = parsed;
+    return 0;
 }
 
-int main() {
-    // Set up signal handler
-    struct sigaction sa;
-    sa.sa_handler = signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    
-    if (sigaction(SIGINT, &sa, NULL) == -1) {
-        perror("Could not set up signal handler");
+// Print command line usage
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  -p, --port PORT      Listen port (default %d)\n", SERVER_PORT);
+    printf("  -t, --threads N      Number of epoll worker threads (default %d)\n", DEFAULT_THREAD_POOL_SIZE);
+    printf("  -s, --select         Use a single select() thread instead of epoll\n");
+    printf("  -c, --cache-mb MB    Memory cap for cached static files (default %d)\n",
+           DEFAULT_STATIC_CACHE_BYTES / (1024 * 1024));
+    printf("  -z, --sendfile-kb KB Send files of at least KB kilobytes with sendfile, 0 to disable (default %d)\n",
+           DEFAULT_SENDFILE_THRESHOLD / 1024);
+    printf("  -d, --max-demos N    Demos allowed to run at once (default: one per CPU)\n");
+    printf("  -o, --output-kb KB   Output kept per demo run before it is truncated (default %d)\n",
+           DEFAULT_DEMO_OUTPUT_LIMIT / 1024);
+    printf("  -m, --request-kb KB  Memory one POST request may use, at least %d (default %d)\n",
+           REQUEST_ARENA_BLOCK_SIZE / 1024, DEFAULT_REQUEST_MEMORY_LIMIT / 1024);
+    printf("  -a, --ai-workers N   Threads making DeepSeek calls for chat requests (default %d)\n", DEFAULT_AI_WORKERS);
+    printf("  -b, --context-tokens N  Project context added to a chat prompt, in tokens (default %d)\n",
+           DEFAULT_CONTEXT_TOKENS);
+    printf("  -r, --ai-cache-mb MB Memory cap for cached AI responses (default %d)\n",
+           DEFAULT_AI_CACHE_BYTES / (1024 * 1024));
+    printf("  -f, --ai-cache-file FILE  Also keep AI responses in FILE, across restarts\n");
+    printf("  -l, --log-level LEVEL  Least severe messages logged: debug, info, warn or error (default info)\n");
+    printf("      --no-zygote      Fork demos from the server instead of the zygote process\n");
+    printf("  -h, --help           Show this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    web_server_config_t config;
+    web_server_default_config(&config);
+
+    static const struct option long_options[] = {
+        {"port",    required_argument, NULL, 'p'},
+        {"threads", required_argument, NULL, 't'},
+        {"select",  no_argument,       NULL, 's'},
+        {"cache-mb", required_argument, NULL, 'c'},
+        {"sendfile-kb", required_argument, NULL, 'z'},
+        {"max-demos", required_argument, NULL, 'd'},
+        {"output-kb", required_argument, NULL, 'o'},
+        {"request-kb", required_argument, NULL, 'm'},
+        {"ai-workers", required_argument, NULL, 'a'},
+        {"context-tokens", required_argument, NULL, 'b'},
+        {"ai-cache-mb", required_argument, NULL, 'r'},
+        {"ai-cache-file", required_argument, NULL, 'f'},
+        {"log-level", required_argument, NULL, 'l'},
+        {"no-zygote", no_argument,     NULL, 'Z'},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    unsigned long value = 0;
+    while ((opt = getopt_long(argc, argv, "p:t:sc:z:d:o:m:a:b:r:f:l:h", long_options, NULL)) != -1) {
+        char error[128] = "";
+        switch (opt) {
+            case 'p':
+                if (parse_number(optarg, 1, 65535, &value) != 0) {
+                    snprintf(error, sizeof(error), "Port must be between 1 and 65535");
+                }
+                config.port = (unsigned int)value;
+                break;
+            case 't':
+                if (parse_number(optarg, 1, MAX_THREADS, &value) != 0) {
+                    snprintf(error, sizeof(error), "Thread count must be between 1 and %d", MAX_THREADS);
+                }
+                config.thread_pool_size = (unsigned int)value;
+                break;
+            case 's':
+                config.use_epoll = 0;
+                break;
+            case 'c':
+                if (parse_number(optarg, 0, SIZE_MAX / (1024 * 1024), &value) != 0) {
+                    snprintf(error, sizeof(error), "Static cache size must be a number of megabytes");
+                }
+                config.static_cache_bytes = (size_t)value * 1024 * 1024;
+                break;
+            case 'z':
+                if (parse_number(optarg, 0, SIZE_MAX / 1024, &value) != 0) {
+                    snprintf(error, sizeof(error), "Sendfile threshold must be a number of kilobytes");
+                }
+                config.sendfile_threshold = (size_t)value * 1024;
+                break;
+            case 'd':
+                if (parse_number(optarg, 1, MAX_THREADS, &value) != 0) {
+                    snprintf(error, sizeof(error), "Concurrent demo count must be between 1 and %d", MAX_THREADS);
+                }
+                config.max_concurrent_demos = (unsigned int)value;
+                break;
+            case 'o':
+                if (parse_number(optarg, 1, SIZE_MAX / 1024, &value) != 0) {
+                    snprintf(error, sizeof(error), "Demo output limit must be at least 1 KB");
+                }
+                config.demo_output_limit = (size_t)value * 1024;
+                break;
+            case 'm':
+                if (parse_number(optarg, REQUEST_ARENA_BLOCK_SIZE / 1024, SIZE_MAX / 1024, &value) != 0) {
+                    snprintf(error, sizeof(error), "Request memory limit must be at least %d KB",
+                             REQUEST_ARENA_BLOCK_SIZE / 1024);
+                }
+                config.request_memory_limit = (size_t)value * 1024;
+                break;
+            case 'a':
+                if (parse_number(optarg, 1, MAX_THREADS, &value) != 0) {
+                    snprintf(error, sizeof(error), "AI worker count must be between 1 and %d", MAX_THREADS);
+                }
+                config.ai_workers = (unsigned int)value;
+                break;
+            case 'b':
+                if (parse_number(optarg, 1, MAX_CONTEXT_TOKENS, &value) != 0) {
+                    snprintf(error, sizeof(error), "Context token budget must be between 1 and %d", MAX_CONTEXT_TOKENS);
+                }
+                config.context_tokens = (size_t)value;
+                break;
+            case 'r':
+                if (parse_number(optarg, 0, SIZE_MAX / (1024 * 1024), &value) != 0) {
+                    snprintf(error, sizeof(error), "AI cache size must be a number of megabytes");
+                }
+                config.ai_cache_bytes = (size_t)value * 1024 * 1024;
+                break;
+            case 'f':
+                config.ai_cache_file = optarg;
+                break;
+            case 'l':
+                if (log_level_parse(optarg, &config.log_level) != 0) {
+                    fprintf(stderr, "Unknown log level: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'Z':
+                config.use_zygote = 0;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+        if (error[0] != '\0') {
+            fprintf(stderr, "%s\n", error);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Block Ctrl+C and SIGTERM before the server starts its threads, so they
+    // all inherit the mask and the signals are only taken by sigwait below.
+    // A handler could run on any server thread, which stop_web_server would
+    // then try to join, possibly while it holds one of the server's locks.
+    sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    int rc = pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL);
+    if (rc != 0) {
+        errno = rc;
+        perror("Could not block shutdown signals");
         return 1;
     }
     
     printf("\n===== System Call Library Web Demo =====\n");
-    printf("Starting web server on port %d...\n", SERVER_PORT);
+    printf("Starting web server on port %u...\n", config.port);
     
     // Initialize and start the web server
-    web_daemon = init_web_server();
+    struct MHD_Daemon *web_daemon = init_web_server_with_config(&config);
     if (web_daemon == NULL) {
         fprintf(stderr, "Failed to initialize web server\n");
         return 1;
     }
     
-    printf("Web server running at http://localhost:%d\n", SERVER_PORT);
+    printf("Web server running at http://localhost:%u\n", config.port);
     printf("Press Ctrl+C to quit\n");
     
-    // Keep the main thread running
-    while (1) {
-        sleep(1);
+    // Wait for Ctrl+C or SIGTERM, then shut down from this thread
+    int signum;
+    while (sigwait(&shutdown_signals, &signum) != 0) {
     }
     
+    printf("\nShutting down web server...\n");
+    stop_web_server(web_daemon);
+    
     return 0;
 }
\ No newline at end of file
@@ -9,12 +9,58 @@ document.addEventListener("DOMContentLoaded", () => {
   // --- Helper Function to Format Output ---
   const formatOutput = (rawOutput) => {
     if (!rawOutput) return "No output received from demo.";
-    // Process escaped sequences for display in <pre> tag
-    return rawOutput
-      .replace(/\\n/g, "\n") // Newlines
-      .replace(/\\t/g, "\t") // Tabs
-      .replace(/\\"/g, '"') // Double quotes
-      .replace(/\\\\/g, "\\"); // Backslashes
+    // The server sends properly escaped JSON, so the parsed string is already plain text
+    return rawOutput;
+  };
+
+  // --- Helper Function to Run a Demo and Wait for the Whole Output ---
+  const runDemoBuffered = async (demoName) => {
+    // Fetch demo results using async/await
+    const response = await fetch(`/run/${demoName}`);
+
+    if (!response.ok) {
+      // Handle HTTP errors (e.g., 404, 500)
+      throw new Error(`Server error: ${response.status} ${response.statusText}`);
+    }
+
+    const data = await response.json();
+    console.log("Received response:", data);
+
+    // Format and display the output
+    let formattedOutput = formatOutput(data.output);
+    if (data.truncated) {
+      formattedOutput += "\n\n[Output truncated: the demo exceeded the server's output limit]";
+    }
+    outputElement.textContent = formattedOutput;
+  };
+
+  // --- Helper Function to Render Demo Output as It Is Produced ---
+  const runDemoStreaming = async (demoName) => {
+    const response = await fetch(`/stream/${demoName}`);
+
+    if (!response.ok) {
+      throw new Error(`Server error: ${response.status} ${response.statusText}`);
+    }
+
+    const reader = response.body.getReader();
+    const decoder = new TextDecoder();
+    let received = false;
+
+    while (true) {
+      const { done, value } = await reader.read();
+      if (done) break;
+
+      // Replace the loading text with the first chunk, then append
+      const text = decoder.decode(value, { stream: true });
+      outputElement.textContent = received ? outputElement.textContent + text : text;
+      received = true;
+      outputElement.scrollTop = outputElement.scrollHeight;
+    }
+
+    outputElement.textContent += decoder.decode();
+    if (!received) {
+      outputElement.textContent = formatOutput("");
+    }
   };
 
   // --- Helper Function to Handle Demo Execution ---
@@ -25,21 +71,13 @@ document.addEventListener("DOMContentLoaded", () => {
     outputContainer.classList.add("loading");
 
     try {
-      // Fetch demo results using async/await
-      const response = await fetch(`/run/${demoName}`);
-
-      if (!response.ok) {
-        // Handle HTTP errors (e.g., 404, 500)
-        throw new Error(`Server error: ${response.status} ${response.statusText}`);
+      // Stream when the browser can read the response body incrementally
+      if (window.ReadableStream && window.TextDecoder) {
+        await runDemoStreaming(demoName);
+      } else {
+        await runDemoBuffered(demoName);
       }
 
-      const data = await response.json();
-      console.log("Received response:", data);
-
-      // Format and display the output
-      const formattedOutput = formatOutput(data.output);
-      outputElement.textContent = formattedOutput;
-
       // Auto-scroll to the bottom of the output
       outputElement.scrollTop = outputElement.scrollHeight;
     } catch (error) {